@@ -0,0 +1,242 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//An api response as it came off the wire, enough to run it back through PoloniexApi's response handling.
+		struct RecordedResponse
+		{
+			uint16_t status_;
+			std::string reasonPhrase_;
+			std::string contentType_;
+			std::string body_;
+			std::chrono::microseconds latency_;//request sent to body received
+		};
+
+		//Request identity for matching replayed responses: method, path and the parameters in name order. The nonce
+		//is left out since it differs every run.
+		inline std::string recordingKey(const std::string &method, const std::string &path, const std::unordered_map<std::string, std::string> &params)
+		{
+			std::vector<std::pair<std::string, std::string>> sorted(params.begin(), params.end());
+			std::sort(sorted.begin(), sorted.end());
+			std::string key = method + " " + path;
+			char separator = '?';
+			for(const auto &param : sorted)
+			{
+				if(param.first == "nonce")
+					continue;
+				key += separator + param.first + "=" + param.second;
+				separator = '&';
+			}
+			return key;
+		}
+
+		//Recording files are binary and append-only. The file starts with apiRecordingMagic_, then records:
+		//  'S' u64 session start (unix ms)
+		//  'R' u64 offset from session start (us) u32 latency (us) u16 status, then strings key, reason, content type, body
+		//Integers little endian, strings u32 length then bytes.
+		static const char apiRecordingMagic_[8] = { 'P', 'L', 'B', 'R', 'E', 'C', '1', '\n' };
+
+		//Appends every api response to file. One session record per run so several runs can share a file.
+		class ApiRecorder
+		{
+		public:
+			explicit ApiRecorder(const std::string &file) :
+				start_(std::chrono::steady_clock::now())
+			{
+				std::ifstream existing(file, std::ios::binary);
+				bool empty = !existing.is_open() || existing.peek() == std::ifstream::traits_type::eof();
+				existing.close();
+
+				out_.open(file, std::ios::binary | std::ios::app);
+				if(!out_.is_open())
+					throw std::runtime_error("Unable to open api recording file(" + file + ")");
+				if(empty)
+					out_.write(apiRecordingMagic_, sizeof(apiRecordingMagic_));
+
+				std::string record(1, 'S');
+				putInt(record, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()), 8);
+				write(record);
+			}
+
+		private://noncopyable
+			ApiRecorder(const ApiRecorder &) = delete;
+			ApiRecorder& operator=(const ApiRecorder &) = delete;
+
+		public:
+			void append(const std::string &key, const RecordedResponse &response)
+			{
+				std::string record(1, 'R');
+				record.reserve(32 + key.size() + response.reasonPhrase_.size() + response.contentType_.size() + response.body_.size());
+				putInt(record, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count()), 8);
+				putInt(record, static_cast<uint64_t>(std::min<int64_t>(response.latency_.count(), UINT32_MAX)), 4);
+				putInt(record, response.status_, 2);
+				putString(record, key);
+				putString(record, response.reasonPhrase_);
+				putString(record, response.contentType_);
+				putString(record, response.body_);
+				write(record);
+			}
+
+		private:
+			std::mutex mutex_;
+			std::ofstream out_;
+			std::chrono::steady_clock::time_point start_;
+
+			//flushed per record so a crash loses at most the response in flight
+			void write(const std::string &record)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				out_.write(record.data(), static_cast<std::streamsize>(record.size()));
+				out_.flush();
+			}
+
+			static void putInt(std::string &out, uint64_t value, int bytes)
+			{
+				for(int i = 0; i < bytes; ++i)
+					out += static_cast<char>((value >> (8 * i)) & 0xff);
+			}
+
+			static void putString(std::string &out, const std::string &str)
+			{
+				putInt(out, str.size(), 4);
+				out += str;
+			}
+		};
+
+		//Serves recorded responses back instead of the exchange. Each request gets the next unused response recorded
+		//for the same key, so retries and repeated polls play back in their original order.
+		class ApiReplay
+		{
+		public:
+			enum class Timing
+			{
+				ORIGINAL,//wait out each response's recorded latency
+				FAST     //answer immediately
+			};
+
+			ApiReplay(const std::string &file, Timing timing) :
+				timing_(timing)
+			{
+				std::ifstream in(file, std::ios::binary);
+				if(!in.is_open())
+					throw std::runtime_error("Unable to open api replay file(" + file + ")");
+				std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+				size_t pos = sizeof(apiRecordingMagic_);
+				if(data.size() < pos || !std::equal(apiRecordingMagic_, apiRecordingMagic_ + pos, data.begin()))
+					throw std::runtime_error("Not an api recording file(" + file + ")");
+
+				try
+				{
+					while(pos < data.size())
+					{
+						char type = data[pos++];
+						if(type == 'S')
+							getInt(data, pos, 8);
+						else if(type == 'R')
+						{
+							RecordedResponse response;
+							getInt(data, pos, 8);
+							response.latency_ = std::chrono::microseconds(getInt(data, pos, 4));
+							response.status_ = static_cast<uint16_t>(getInt(data, pos, 2));
+							std::string key = getString(data, pos);
+							response.reasonPhrase_ = getString(data, pos);
+							response.contentType_ = getString(data, pos);
+							response.body_ = getString(data, pos);
+							responses_[key].push_back(std::move(response));
+						}
+						else
+							throw std::runtime_error("Corrupt api recording file(" + file + ") at byte " + std::to_string(pos - 1));
+					}
+				}
+				catch(const Truncated &)
+				{
+					//last record cut short by a crash while recording
+				}
+			}
+
+		private://noncopyable
+			ApiReplay(const ApiReplay &) = delete;
+			ApiReplay& operator=(const ApiReplay &) = delete;
+
+		public:
+			//Throws when the recording has nothing (left) for this request.
+			RecordedResponse respond(const std::string &key)
+			{
+				RecordedResponse response;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					auto iter = responses_.find(key);
+					if(iter == responses_.end() || iter->second.empty())
+						throw std::runtime_error("api replay has no recorded response left for: " + key);
+					response = std::move(iter->second.front());
+					iter->second.pop_front();
+				}
+				if(timing_ == Timing::ORIGINAL)
+					std::this_thread::sleep_for(response.latency_);
+				return response;
+			}
+
+		private:
+			Timing timing_;
+			std::mutex mutex_;
+			std::map<std::string, std::deque<RecordedResponse>> responses_;
+
+			struct Truncated {};
+
+			static uint64_t getInt(const std::string &data, size_t &pos, int bytes)
+			{
+				if(data.size() - pos < static_cast<size_t>(bytes))
+					throw Truncated();
+				uint64_t value = 0;
+				for(int i = 0; i < bytes; ++i)
+					value |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+				pos += bytes;
+				return value;
+			}
+
+			static std::string getString(const std::string &data, size_t &pos)
+			{
+				size_t size = static_cast<size_t>(getInt(data, pos, 4));
+				if(data.size() - pos < size)
+					throw Truncated();
+				std::string str = data.substr(pos, size);
+				pos += size;
+				return str;
+			}
+		};
+	}
+}
@@ -0,0 +1,83 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "PoloniexLendingBot.hpp"
+#include "SpreadLendBacktest.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//The bot's settings file as the backtest tools read it: the intervals and each coin's settings, with the
+		//bot's defaults for whatever the file leaves out.
+		class BacktestSettings
+		{
+		public:
+			static const char *defaultFile() { return "config.json"; }
+
+			//A file named on the command line must exist; the default one falling back to built in defaults is
+			//only reported, so the tools still run on a machine without the bot's config.
+			BacktestSettings(const std::string &file, bool given)
+			{
+				if(filesystem::exists(file))
+					read_json(file, settings_);
+				else if(given)
+					throw std::invalid_argument("settings file " + file + " not found");
+				else
+					std::cerr << file << " not found, using built in default settings" << std::endl;
+			}
+
+			SpreadLendBacktest::Config defaults(const FixedAmount &balance, int loanHours) const
+			{
+				SpreadLendBacktest::Config config;
+				config.balance_ = balance;
+				config.loanDuration_ = std::chrono::hours(loanHours);
+				config.refreshInterval_ = std::chrono::seconds(settings_.get<int>("refreshLoansInterval", 60));
+				config.startupStatisticsInitializeInterval_ = std::chrono::seconds(settings_.get<int>("startupStatisticsInitializeInterval", 60 * 15));
+				config.strategyRateStatisticsWindow_ = std::chrono::seconds(settings_.get<int>("strategyRateStatisticsWindow", 60 * 15));
+				return config;
+			}
+
+			PoloniexLendingBot::Settings::Coin coin(const std::string &currency)
+			{
+				PoloniexLendingBot::Settings::Coin coin;
+				auto coinSettings = settings_.get_child_optional("CoinSettings." + currency);
+				try
+				{
+					if(coinSettings)
+						coin.ptree(*coinSettings);
+				}
+				catch(const std::invalid_argument &e)
+				{
+					throw std::invalid_argument("curCode(" + currency + ") " + e.what());
+				}
+				return coin;
+			}
+
+		private:
+			boost::property_tree::ptree settings_;
+		};
+	}
+}
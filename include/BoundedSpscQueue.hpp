@@ -0,0 +1,125 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tylawin
+{
+	//Fixed capacity ring between exactly one producer thread and one consumer thread. No locks: each index is
+	//written by one side only and published with release/acquire. push()/pop() wait by spinning, then yielding,
+	//then sleeping up to waitMax_, which is fine for handing off work that takes milliseconds (api calls).
+	template<typename T>
+	class BoundedSpscQueue
+	{
+	public:
+		static constexpr std::chrono::microseconds waitMax_{ 1000 };
+
+		explicit BoundedSpscQueue(size_t capacity) :
+			slots_(roundUpToPowerOf2(capacity)),
+			mask_(slots_.size() - 1)
+		{
+			if(capacity == 0)
+				throw std::invalid_argument("BoundedSpscQueue capacity must be > 0");
+		}
+
+		//Producer. Moves value in and returns true unless full.
+		bool tryPush(T &value)
+		{
+			size_t tail = tail_.load(std::memory_order_relaxed);
+			if(tail - head_.load(std::memory_order_acquire) == slots_.size())
+				return false;
+			slots_[tail & mask_] = std::move(value);
+			tail_.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		//Producer. Waits for room.
+		void push(T value)
+		{
+			for(unsigned attempt = 0; !tryPush(value); ++attempt)
+				wait(attempt);
+		}
+
+		//Producer. No more pushes; pop() returns false once the queue drains.
+		void close() { closed_.store(true, std::memory_order_release); }
+
+		//Consumer. Moves the oldest value out and returns true unless empty.
+		bool tryPop(T &value)
+		{
+			size_t head = head_.load(std::memory_order_relaxed);
+			if(head == tail_.load(std::memory_order_acquire))
+				return false;
+			value = std::move(slots_[head & mask_]);
+			head_.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		//Consumer. Waits for a value, false when closed and empty.
+		bool pop(T &value)
+		{
+			for(unsigned attempt = 0; ; ++attempt)
+			{
+				if(tryPop(value))
+					return true;
+				if(closed_.load(std::memory_order_acquire))
+					return tryPop(value);//pushes before close() are visible now
+				wait(attempt);
+			}
+		}
+
+		size_t capacity() const { return slots_.size(); }
+
+	private:
+		std::vector<T> slots_;
+		const size_t mask_;
+		alignas(64) std::atomic<size_t> head_{ 0 };//next pop, written by the consumer
+		alignas(64) std::atomic<size_t> tail_{ 0 };//next push, written by the producer
+		std::atomic<bool> closed_{ false };
+
+		BoundedSpscQueue(const BoundedSpscQueue &) = delete;
+		BoundedSpscQueue &operator=(const BoundedSpscQueue &) = delete;
+
+		static size_t roundUpToPowerOf2(size_t n)
+		{
+			size_t size = 1;
+			while(size < n)
+				size <<= 1;
+			return size;
+		}
+
+		static void wait(unsigned attempt)
+		{
+			if(attempt < 64)
+				return;
+			if(attempt < 128)
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::min<std::chrono::microseconds>(std::chrono::microseconds(10) * (attempt - 127), waitMax_));
+		}
+	};
+
+	template<typename T>
+	constexpr std::chrono::microseconds BoundedSpscQueue<T>::waitMax_;
+}
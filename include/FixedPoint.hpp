@@ -0,0 +1,313 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace tylawin
+{
+	template<unsigned N>
+	struct Pow10
+	{
+		static constexpr int64_t value = 10 * Pow10<N - 1>::value;
+	};
+	template<>
+	struct Pow10<0>
+	{
+		static constexpr int64_t value = 1;
+	};
+
+	enum class Rounding
+	{
+		DOWN,    //toward -infinity
+		UP,      //toward +infinity
+		HALF_UP, //to nearest, ties away from zero
+		HALF_EVEN, //to nearest, ties to the even neighbour
+		EXACT    //throw std::invalid_argument if any precision would be lost
+	};
+
+	//Signed decimal with Scale digits after the point, stored as an int64 count of 10^-Scale units.
+	//Parsing and formatting work on caller buffers without allocating. Arithmetic that would overflow
+	//throws std::overflow_error instead of wrapping.
+	template<unsigned Scale>
+	class FixedPoint
+	{
+		static_assert(Scale <= 18, "FixedPoint scale must fit in int64");
+
+	public:
+		typedef int64_t Raw;
+
+		//sign, 19 integer digits, point, Scale decimals
+		static constexpr size_t maxFormattedSize_ = 21 + Scale;
+
+		FixedPoint() : raw_(0) {}
+
+		static FixedPoint fromRaw(Raw raw)
+		{
+			FixedPoint result;
+			result.raw_ = raw;
+			return result;
+		}
+
+		static FixedPoint fromInteger(int64_t value)
+		{
+			return fromRaw(checkedMul(value, Pow10<Scale>::value));
+		}
+
+		//"[-]digits[.digits]"
+		static FixedPoint parse(const char *str, size_t size, Rounding rounding = Rounding::EXACT)
+		{
+			size_t i = 0;
+			bool negative = false;
+			if(i < size && (str[i] == '-' || str[i] == '+'))
+			{
+				negative = str[i] == '-';
+				++i;
+			}
+
+			bool anyDigit = false;
+			Raw integerPart = 0;
+			for(; i < size && str[i] != '.'; ++i)
+			{
+				integerPart = checkedAdd(checkedMul(integerPart, 10), digitAt(str, size, i));
+				anyDigit = true;
+			}
+
+			Raw fraction = 0;
+			unsigned fractionDigits = 0;
+			int firstDroppedDigit = -1;
+			bool droppedNonZero = false;
+			bool droppedNonZeroAfterFirst = false;
+			if(i < size)
+			{
+				for(++i; i < size; ++i)
+				{
+					Raw digit = digitAt(str, size, i);
+					anyDigit = true;
+					if(fractionDigits < Scale)
+					{
+						fraction = fraction * 10 + digit;
+						++fractionDigits;
+					}
+					else
+					{
+						if(firstDroppedDigit < 0)
+							firstDroppedDigit = static_cast<int>(digit);
+						else if(digit != 0)
+							droppedNonZeroAfterFirst = true;
+						if(digit != 0)
+							droppedNonZero = true;
+					}
+				}
+			}
+			if(!anyDigit)
+				throw std::invalid_argument("invalid number: " + std::string(str, size));
+			for(; fractionDigits < Scale; ++fractionDigits)
+				fraction *= 10;
+
+			Raw magnitude = checkedAdd(checkedMul(integerPart, Pow10<Scale>::value), fraction);
+			if(droppedNonZero)
+			{
+				bool roundMagnitudeUp = false;
+				switch(rounding)
+				{
+					case Rounding::DOWN:    roundMagnitudeUp = negative; break;
+					case Rounding::UP:      roundMagnitudeUp = !negative; break;
+					case Rounding::HALF_UP: roundMagnitudeUp = firstDroppedDigit >= 5; break;
+					case Rounding::HALF_EVEN:
+						roundMagnitudeUp = firstDroppedDigit > 5 || (firstDroppedDigit == 5 && (droppedNonZeroAfterFirst || magnitude % 2 != 0));
+						break;
+					case Rounding::EXACT:
+						throw std::invalid_argument(std::string(str, size) + " has more than " + std::to_string(Scale) + " decimal places");
+				}
+				if(roundMagnitudeUp)
+					magnitude = checkedAdd(magnitude, 1);
+			}
+
+			return fromRaw(negative ? -magnitude : magnitude);
+		}
+
+		static FixedPoint parse(const std::string &str, Rounding rounding = Rounding::EXACT)
+		{
+			return parse(str.data(), str.size(), rounding);
+		}
+
+		Raw raw() const { return raw_; }
+
+		//Writes at most maxFormattedSize_ chars (not null terminated) and returns the count.
+		//Fewer decimals than Scale rounds half up.
+		size_t format(char *out, unsigned decimals = Scale) const
+		{
+			if(decimals > Scale)
+				decimals = Scale;
+
+			uint64_t magnitude = raw_ < 0 ? 0 - static_cast<uint64_t>(raw_) : static_cast<uint64_t>(raw_);
+			uint64_t dropUnit = 1;
+			for(unsigned i = decimals; i < Scale; ++i)
+				dropUnit *= 10;
+			if(dropUnit > 1)
+				magnitude = (magnitude + dropUnit / 2) / dropUnit;
+
+			uint64_t decimalUnit = 1;
+			for(unsigned i = 0; i < decimals; ++i)
+				decimalUnit *= 10;
+			uint64_t integerPart = magnitude / decimalUnit;
+			uint64_t fraction = magnitude % decimalUnit;
+
+			size_t len = 0;
+			if(raw_ < 0 && magnitude != 0)
+				out[len++] = '-';
+
+			char digits[20];
+			size_t digitCount = 0;
+			do
+			{
+				digits[digitCount++] = static_cast<char>('0' + integerPart % 10);
+				integerPart /= 10;
+			} while(integerPart != 0);
+			while(digitCount != 0)
+				out[len++] = digits[--digitCount];
+
+			if(decimals != 0)
+			{
+				out[len++] = '.';
+				for(unsigned i = decimals; i != 0; --i)
+				{
+					out[len + i - 1] = static_cast<char>('0' + fraction % 10);
+					fraction /= 10;
+				}
+				len += decimals;
+			}
+			return len;
+		}
+
+		std::string toString(unsigned decimals = Scale) const
+		{
+			char buf[maxFormattedSize_];
+			return std::string(buf, format(buf, decimals));
+		}
+
+		FixedPoint divide(int64_t divisor, Rounding rounding) const
+		{
+			if(divisor == 0)
+				throw std::domain_error("FixedPoint divide by zero");
+			if(raw_ == std::numeric_limits<Raw>::min() && divisor == -1)
+				throw std::overflow_error("FixedPoint divide overflow");
+
+			Raw quotient = raw_ / divisor;
+			Raw remainder = raw_ % divisor;
+			if(remainder != 0)
+			{
+				bool negativeResult = (remainder < 0) != (divisor < 0);
+				switch(rounding)
+				{
+					case Rounding::DOWN:
+						if(negativeResult)
+							--quotient;
+						break;
+					case Rounding::UP:
+						if(!negativeResult)
+							++quotient;
+						break;
+					case Rounding::HALF_UP:
+					case Rounding::HALF_EVEN:
+					{
+						uint64_t twiceRemainder = 2 * (remainder < 0 ? 0 - static_cast<uint64_t>(remainder) : static_cast<uint64_t>(remainder));
+						uint64_t absDivisor = divisor < 0 ? 0 - static_cast<uint64_t>(divisor) : static_cast<uint64_t>(divisor);
+						bool tie = twiceRemainder == absDivisor;
+						if(twiceRemainder > absDivisor || (tie && (rounding == Rounding::HALF_UP || quotient % 2 != 0)))
+							quotient += negativeResult ? -1 : 1;
+						break;
+					}
+					case Rounding::EXACT:
+						throw std::invalid_argument(toString() + " / " + std::to_string(divisor) + " is not exact at " + std::to_string(Scale) + " decimal places");
+				}
+			}
+			return fromRaw(quotient);
+		}
+
+		FixedPoint operator-() const { return fromRaw(checkedSub(0, raw_)); }
+
+		FixedPoint &operator+=(const FixedPoint &rhs) { raw_ = checkedAdd(raw_, rhs.raw_); return *this; }
+		FixedPoint &operator-=(const FixedPoint &rhs) { raw_ = checkedSub(raw_, rhs.raw_); return *this; }
+		FixedPoint &operator*=(int64_t rhs) { raw_ = checkedMul(raw_, rhs); return *this; }
+
+		friend FixedPoint operator+(FixedPoint lhs, const FixedPoint &rhs) { return lhs += rhs; }
+		friend FixedPoint operator-(FixedPoint lhs, const FixedPoint &rhs) { return lhs -= rhs; }
+		friend FixedPoint operator*(FixedPoint lhs, int64_t rhs) { return lhs *= rhs; }
+
+		friend bool operator==(const FixedPoint &lhs, const FixedPoint &rhs) { return lhs.raw_ == rhs.raw_; }
+		friend bool operator!=(const FixedPoint &lhs, const FixedPoint &rhs) { return lhs.raw_ != rhs.raw_; }
+		friend bool operator<(const FixedPoint &lhs, const FixedPoint &rhs) { return lhs.raw_ < rhs.raw_; }
+		friend bool operator>(const FixedPoint &lhs, const FixedPoint &rhs) { return lhs.raw_ > rhs.raw_; }
+		friend bool operator<=(const FixedPoint &lhs, const FixedPoint &rhs) { return lhs.raw_ <= rhs.raw_; }
+		friend bool operator>=(const FixedPoint &lhs, const FixedPoint &rhs) { return lhs.raw_ >= rhs.raw_; }
+
+		friend std::ostream &operator<<(std::ostream &os, const FixedPoint &value)
+		{
+			char buf[maxFormattedSize_];
+			return os.write(buf, static_cast<std::streamsize>(value.format(buf)));
+		}
+
+		friend std::string to_string(const FixedPoint &value, unsigned decimals = Scale)
+		{
+			return value.toString(decimals);
+		}
+
+	private:
+		Raw raw_;
+
+		static Raw digitAt(const char *str, size_t size, size_t i)
+		{
+			if(str[i] < '0' || str[i] > '9')
+				throw std::invalid_argument("invalid number: " + std::string(str, size));
+			return str[i] - '0';
+		}
+
+		static Raw checkedAdd(Raw a, Raw b)
+		{
+			if((b > 0 && a > std::numeric_limits<Raw>::max() - b) || (b < 0 && a < std::numeric_limits<Raw>::min() - b))
+				throw std::overflow_error("FixedPoint add overflow");
+			return a + b;
+		}
+
+		static Raw checkedSub(Raw a, Raw b)
+		{
+			if((b < 0 && a > std::numeric_limits<Raw>::max() + b) || (b > 0 && a < std::numeric_limits<Raw>::min() + b))
+				throw std::overflow_error("FixedPoint subtract overflow");
+			return a - b;
+		}
+
+		static Raw checkedMul(Raw a, Raw b)
+		{
+			if(a == 0 || b == 0)
+				return 0;
+			if((a == -1 && b == std::numeric_limits<Raw>::min()) || (b == -1 && a == std::numeric_limits<Raw>::min()))
+				throw std::overflow_error("FixedPoint multiply overflow");
+			if((a > 0 && b > 0 && a > std::numeric_limits<Raw>::max() / b)
+				|| (a < 0 && b < 0 && a < std::numeric_limits<Raw>::max() / b)
+				|| (a > 0 && b < 0 && b < std::numeric_limits<Raw>::min() / a)
+				|| (a < 0 && b > 0 && a < std::numeric_limits<Raw>::min() / b))
+				throw std::overflow_error("FixedPoint multiply overflow");
+			return a * b;//checked first, signed overflow is undefined
+		}
+	};
+}
@@ -0,0 +1,288 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Last entryCount api requests and responses in a fixed size memory mapped file, oldest overwritten first.
+		//Cheap enough to leave on: the request path only copies the text into a queue and a writer thread copies it
+		//into the mapping, so the file survives a crash or kill without any formatting or syscalls per request.
+		//Bodies longer than a slot are cut short. FlightRecorderDump formats the file.
+		class FlightRecorder
+		{
+		public:
+			enum Flags : uint16_t
+			{
+				AUTHENTICATED = 1,
+				TRANSPORT_ERROR = 2,//body is the error text, no response came back
+				TRUNCATED = 4
+			};
+
+			struct FileHeader
+			{
+				char magic_[8];
+				uint32_t version_;
+				uint32_t entryCount_;
+				uint32_t entryBytes_;//slot size including SlotHeader
+				uint32_t reserved_;
+				uint64_t nextSequence_;
+			};
+
+			//sequence_ is written last; 0 marks a slot that is empty or mid write
+			struct SlotHeader
+			{
+				uint64_t sequence_;
+				uint64_t unixTimeUs_;
+				uint32_t latencyUs_;
+				uint16_t status_;
+				uint16_t flags_;
+				uint32_t requestBytes_;
+				uint32_t bodyBytes_;//stored
+				uint32_t bodyTotalBytes_;//as received
+				uint32_t reserved_;
+			};
+
+			static const char *magic() { return "PLBFLT1"; }
+			static const uint32_t version_ = 1;
+
+			struct Entry
+			{
+				std::chrono::system_clock::time_point time_;
+				std::chrono::microseconds latency_;
+				uint16_t status_;
+				uint16_t flags_;
+				std::string request_;//method path?params, without the nonce
+				std::string body_;
+				size_t bodyTotalBytes_;
+			};
+
+			//Reuses an existing file of the same shape so history carries over restarts.
+			FlightRecorder(const std::string &file, uint32_t entryCount, uint32_t entryBytes) :
+				dropped_(0),
+				stop_(false)
+			{
+				if(entryCount == 0 || entryBytes <= sizeof(SlotHeader))
+					throw std::invalid_argument("FlightRecorder needs entryCount > 0 and entryBytes > " + std::to_string(sizeof(SlotHeader)));
+				if(entryBytes % 8 != 0)//keeps every SlotHeader in the mapping aligned
+					throw std::invalid_argument("FlightRecorder needs entryBytes to be a multiple of 8");
+
+				uint64_t fileBytes = sizeof(FileHeader) + static_cast<uint64_t>(entryCount) * entryBytes;
+				bool reuse = false;
+				{
+					std::ifstream existing(file, std::ios::binary | std::ios::ate);
+					if(existing.is_open() && static_cast<uint64_t>(existing.tellg()) == fileBytes)
+					{
+						FileHeader header;
+						existing.seekg(0);
+						existing.read(reinterpret_cast<char *>(&header), sizeof(header));
+						reuse = existing && memcmp(header.magic_, magic(), sizeof(header.magic_)) == 0 && header.version_ == version_
+							&& header.entryCount_ == entryCount && header.entryBytes_ == entryBytes;
+					}
+				}
+				if(!reuse)
+				{
+					std::ofstream create(file, std::ios::binary | std::ios::trunc);
+					if(!create.is_open())
+						throw std::runtime_error("Unable to create flight recorder file(" + file + ")");
+					FileHeader header = FileHeader();
+					memcpy(header.magic_, magic(), sizeof(header.magic_));
+					header.version_ = version_;
+					header.entryCount_ = entryCount;
+					header.entryBytes_ = entryBytes;
+					header.nextSequence_ = 1;
+					create.write(reinterpret_cast<const char *>(&header), sizeof(header));
+					std::vector<char> zeros(entryBytes, 0);
+					for(uint32_t i = 0; i < entryCount; ++i)
+						create.write(zeros.data(), zeros.size());
+					if(!create)
+						throw std::runtime_error("Unable to size flight recorder file(" + file + ")");
+				}
+
+				mapping_ = boost::interprocess::file_mapping(file.c_str(), boost::interprocess::read_write);
+				region_ = boost::interprocess::mapped_region(mapping_, boost::interprocess::read_write);
+				header_ = static_cast<FileHeader *>(region_.get_address());
+
+				//a crash can leave the header behind the slots
+				const char *slots = static_cast<const char *>(region_.get_address()) + sizeof(FileHeader);
+				for(uint32_t i = 0; i < entryCount; ++i)
+					header_->nextSequence_ = std::max(header_->nextSequence_, reinterpret_cast<const SlotHeader *>(slots + static_cast<size_t>(i) * entryBytes)->sequence_ + 1);
+
+				writer_ = std::thread([this]() { writeLoop(); });
+			}
+
+			~FlightRecorder()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					stop_ = true;
+				}
+				cv_.notify_all();
+				if(writer_.joinable())
+					writer_.join();
+				region_.flush();
+			}
+
+		private://noncopyable
+			FlightRecorder(const FlightRecorder &) = delete;
+			FlightRecorder& operator=(const FlightRecorder &) = delete;
+
+		public:
+			//Never blocks on the file. Entries are dropped (and counted) if the writer falls maxPending_ behind.
+			void record(Entry &&entry)
+			{
+				size_t capacity = header_->entryBytes_ - sizeof(SlotHeader);
+				entry.bodyTotalBytes_ = entry.body_.size();
+				if(entry.request_.size() > capacity)
+					entry.request_.resize(capacity);
+				if(entry.request_.size() + entry.body_.size() > capacity)
+				{
+					entry.body_.resize(capacity - entry.request_.size());
+					entry.flags_ |= TRUNCATED;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if(pending_.size() >= maxPending_)
+					{
+						++dropped_;
+						return;
+					}
+					pending_.push_back(std::move(entry));
+				}
+				cv_.notify_one();
+			}
+
+			uint64_t dropped() const { return dropped_; }
+
+		private:
+			static const size_t maxPending_ = 64;
+
+			boost::interprocess::file_mapping mapping_;
+			boost::interprocess::mapped_region region_;
+			FileHeader *header_;
+
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			std::deque<Entry> pending_;
+			std::atomic<uint64_t> dropped_;
+			bool stop_;
+			std::thread writer_;
+
+			void writeLoop()
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while(true)
+				{
+					cv_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+					if(pending_.empty())
+						return;//stopping and drained
+					Entry entry = std::move(pending_.front());
+					pending_.pop_front();
+					lock.unlock();
+					write(entry);
+					lock.lock();
+				}
+			}
+
+			void write(const Entry &entry)
+			{
+				uint64_t sequence = header_->nextSequence_++;
+				char *slotAddress = static_cast<char *>(region_.get_address()) + sizeof(FileHeader) + (sequence % header_->entryCount_) * header_->entryBytes_;
+				SlotHeader *slot = reinterpret_cast<SlotHeader *>(slotAddress);
+
+				slot->sequence_ = 0;
+				std::atomic_thread_fence(std::memory_order_release);
+				slot->unixTimeUs_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(entry.time_.time_since_epoch()).count());
+				slot->latencyUs_ = static_cast<uint32_t>(std::min<int64_t>(entry.latency_.count(), UINT32_MAX));
+				slot->status_ = entry.status_;
+				slot->flags_ = entry.flags_;
+				slot->requestBytes_ = static_cast<uint32_t>(entry.request_.size());
+				slot->bodyBytes_ = static_cast<uint32_t>(entry.body_.size());
+				slot->bodyTotalBytes_ = static_cast<uint32_t>(std::min<size_t>(entry.bodyTotalBytes_, UINT32_MAX));
+				memcpy(slotAddress + sizeof(SlotHeader), entry.request_.data(), entry.request_.size());
+				memcpy(slotAddress + sizeof(SlotHeader) + entry.request_.size(), entry.body_.data(), entry.body_.size());
+				std::atomic_thread_fence(std::memory_order_release);
+				slot->sequence_ = sequence;
+			}
+		};
+
+		//Read only view of a flight recorder file. Entries come back oldest first and point into the mapping, so
+		//nothing is copied or formatted until the caller asks for it.
+		class FlightRecorderReader
+		{
+		public:
+			struct EntryView
+			{
+				const FlightRecorder::SlotHeader *header_;
+				const char *request_;
+				const char *body_;
+			};
+
+			explicit FlightRecorderReader(const std::string &file) :
+				mapping_(file.c_str(), boost::interprocess::read_only),
+				region_(mapping_, boost::interprocess::read_only)
+			{
+				if(region_.get_size() < sizeof(FlightRecorder::FileHeader))
+					throw std::runtime_error("Not a flight recorder file(" + file + ")");
+				header_ = static_cast<const FlightRecorder::FileHeader *>(region_.get_address());
+				if(memcmp(header_->magic_, FlightRecorder::magic(), sizeof(header_->magic_)) != 0 || header_->version_ != FlightRecorder::version_
+					|| region_.get_size() < sizeof(FlightRecorder::FileHeader) + static_cast<uint64_t>(header_->entryCount_) * header_->entryBytes_)
+					throw std::runtime_error("Not a flight recorder file(" + file + ")");
+
+				const char *slots = static_cast<const char *>(region_.get_address()) + sizeof(FlightRecorder::FileHeader);
+				size_t capacity = header_->entryBytes_ - sizeof(FlightRecorder::SlotHeader);
+				for(uint32_t i = 0; i < header_->entryCount_; ++i)
+				{
+					const char *slotAddress = slots + static_cast<size_t>(i) * header_->entryBytes_;
+					auto slot = reinterpret_cast<const FlightRecorder::SlotHeader *>(slotAddress);
+					if(slot->sequence_ == 0 || static_cast<uint64_t>(slot->requestBytes_) + slot->bodyBytes_ > capacity)
+						continue;
+					EntryView view = { slot, slotAddress + sizeof(FlightRecorder::SlotHeader), slotAddress + sizeof(FlightRecorder::SlotHeader) + slot->requestBytes_ };
+					entries_.push_back(view);
+				}
+				std::sort(entries_.begin(), entries_.end(), [](const EntryView &a, const EntryView &b) { return a.header_->sequence_ < b.header_->sequence_; });
+			}
+
+			const std::vector<EntryView> &entries() const { return entries_; }
+
+		private:
+			boost::interprocess::file_mapping mapping_;
+			boost::interprocess::mapped_region region_;
+			const FlightRecorder::FileHeader *header_;
+			std::vector<EntryView> entries_;
+		};
+	}
+}
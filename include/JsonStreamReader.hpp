@@ -0,0 +1,375 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	//Forward only reader over json text. Values are read in document order straight out of the buffer so
+	//decoders can fill their own types without building a web::json::value tree first.
+	//Throws std::runtime_error on malformed input.
+	class JsonStreamReader
+	{
+	public:
+		//Points into the reader's buffer (or scratch space for strings with escapes). Valid until the next read.
+		struct Slice
+		{
+			const char *data_;
+			size_t size_;
+
+			bool operator==(const char *str) const
+			{
+				return size_ == strlen(str) && memcmp(data_, str, size_) == 0;
+			}
+			bool operator!=(const char *str) const { return !(*this == str); }
+
+			std::string str() const { return std::string(data_, size_); }
+		};
+
+		enum class Type
+		{
+			OBJECT,
+			ARRAY,
+			STRING,
+			NUMBER,
+			BOOLEAN,
+			NULL_VALUE
+		};
+
+		JsonStreamReader(const char *data, size_t size) :
+			begin_(data),
+			pos_(data),
+			end_(data + size)
+		{}
+
+		explicit JsonStreamReader(const std::string &text) :
+			JsonStreamReader(text.data(), text.size())
+		{}
+
+		Type peekType()
+		{
+			skipWhitespace();
+			if(pos_ == end_)
+				fail("unexpected end");
+			switch(*pos_)
+			{
+				case '{': return Type::OBJECT;
+				case '[': return Type::ARRAY;
+				case '"': return Type::STRING;
+				case 't': case 'f': return Type::BOOLEAN;
+				case 'n': return Type::NULL_VALUE;
+				default: return Type::NUMBER;
+			}
+		}
+
+		void beginObject()
+		{
+			expect('{');
+			firstInScope_.push_back(true);
+		}
+
+		//Reads the next key of the current object. Returns false, consuming the '}', when the object ends.
+		bool nextKey(Slice &key)
+		{
+			if(!nextInScope('}'))
+				return false;
+			key = readString();
+			expect(':');
+			return true;
+		}
+
+		void beginArray()
+		{
+			expect('[');
+			firstInScope_.push_back(true);
+		}
+
+		//Returns true if another element follows. Returns false, consuming the ']', when the array ends.
+		bool nextElement()
+		{
+			return nextInScope(']');
+		}
+
+		Slice readString()
+		{
+			expect('"');
+			const char *start = pos_;
+			while(pos_ != end_ && *pos_ != '"' && *pos_ != '\\')
+				++pos_;
+			if(pos_ == end_)
+				fail("unterminated string");
+			if(*pos_ == '"')
+			{
+				Slice slice = { start, static_cast<size_t>(pos_ - start) };
+				++pos_;
+				return slice;
+			}
+
+			scratch_.assign(start, pos_);
+			while(true)
+			{
+				if(pos_ == end_)
+					fail("unterminated string");
+				char ch = *pos_++;
+				if(ch == '"')
+					break;
+				if(ch != '\\')
+				{
+					scratch_ += ch;
+					continue;
+				}
+				if(pos_ == end_)
+					fail("unterminated escape");
+				switch(*pos_++)
+				{
+					case '"':  scratch_ += '"';  break;
+					case '\\': scratch_ += '\\'; break;
+					case '/':  scratch_ += '/';  break;
+					case 'b':  scratch_ += '\b'; break;
+					case 'f':  scratch_ += '\f'; break;
+					case 'n':  scratch_ += '\n'; break;
+					case 'r':  scratch_ += '\r'; break;
+					case 't':  scratch_ += '\t'; break;
+					case 'u':  appendUtf8(readHex4()); break;
+					default: fail("invalid escape");
+				}
+			}
+			Slice slice = { scratch_.data(), scratch_.size() };
+			return slice;
+		}
+
+		//Accepts a number or a quoted number. ("autoRenew":0 and "id":"123" both show up in api responses)
+		int64_t readInteger()
+		{
+			skipWhitespace();
+			bool quoted = pos_ != end_ && *pos_ == '"';
+			if(quoted)
+				++pos_;
+			bool negative = pos_ != end_ && *pos_ == '-';
+			if(negative)
+				++pos_;
+			uint64_t value = readDigits();
+			if(quoted)
+				expect('"');
+			if(value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+				fail("integer overflow");
+			return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+		}
+
+		uint64_t readUnsigned()
+		{
+			skipWhitespace();
+			bool quoted = pos_ != end_ && *pos_ == '"';
+			if(quoted)
+				++pos_;
+			uint64_t value = readDigits();
+			if(quoted)
+				expect('"');
+			return value;
+		}
+
+		bool readBoolean()
+		{
+			skipWhitespace();
+			if(matchLiteral("true"))
+				return true;
+			if(matchLiteral("false"))
+				return false;
+			fail("expected boolean");
+			return false;
+		}
+
+		void skipValue()
+		{
+			skipWhitespace();
+			if(pos_ == end_)
+				fail("unexpected end");
+
+			if(*pos_ == '"')
+			{
+				skipString();
+				return;
+			}
+			if(*pos_ != '{' && *pos_ != '[')
+			{
+				//number or literal
+				while(pos_ != end_ && *pos_ != ',' && *pos_ != '}' && *pos_ != ']' && !isWhitespace(*pos_))
+					++pos_;
+				return;
+			}
+
+			size_t depth = 0;
+			do
+			{
+				if(pos_ == end_)
+					fail("unexpected end");
+				char ch = *pos_;
+				if(ch == '"')
+				{
+					skipString();
+					continue;
+				}
+				if(ch == '{' || ch == '[')
+					++depth;
+				else if(ch == '}' || ch == ']')
+					--depth;
+				++pos_;
+			} while(depth != 0);
+		}
+
+		//true when only whitespace is left
+		bool atEnd()
+		{
+			skipWhitespace();
+			return pos_ == end_;
+		}
+
+	private:
+		const char *begin_;
+		const char *pos_;
+		const char *end_;
+		std::vector<bool> firstInScope_;
+		std::string scratch_;
+
+		static bool isWhitespace(char ch)
+		{
+			return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+		}
+
+		void skipWhitespace()
+		{
+			while(pos_ != end_ && isWhitespace(*pos_))
+				++pos_;
+		}
+
+		[[noreturn]] void fail(const char *what) const
+		{
+			throw std::runtime_error(std::string("json: ") + what + " at offset " + std::to_string(pos_ - begin_));
+		}
+
+		void expect(char ch)
+		{
+			skipWhitespace();
+			if(pos_ == end_ || *pos_ != ch)
+				fail((std::string("expected '") + ch + "'").c_str());
+			++pos_;
+		}
+
+		bool nextInScope(char close)
+		{
+			if(firstInScope_.empty())
+				fail("not in object or array");
+			skipWhitespace();
+			if(pos_ != end_ && *pos_ == close)
+			{
+				++pos_;
+				firstInScope_.pop_back();
+				return false;
+			}
+			if(firstInScope_.back())
+				firstInScope_.back() = false;
+			else
+				expect(',');
+			return true;
+		}
+
+		bool matchLiteral(const char *literal)
+		{
+			size_t len = strlen(literal);
+			if(static_cast<size_t>(end_ - pos_) < len || memcmp(pos_, literal, len) != 0)
+				return false;
+			pos_ += len;
+			return true;
+		}
+
+		uint64_t readDigits()
+		{
+			if(pos_ == end_ || *pos_ < '0' || *pos_ > '9')
+				fail("expected digit");
+			uint64_t value = 0;
+			while(pos_ != end_ && *pos_ >= '0' && *pos_ <= '9')
+			{
+				uint64_t digit = static_cast<uint64_t>(*pos_ - '0');
+				if(value > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+					fail("integer overflow");
+				value = value * 10 + digit;
+				++pos_;
+			}
+			return value;
+		}
+
+		void skipString()
+		{
+			++pos_;//opening quote
+			while(pos_ != end_ && *pos_ != '"')
+			{
+				if(*pos_ == '\\')
+					++pos_;
+				if(pos_ != end_)
+					++pos_;
+			}
+			if(pos_ == end_)
+				fail("unterminated string");
+			++pos_;
+		}
+
+		uint32_t readHex4()
+		{
+			if(end_ - pos_ < 4)
+				fail("short unicode escape");
+			uint32_t value = 0;
+			for(int i = 0; i < 4; ++i, ++pos_)
+			{
+				char ch = *pos_;
+				value <<= 4;
+				if(ch >= '0' && ch <= '9')
+					value |= static_cast<uint32_t>(ch - '0');
+				else if(ch >= 'a' && ch <= 'f')
+					value |= static_cast<uint32_t>(ch - 'a' + 10);
+				else if(ch >= 'A' && ch <= 'F')
+					value |= static_cast<uint32_t>(ch - 'A' + 10);
+				else
+					fail("invalid unicode escape");
+			}
+			return value;
+		}
+
+		//surrogate pairs are not combined; api responses don't contain any
+		void appendUtf8(uint32_t codePoint)
+		{
+			if(codePoint < 0x80)
+				scratch_ += static_cast<char>(codePoint);
+			else if(codePoint < 0x800)
+			{
+				scratch_ += static_cast<char>(0xc0 | (codePoint >> 6));
+				scratch_ += static_cast<char>(0x80 | (codePoint & 0x3f));
+			}
+			else
+			{
+				scratch_ += static_cast<char>(0xe0 | (codePoint >> 12));
+				scratch_ += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+				scratch_ += static_cast<char>(0x80 | (codePoint & 0x3f));
+			}
+		}
+	};
+}
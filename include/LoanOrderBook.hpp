@@ -0,0 +1,169 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "FixedPoint.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		typedef FixedPoint<8> FixedAmount;//exchange amount precision
+		typedef FixedPoint<6> FixedRate;//exchange rate precision, one raw unit is the minimum rate increment
+
+		//One side of a loan order book, kept in rate order in one contiguous array. Offers with equal
+		//rates stay in insertion order, same as the std::multimap this replaces, so scans see the same sequence.
+		//A rate's tick is its FixedRate raw value. A dense ladder over the first denseTicks_ ticks above the
+		//best rate maps a tick to its first offer in O(1); lookups further out fall back to a binary search.
+		//Running amount totals are kept alongside so "how deep until x coins" is a binary search too.
+		class LoanOrderBook
+		{
+		public:
+			typedef FixedRate::Raw Tick;
+			static constexpr Tick denseTicks_ = 4096;
+
+			struct Offer
+			{
+				FixedRate rate_;
+				FixedAmount amount_;
+				uint16_t rangeMin_, rangeMax_;
+
+				Tick tick() const { return rate_.raw(); }
+			};
+			typedef std::vector<Offer>::const_iterator const_iterator;
+			typedef std::vector<Offer>::const_reverse_iterator const_reverse_iterator;
+
+			void insert(const FixedRate &rate, const FixedAmount &amount, uint16_t rangeMin, uint16_t rangeMax)
+			{
+				Offer offer = { rate, amount, rangeMin, rangeMax };
+
+				//api sends offers sorted so this is almost always an append
+				if(offers_.empty() || !(offer.rate_ < offers_.back().rate_))
+				{
+					offers_.push_back(offer);
+					cumulativeAmounts_.push_back(cumulativeAmounts_.empty() ? amount : cumulativeAmounts_.back() + amount);
+					extendLadder(offers_.size() - 1);
+				}
+				else
+				{
+					auto pos = std::upper_bound(offers_.begin(), offers_.end(), offer.rate_, [](const FixedRate &r, const Offer &o) { return r < o.rate_; });
+					offers_.insert(pos, offer);
+					rebuildIndexes();
+				}
+			}
+
+			//Keeps the storage for the next fill.
+			void clear()
+			{
+				offers_.clear();
+				cumulativeAmounts_.clear();
+				ladder_.clear();
+			}
+
+			//Keeps the best count offers.
+			void truncate(size_t count)
+			{
+				if(count >= offers_.size())
+					return;
+				offers_.erase(offers_.begin() + static_cast<std::ptrdiff_t>(count), offers_.end());
+				rebuildIndexes();
+			}
+
+			size_t size() const { return offers_.size(); }
+			bool empty() const { return offers_.empty(); }
+			const_iterator begin() const { return offers_.begin(); }
+			const_iterator end() const { return offers_.end(); }
+			const_reverse_iterator rbegin() const { return offers_.rbegin(); }
+			const_reverse_iterator rend() const { return offers_.rend(); }
+			const Offer &front() const { return offers_.front(); }
+			const Offer &back() const { return offers_.back(); }
+			const Offer &operator[](size_t i) const { return offers_[i]; }
+
+			//Sum of the amounts of offers [0, i].
+			const FixedAmount &cumulativeAmount(size_t i) const { return cumulativeAmounts_[i]; }
+
+			//Index of the first offer where the running amount total reaches amount, size() if it never does.
+			size_t firstReachingCumulativeAmount(const FixedAmount &amount) const
+			{
+				return static_cast<size_t>(std::lower_bound(cumulativeAmounts_.begin(), cumulativeAmounts_.end(), amount) - cumulativeAmounts_.begin());
+			}
+
+			//Index of the first offer with tick >= tick, size() if there is none.
+			size_t lowerBound(Tick tick) const
+			{
+				if(offers_.empty() || tick <= offers_.front().tick())
+					return 0;
+				if(tick > offers_.back().tick())
+					return offers_.size();
+
+				Tick offset = tick - offers_.front().tick();
+				if(offset < static_cast<Tick>(ladder_.size()))
+					return ladder_[static_cast<size_t>(offset)];
+
+				return static_cast<size_t>(std::lower_bound(offers_.begin(), offers_.end(), tick, [](const Offer &o, Tick t) { return o.tick() < t; }) - offers_.begin());
+			}
+
+			//Total amount offered at exactly this tick.
+			FixedAmount amountAt(Tick tick) const
+			{
+				FixedAmount amount;
+				for(size_t i = lowerBound(tick); i < offers_.size() && offers_[i].tick() == tick; ++i)
+					amount += offers_[i].amount_;
+				return amount;
+			}
+
+		private:
+			std::vector<Offer> offers_;
+			std::vector<FixedAmount> cumulativeAmounts_;
+			//ladder_[t] = index of the first offer with tick >= front().tick() + t
+			std::vector<uint32_t> ladder_;
+
+			//index is the last offer and has the highest tick so far
+			void extendLadder(size_t index)
+			{
+				if(index == 0)
+				{
+					ladder_.assign(1, 0);
+					return;
+				}
+
+				Tick last = std::min<Tick>(offers_[index].tick() - offers_.front().tick(), denseTicks_ - 1);
+				while(static_cast<Tick>(ladder_.size()) <= last)
+					ladder_.push_back(static_cast<uint32_t>(index));
+			}
+
+			void rebuildIndexes()
+			{
+				ladder_.clear();
+				cumulativeAmounts_.clear();
+				FixedAmount sum;
+				for(size_t i = 0; i < offers_.size(); ++i)
+				{
+					sum += offers_[i].amount_;
+					cumulativeAmounts_.push_back(sum);
+					extendLadder(i);
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,451 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "cpprest_utilities.hpp"
+#include "JsonStreamReader.hpp"
+#include "LoanOrdersCache.hpp"
+
+#include <cpprest/ws_client.h>
+
+#include <boost/optional.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Keeps loan order books current from a websocket push feed so they don't have to be polled.
+		//Messages follow the poloniex push api layout, one json array each:
+		//  client: {"command":"subscribe","channel":"BTC"} / {"command":"unsubscribe","channel":"BTC"}
+		//  server: [1010]                                   heartbeat
+		//          ["BTC", seq, [update, ...]]              updates for one book, seq counts up by one
+		//  update: ["i", {"offers":[["0.00020000","1.5"],...], "demands":[...]}]  full snapshot, restarts seq
+		//          ["o", side, "0.00020000", "1.5"]         side 0 offers 1 demands, amount "0" removes the rate
+		//Books are kept by rate level, so offers sharing a rate show up as one offer with the summed amount.
+		//A sequence gap drops that book and resubscribes for a new snapshot. A book only answers while the
+		//connection is up and heard from within staleAfter_; otherwise callers go back to polling.
+		class LoanOrderBookFeed
+		{
+		public:
+			struct Settings
+			{
+				std::string uri_;
+				std::chrono::milliseconds staleAfter_;
+				std::chrono::seconds reconnectInterval_;
+
+				Settings() :
+					staleAfter_(5000),
+					reconnectInterval_(10)
+				{}
+			};
+
+			struct Stats
+			{
+				uint64_t connects_ = 0, disconnects_ = 0;
+				uint64_t snapshots_ = 0, updates_ = 0, gaps_ = 0;
+				uint64_t served_ = 0, notReady_ = 0;//books answered from the feed vs left to polling
+
+				std::string toString() const
+				{
+					std::ostringstream os;
+					os << "connects:" << connects_ << " disconnects:" << disconnects_ << " snapshots:" << snapshots_ << " updates:" << updates_
+						<< " gaps:" << gaps_ << " served:" << served_ << " notReady:" << notReady_;
+					return os.str();
+				}
+			};
+
+			explicit LoanOrderBookFeed(const Settings &settings) :
+				settings_(settings),
+				connected_(false),
+				stop_(false)
+			{
+				supervisor_ = std::thread([this]() { supervise(); });
+			}
+
+			~LoanOrderBookFeed()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					stop_ = true;
+				}
+				cv_.notify_all();
+				if(supervisor_.joinable())
+					supervisor_.join();
+				closeClient();
+			}
+
+		private://noncopyable
+			LoanOrderBookFeed(const LoanOrderBookFeed &) = delete;
+			LoanOrderBookFeed& operator=(const LoanOrderBookFeed &) = delete;
+
+		public:
+			//Best limit levels of the pushed book (whole book when limit is none), or none when the feed can't vouch
+			//for it right now. The first ask for a currency subscribes to it.
+			boost::optional<LoanOrders> find(const std::string &currency, const boost::optional<uint16_t> &limit, bool includeDemands)
+			{
+				bool subscribe = false;
+				boost::optional<LoanOrders> orders;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					subscribe = subscriptions_.insert(currency).second && connected_;
+					auto iter = books_.find(currency);
+					if(connected_ && iter != books_.end() && iter->second.synced_ && std::chrono::steady_clock::now() - lastMessage_ <= settings_.staleAfter_)
+					{
+						orders = LoanOrders();
+						copyLevels(iter->second.offers_, limit, orders->offers_);
+						if(includeDemands)
+							copyLevels(iter->second.demands_, limit, orders->demands_);
+						++stats_.served_;
+					}
+					else
+						++stats_.notReady_;
+				}
+				if(subscribe)
+					send("subscribe", currency);
+				return orders;
+			}
+
+			Stats stats()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return stats_;
+			}
+
+		private:
+			typedef std::map<FixedRate::Raw, FixedAmount> Levels;
+
+			struct Book
+			{
+				Levels offers_, demands_;
+				uint64_t sequence_ = 0;
+				bool synced_ = false;
+			};
+
+			Settings settings_;
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			std::set<std::string> subscriptions_;
+			std::map<std::string, Book> books_;
+			std::chrono::steady_clock::time_point lastMessage_;
+			bool connected_;
+			bool stop_;
+			Stats stats_;
+			std::thread supervisor_;
+
+			//Swapped only by the supervisor thread. Handlers of a replaced client are ignored by generation.
+			std::mutex clientMutex_;
+			std::shared_ptr<web::websockets::client::websocket_callback_client> client_;
+			uint64_t generation_ = 0;
+
+			static void copyLevels(const Levels &levels, const boost::optional<uint16_t> &limit, LoanOrderBook &side)
+			{
+				size_t count = 0;
+				for(const auto &level : levels)
+				{
+					if(limit && count++ >= *limit)
+						break;
+					side.insert(FixedRate::fromRaw(level.first), level.second, 0, 0);
+				}
+			}
+
+			//(Re)connects while disconnected and drops connections that went quiet.
+			void supervise()
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while(!stop_)
+				{
+					if(connected_ && std::chrono::steady_clock::now() - lastMessage_ > settings_.staleAfter_ * 3)
+					{
+						markDisconnected();
+						lock.unlock();
+						closeClient();
+						lock.lock();
+					}
+					if(!connected_)
+					{
+						lock.unlock();
+						connect();
+						lock.lock();
+					}
+					cv_.wait_for(lock, connected_ ? settings_.staleAfter_ : std::chrono::duration_cast<std::chrono::milliseconds>(settings_.reconnectInterval_));
+				}
+			}
+
+			//mutex_ held
+			void markDisconnected()
+			{
+				if(connected_)
+					++stats_.disconnects_;
+				connected_ = false;
+				for(auto &book : books_)
+					book.second.synced_ = false;
+			}
+
+			void connect()
+			{
+				auto client = std::make_shared<web::websockets::client::websocket_callback_client>();
+				uint64_t generation;
+				{
+					std::lock_guard<std::mutex> lock(clientMutex_);
+					generation = ++generation_;
+				}
+
+				client->set_message_handler([this, generation](const web::websockets::client::websocket_incoming_message &message) {
+					if(message.message_type() != web::websockets::client::websocket_message_type::text_message)
+						return;
+					std::string text = message.extract_string().get();
+					std::lock_guard<std::mutex> lock(mutex_);
+					if(!isCurrent(generation))
+						return;
+					lastMessage_ = std::chrono::steady_clock::now();
+					try
+					{
+						onMessage(text);
+					}
+					catch(const std::exception &)
+					{
+						//malformed message: resync everything rather than trust the books
+						for(auto &book : books_)
+							resync(book.first, book.second);
+					}
+				});
+				client->set_close_handler([this, generation](web::websockets::client::websocket_close_status, const utility::string_t &, const std::error_code &) {
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						if(!isCurrent(generation))
+							return;
+						markDisconnected();
+					}
+					cv_.notify_all();
+				});
+
+				try
+				{
+					client->connect(web::uri(CppRest::Utilities::s2u(settings_.uri_))).wait();
+				}
+				catch(const std::exception &)
+				{
+					return;//supervisor retries after reconnectInterval_
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(clientMutex_);
+					client_ = client;
+				}
+				std::vector<std::string> channels;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					connected_ = true;
+					lastMessage_ = std::chrono::steady_clock::now();
+					++stats_.connects_;
+					books_.clear();
+					channels.assign(subscriptions_.begin(), subscriptions_.end());
+				}
+				for(const auto &channel : channels)
+					send("subscribe", channel);
+			}
+
+			bool isCurrent(uint64_t generation)
+			{
+				std::lock_guard<std::mutex> lock(clientMutex_);
+				return generation == generation_;
+			}
+
+			void closeClient()
+			{
+				std::shared_ptr<web::websockets::client::websocket_callback_client> client;
+				{
+					std::lock_guard<std::mutex> lock(clientMutex_);
+					client.swap(client_);
+					++generation_;
+				}
+				if(client)
+				{
+					try
+					{
+						client->close().wait();
+					}
+					catch(const std::exception &)
+					{
+					}
+				}
+			}
+
+			void send(const std::string &command, const std::string &channel)
+			{
+				std::shared_ptr<web::websockets::client::websocket_callback_client> client;
+				{
+					std::lock_guard<std::mutex> lock(clientMutex_);
+					client = client_;
+				}
+				if(!client)
+					return;
+
+				web::websockets::client::websocket_outgoing_message message;
+				message.set_utf8_message("{\"command\":\"" + command + "\",\"channel\":\"" + channel + "\"}");
+				client->send(message).then([](pplx::task<void> sent) {
+					try
+					{
+						sent.get();
+					}
+					catch(const std::exception &)
+					{
+						//lost with the connection; resubscribed on reconnect
+					}
+				});
+			}
+
+			//mutex_ held (send only takes clientMutex_). Asks for a new snapshot; updates are ignored until it arrives.
+			void resync(const std::string &currency, Book &book)
+			{
+				if(!book.synced_)
+					return;
+				book.synced_ = false;
+				++stats_.gaps_;
+				send("unsubscribe", currency);
+				send("subscribe", currency);
+			}
+
+			//mutex_ held
+			void onMessage(const std::string &text)
+			{
+				JsonStreamReader reader(text);
+				reader.beginArray();
+				if(!reader.nextElement())
+					return;
+				if(reader.peekType() == JsonStreamReader::Type::NUMBER)//heartbeat
+				{
+					reader.skipValue();
+					return;
+				}
+
+				std::string currency = reader.readString().str();
+				if(!reader.nextElement())
+					throw std::runtime_error("loan order book feed: missing sequence");
+				uint64_t sequence = reader.readUnsigned();
+				if(!reader.nextElement())
+					throw std::runtime_error("loan order book feed: missing updates");
+
+				Book &book = books_[currency];
+				JsonStreamReader::Slice type;
+				reader.beginArray();
+				while(reader.nextElement())
+				{
+					reader.beginArray();
+					if(!reader.nextElement())
+						throw std::runtime_error("loan order book feed: empty update");
+					type = reader.readString();
+					if(type == "i")
+					{
+						if(!reader.nextElement())
+							throw std::runtime_error("loan order book feed: missing snapshot");
+						readSnapshot(reader, book);
+						book.sequence_ = sequence;
+						book.synced_ = true;
+						++stats_.snapshots_;
+					}
+					else if(type == "o")
+					{
+						if(!book.synced_)
+						{
+							skipRest(reader);
+							continue;
+						}
+						if(sequence != book.sequence_ + 1 && sequence != book.sequence_)//several updates share one seq
+						{
+							resync(currency, book);
+							skipRest(reader);
+							continue;
+						}
+						book.sequence_ = sequence;
+
+						if(!reader.nextElement())
+							throw std::runtime_error("loan order book feed: missing side");
+						Levels &levels = reader.readUnsigned() == 0 ? book.offers_ : book.demands_;
+						if(!reader.nextElement())
+							throw std::runtime_error("loan order book feed: missing rate");
+						JsonStreamReader::Slice rateText = reader.readString();
+						FixedRate rate = FixedRate::parse(rateText.data_, rateText.size_, Rounding::DOWN);
+						if(!reader.nextElement())
+							throw std::runtime_error("loan order book feed: missing amount");
+						JsonStreamReader::Slice amountText = reader.readString();
+						FixedAmount amount = FixedAmount::parse(amountText.data_, amountText.size_, Rounding::DOWN);
+						if(amount == FixedAmount())
+							levels.erase(rate.raw());
+						else
+							levels[rate.raw()] = amount;
+						++stats_.updates_;
+					}
+					skipRest(reader);
+				}
+			}
+
+			static void skipRest(JsonStreamReader &reader)
+			{
+				while(reader.nextElement())
+					reader.skipValue();
+			}
+
+			static void readSnapshot(JsonStreamReader &reader, Book &book)
+			{
+				book.offers_.clear();
+				book.demands_.clear();
+
+				JsonStreamReader::Slice key;
+				reader.beginObject();
+				while(reader.nextKey(key))
+				{
+					Levels *levels;
+					if(key == "offers")
+						levels = &book.offers_;
+					else if(key == "demands")
+						levels = &book.demands_;
+					else
+					{
+						reader.skipValue();
+						continue;
+					}
+
+					reader.beginArray();
+					while(reader.nextElement())
+					{
+						reader.beginArray();
+						if(!reader.nextElement())
+							throw std::runtime_error("loan order book feed: missing rate");
+						JsonStreamReader::Slice rateText = reader.readString();
+						FixedRate rate = FixedRate::parse(rateText.data_, rateText.size_, Rounding::DOWN);
+						if(!reader.nextElement())
+							throw std::runtime_error("loan order book feed: missing amount");
+						JsonStreamReader::Slice amountText = reader.readString();
+						(*levels)[rate.raw()] += FixedAmount::parse(amountText.data_, amountText.size_, Rounding::DOWN);
+						skipRest(reader);
+					}
+				}
+			}
+		};
+	}
+}
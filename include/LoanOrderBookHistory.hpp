@@ -0,0 +1,426 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "LoanOrderBook.hpp"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#ifdef _WIN32
+#include <filesystem>
+namespace filesystem = std::experimental::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace filesystem = boost::filesystem;
+#endif
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Loan order book snapshots of one currency, appended to a file in blocks of up to blockSnapshots. A block
+		//stores each field as its own column of varints so the common cases are a byte or two:
+		//  times    ms since the previous snapshot
+		//  counts   offers + 1, or 0 when the book is the same as the previous one
+		//  rates    ticks (FixedRate raw) above the previous offer; the first offer is relative to the previous book's
+		//  amounts  FixedAmount raw + 1, or 0 when the previous book had that amount at the same place on that tick
+		//  ranges   rangeMin, then rangeMax - rangeMin
+		//Each block starts from an empty previous book so it decodes on its own.
+		class LoanOrderBookHistory
+		{
+		public:
+			typedef std::chrono::system_clock Clock;
+
+			enum Column
+			{
+				TIMES,
+				COUNTS,
+				RATES,
+				AMOUNTS,
+				RANGES,
+				COLUMN_COUNT
+			};
+
+			struct FileHeader
+			{
+				char magic_[8];
+				uint32_t version_;
+				uint32_t reserved_;
+			};
+
+			struct BlockHeader
+			{
+				uint32_t magic_;
+				uint32_t snapshots_;
+				int64_t firstUnixTimeMs_;
+				int64_t lastUnixTimeMs_;
+				uint32_t columnBytes_[COLUMN_COUNT];
+				uint32_t reserved_;
+			};
+
+			static const char *magic() { return "PLBBOOK"; }
+			static const uint32_t version_ = 1;
+			static const uint32_t blockMagic_ = 0x314b4c42;//"BLK1"
+
+			//Padded to 8 so every BlockHeader in a mapping is aligned
+			static uint64_t blockBytes(const BlockHeader &header)
+			{
+				uint64_t bytes = sizeof(BlockHeader);
+				for(auto columnBytes : header.columnBytes_)
+					bytes += columnBytes;
+				return (bytes + 7) & ~static_cast<uint64_t>(7);
+			}
+
+			//Byte length of the complete blocks at the start of data, after the file header. A crash mid append leaves
+			//a partial block at the end which this stops short of.
+			static uint64_t validBytes(const char *data, uint64_t size)
+			{
+				if(size < sizeof(FileHeader))
+					return 0;
+				auto header = reinterpret_cast<const FileHeader *>(data);
+				if(memcmp(header->magic_, magic(), sizeof(header->magic_)) != 0 || header->version_ != version_)
+					return 0;
+				uint64_t offset = sizeof(FileHeader);
+				while(size - offset >= sizeof(BlockHeader))
+				{
+					BlockHeader block;
+					memcpy(&block, data + offset, sizeof(block));
+					if(block.magic_ != blockMagic_ || blockBytes(block) > size - offset)
+						break;
+					offset += blockBytes(block);
+				}
+				return offset;
+			}
+
+			static void putVarint(std::vector<uint8_t> &out, uint64_t value)
+			{
+				while(value >= 0x80)
+				{
+					out.push_back(static_cast<uint8_t>(value | 0x80));
+					value >>= 7;
+				}
+				out.push_back(static_cast<uint8_t>(value));
+			}
+
+			static uint64_t getVarint(const uint8_t *&in, const uint8_t *end)
+			{
+				uint64_t value = 0;
+				for(unsigned shift = 0; shift < 64; shift += 7)
+				{
+					if(in == end)
+						throw std::runtime_error("Loan order book history column ends mid value");
+					uint8_t byte = *in++;
+					value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+					if((byte & 0x80) == 0)
+						return value;
+				}
+				throw std::runtime_error("Loan order book history varint too long");
+			}
+
+			static uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+			static int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+			static int64_t toUnixTimeMs(Clock::time_point time) { return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count(); }
+			static Clock::time_point fromUnixTimeMs(int64_t ms) { return Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(ms))); }
+		};
+
+		//Appends to a LoanOrderBookHistory file, creating it if needed. Snapshots are encoded as they come in and
+		//written a block at a time, so up to blockSnapshots - 1 of them are lost if the process dies.
+		class LoanOrderBookHistoryWriter
+		{
+		public:
+			explicit LoanOrderBookHistoryWriter(const std::string &file, uint32_t blockSnapshots = 64) :
+				blockSnapshots_(blockSnapshots)
+			{
+				if(blockSnapshots == 0)
+					throw std::invalid_argument("LoanOrderBookHistoryWriter blockSnapshots must be > 0");
+
+				uint64_t keep = 0;
+				if(filesystem::exists(file))
+				{
+					std::ifstream existing(file, std::ios::binary);
+					std::vector<char> bytes((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+					keep = LoanOrderBookHistory::validBytes(bytes.data(), bytes.size());
+					if(keep == 0 && !bytes.empty())
+						throw std::runtime_error("Not a loan order book history file(" + file + ")");
+					if(keep != bytes.size())
+						filesystem::resize_file(file, keep);//drop a partial block
+				}
+
+				out_.open(file, std::ios::binary | std::ios::app);
+				if(!out_.is_open())
+					throw std::runtime_error("Unable to open loan order book history file(" + file + ")");
+				if(keep == 0)
+				{
+					LoanOrderBookHistory::FileHeader header = LoanOrderBookHistory::FileHeader();
+					memcpy(header.magic_, LoanOrderBookHistory::magic(), sizeof(header.magic_));
+					header.version_ = LoanOrderBookHistory::version_;
+					out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+					out_.flush();
+				}
+				startBlock();
+			}
+
+			~LoanOrderBookHistoryWriter()
+			{
+				try
+				{
+					flush();
+				}
+				catch(...)
+				{
+				}
+			}
+
+		private://noncopyable
+			LoanOrderBookHistoryWriter(const LoanOrderBookHistoryWriter &) = delete;
+			LoanOrderBookHistoryWriter& operator=(const LoanOrderBookHistoryWriter &) = delete;
+
+		public:
+			void append(LoanOrderBookHistory::Clock::time_point time, const LoanOrderBook &book)
+			{
+				int64_t timeMs = LoanOrderBookHistory::toUnixTimeMs(time);
+				if(header_.snapshots_ == 0)
+					header_.firstUnixTimeMs_ = timeMs;
+				header_.lastUnixTimeMs_ = timeMs;
+				LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::TIMES], LoanOrderBookHistory::zigzag(timeMs - previousTimeMs_));
+				previousTimeMs_ = timeMs;
+
+				if(header_.snapshots_ != 0 && sameAsPrevious(book))
+					LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::COUNTS], 0);
+				else
+				{
+					LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::COUNTS], book.size() + 1);
+					LoanOrderBook::Tick previousTick = previous_.empty() ? 0 : previous_.front().tick();
+					size_t p = 0;
+					for(size_t i = 0; i < book.size(); ++i)
+					{
+						const auto &offer = book[i];
+						if(i == 0)
+							LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::RATES], LoanOrderBookHistory::zigzag(offer.tick() - previousTick));
+						else
+							LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::RATES], static_cast<uint64_t>(offer.tick() - previousTick));
+						previousTick = offer.tick();
+
+						while(p < previous_.size() && previous_[p].tick() < offer.tick())
+							++p;
+						bool unchanged = false;
+						if(p < previous_.size() && previous_[p].tick() == offer.tick())
+							unchanged = previous_[p++].amount_ == offer.amount_;
+						LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::AMOUNTS], unchanged ? 0 : static_cast<uint64_t>(offer.amount_.raw()) + 1);
+
+						LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::RANGES], offer.rangeMin_);
+						LoanOrderBookHistory::putVarint(columns_[LoanOrderBookHistory::RANGES], LoanOrderBookHistory::zigzag(static_cast<int64_t>(offer.rangeMax_) - offer.rangeMin_));
+					}
+					previous_.assign(book.begin(), book.end());
+				}
+
+				++snapshots_;
+				if(++header_.snapshots_ >= blockSnapshots_)
+					flush();
+			}
+
+			//Writes the snapshots since the last block out as a block of their own
+			void flush()
+			{
+				if(header_.snapshots_ == 0)
+					return;
+				for(int c = 0; c < LoanOrderBookHistory::COLUMN_COUNT; ++c)
+					header_.columnBytes_[c] = static_cast<uint32_t>(columns_[c].size());
+				out_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+				uint64_t padding = LoanOrderBookHistory::blockBytes(header_) - sizeof(header_);
+				for(const auto &column : columns_)
+				{
+					out_.write(reinterpret_cast<const char *>(column.data()), column.size());
+					padding -= column.size();
+				}
+				const char zeros[8] = {};
+				out_.write(zeros, static_cast<std::streamsize>(padding));
+				out_.flush();
+				if(!out_)
+					throw std::runtime_error("Unable to write loan order book history");
+				bytesWritten_ += LoanOrderBookHistory::blockBytes(header_);
+				startBlock();
+			}
+
+			uint64_t snapshots() const { return snapshots_; }
+			uint64_t bytesWritten() const { return bytesWritten_; }
+
+		private:
+			uint32_t blockSnapshots_;
+			std::ofstream out_;
+			LoanOrderBookHistory::BlockHeader header_;
+			std::array<std::vector<uint8_t>, LoanOrderBookHistory::COLUMN_COUNT> columns_;
+			int64_t previousTimeMs_;
+			std::vector<LoanOrderBook::Offer> previous_;
+			uint64_t snapshots_ = 0, bytesWritten_ = 0;
+
+			void startBlock()
+			{
+				header_ = LoanOrderBookHistory::BlockHeader();
+				header_.magic_ = LoanOrderBookHistory::blockMagic_;
+				for(auto &column : columns_)
+					column.clear();
+				previousTimeMs_ = 0;
+				previous_.clear();
+			}
+
+			bool sameAsPrevious(const LoanOrderBook &book) const
+			{
+				if(book.size() != previous_.size())
+					return false;
+				for(size_t i = 0; i < book.size(); ++i)
+				{
+					const auto &a = book[i], &b = previous_[i];
+					if(a.rate_ != b.rate_ || a.amount_ != b.amount_ || a.rangeMin_ != b.rangeMin_ || a.rangeMax_ != b.rangeMax_)
+						return false;
+				}
+				return true;
+			}
+		};
+
+		//Read only view of a LoanOrderBookHistory file. Blocks are indexed on open; snapshots are decoded straight
+		//out of the mapping when visited, so a time range only costs the blocks that overlap it.
+		class LoanOrderBookHistoryReader
+		{
+		public:
+			typedef LoanOrderBookHistory::Clock Clock;
+
+			struct Block
+			{
+				Clock::time_point first_, last_;
+				uint32_t snapshots_;
+				const LoanOrderBookHistory::BlockHeader *header_;
+			};
+
+			explicit LoanOrderBookHistoryReader(const std::string &file)
+			{
+				if(!filesystem::exists(file) || filesystem::file_size(file) < sizeof(LoanOrderBookHistory::FileHeader))
+					throw std::runtime_error("Not a loan order book history file(" + file + ")");
+				mapping_ = boost::interprocess::file_mapping(file.c_str(), boost::interprocess::read_only);
+				region_ = boost::interprocess::mapped_region(mapping_, boost::interprocess::read_only);
+
+				const char *data = static_cast<const char *>(region_.get_address());
+				uint64_t end = LoanOrderBookHistory::validBytes(data, region_.get_size());
+				if(end == 0)
+					throw std::runtime_error("Not a loan order book history file(" + file + ")");
+				for(uint64_t offset = sizeof(LoanOrderBookHistory::FileHeader); offset < end; )
+				{
+					auto header = reinterpret_cast<const LoanOrderBookHistory::BlockHeader *>(data + offset);
+					Block block = { LoanOrderBookHistory::fromUnixTimeMs(header->firstUnixTimeMs_), LoanOrderBookHistory::fromUnixTimeMs(header->lastUnixTimeMs_), header->snapshots_, header };
+					blocks_.push_back(block);
+					snapshots_ += header->snapshots_;
+					offset += LoanOrderBookHistory::blockBytes(*header);
+				}
+			}
+
+			const std::vector<Block> &blocks() const { return blocks_; }
+			uint64_t snapshots() const { return snapshots_; }
+
+			//Calls visit(Clock::time_point, const LoanOrderBook &) for each snapshot from <= time <= to, oldest first.
+			//The book is reused from one call to the next.
+			template<typename Visit>
+			void forEach(Visit &&visit, Clock::time_point from = Clock::time_point::min(), Clock::time_point to = Clock::time_point::max()) const
+			{
+				LoanOrderBook book;
+				for(const auto &block : blocks_)
+				{
+					if(block.last_ < from || block.first_ > to)
+						continue;
+					decode(block, book, visit, from, to);
+				}
+			}
+
+		private:
+			boost::interprocess::file_mapping mapping_;
+			boost::interprocess::mapped_region region_;
+			std::vector<Block> blocks_;
+			uint64_t snapshots_ = 0;
+
+			template<typename Visit>
+			static void decode(const Block &block, LoanOrderBook &book, Visit &visit, Clock::time_point from, Clock::time_point to)
+			{
+				const uint8_t *in[LoanOrderBookHistory::COLUMN_COUNT], *end[LoanOrderBookHistory::COLUMN_COUNT];
+				const uint8_t *column = reinterpret_cast<const uint8_t *>(block.header_ + 1);
+				for(int c = 0; c < LoanOrderBookHistory::COLUMN_COUNT; ++c)
+				{
+					in[c] = column;
+					column += block.header_->columnBytes_[c];
+					end[c] = column;
+				}
+
+				using H = LoanOrderBookHistory;
+				std::vector<LoanOrderBook::Offer> previous, current;
+				int64_t timeMs = 0;
+				book.clear();
+				for(uint32_t s = 0; s < block.snapshots_; ++s)
+				{
+					timeMs += H::unzigzag(H::getVarint(in[H::TIMES], end[H::TIMES]));
+					uint64_t count = H::getVarint(in[H::COUNTS], end[H::COUNTS]);
+					if(count != 0)
+					{
+						current.clear();
+						LoanOrderBook::Tick tick = previous.empty() ? 0 : previous.front().tick();
+						size_t p = 0;
+						for(uint64_t i = 0; i + 1 < count; ++i)
+						{
+							if(i == 0)
+								tick += H::unzigzag(H::getVarint(in[H::RATES], end[H::RATES]));
+							else
+								tick += static_cast<LoanOrderBook::Tick>(H::getVarint(in[H::RATES], end[H::RATES]));
+
+							while(p < previous.size() && previous[p].tick() < tick)
+								++p;
+							const LoanOrderBook::Offer *same = nullptr;
+							if(p < previous.size() && previous[p].tick() == tick)
+								same = &previous[p++];
+							uint64_t amount = H::getVarint(in[H::AMOUNTS], end[H::AMOUNTS]);
+							if(amount == 0 && same == nullptr)
+								throw std::runtime_error("Loan order book history amount refers to a missing offer");
+
+							LoanOrderBook::Offer offer;
+							offer.rate_ = FixedRate::fromRaw(tick);
+							offer.amount_ = amount == 0 ? same->amount_ : FixedAmount::fromRaw(static_cast<FixedAmount::Raw>(amount - 1));
+							offer.rangeMin_ = static_cast<uint16_t>(H::getVarint(in[H::RANGES], end[H::RANGES]));
+							offer.rangeMax_ = static_cast<uint16_t>(offer.rangeMin_ + H::unzigzag(H::getVarint(in[H::RANGES], end[H::RANGES])));
+							current.push_back(offer);
+						}
+						previous.swap(current);
+
+						book.clear();
+						for(const auto &offer : previous)
+							book.insert(offer.rate_, offer.amount_, offer.rangeMin_, offer.rangeMax_);
+					}
+
+					Clock::time_point time = H::fromUnixTimeMs(timeMs);
+					if(time >= from && time <= to)
+						visit(time, static_cast<const LoanOrderBook &>(book));
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,154 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "LoanOrderBook.hpp"
+
+#include <boost/optional.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//returnLoanOrders response
+		struct LoanOrders
+		{
+			typedef LoanOrderBook Offers;
+			Offers offers_;
+			typedef LoanOrderBook Demands;
+			Demands demands_;
+			size_t responseBytes_ = 0;//body size when fetched, 0 when answered from the cache or the push feed
+		};
+
+		//Recent returnLoanOrders responses by currency and depth. The api returns the best `limit` offers, so a
+		//book fetched with a deeper limit answers a shallower request by truncation. A side that came back shorter
+		//than its limit is the whole side and answers any depth.
+		class LoanOrdersCache
+		{
+		public:
+			struct Stats
+			{
+				uint64_t hits_ = 0, misses_ = 0;
+			};
+
+			explicit LoanOrdersCache(std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) : ttl_(ttl) {}
+
+			//0 disables the cache
+			void ttl(std::chrono::milliseconds ttl)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				ttl_ = ttl;
+			}
+
+			//limit none is the api default depth and only matches itself
+			boost::optional<LoanOrders> find(const std::string &currency, const boost::optional<uint16_t> &limit, bool includeDemands)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto now = std::chrono::steady_clock::now();
+				auto currencyIter = entries_.find(currency);
+				if(currencyIter != entries_.end())
+				{
+					//deepest fresh entry first
+					for(auto iter = currencyIter->second.rbegin(); iter != currencyIter->second.rend(); ++iter)
+					{
+						const Entry &entry = iter->second;
+						if(now - entry.time_ > ttl_ || (includeDemands && !entry.includeDemands_))
+							continue;
+						if(!limit || !entry.limit_)
+						{
+							if(limit == entry.limit_)
+								return hit(entry.orders_, limit, includeDemands);
+							continue;
+						}
+						if(*entry.limit_ >= *limit || complete(entry, includeDemands))
+							return hit(entry.orders_, limit, includeDemands);
+					}
+				}
+				++stats_.misses_;
+				return boost::none;
+			}
+
+			void store(const std::string &currency, const boost::optional<uint16_t> &limit, bool includeDemands, const LoanOrders &orders)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if(ttl_ == std::chrono::milliseconds(0))
+					return;
+
+				auto now = std::chrono::steady_clock::now();
+				auto &byDepth = entries_[currency];
+				for(auto iter = byDepth.begin(); iter != byDepth.end(); )
+				{
+					if(now - iter->second.time_ > ttl_)
+						iter = byDepth.erase(iter);
+					else
+						++iter;
+				}
+
+				Entry &entry = byDepth[limit ? *limit : 0u];
+				entry.limit_ = limit;
+				entry.includeDemands_ = includeDemands;
+				entry.time_ = now;
+				entry.orders_ = orders;
+			}
+
+			Stats stats()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return stats_;
+			}
+
+		private:
+			struct Entry
+			{
+				boost::optional<uint16_t> limit_;
+				bool includeDemands_;
+				std::chrono::steady_clock::time_point time_;
+				LoanOrders orders_;
+			};
+
+			std::mutex mutex_;
+			std::chrono::milliseconds ttl_;
+			std::map<std::string, std::map<uint32_t, Entry>> entries_;
+			Stats stats_;
+
+			static bool complete(const Entry &entry, bool includeDemands)
+			{
+				return entry.orders_.offers_.size() < *entry.limit_ && (!includeDemands || entry.orders_.demands_.size() < *entry.limit_);
+			}
+
+			LoanOrders hit(const LoanOrders &cached, const boost::optional<uint16_t> &limit, bool includeDemands)
+			{
+				++stats_.hits_;
+				LoanOrders orders;
+				orders.offers_ = cached.offers_;
+				if(includeDemands)
+					orders.demands_ = cached.demands_;
+				if(limit)
+				{
+					orders.offers_.truncate(*limit);
+					orders.demands_.truncate(*limit);
+				}
+				return orders;
+			}
+		};
+	}
+}
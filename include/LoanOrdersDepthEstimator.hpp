@@ -0,0 +1,129 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "LoanOrderBook.hpp"
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <sstream>
+#include <string>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Picks the returnLoanOrders limit for one currency so the spread position is usually inside the first fetch.
+		//Two estimates, whichever is deeper:
+		//  the deepest spread position of the last historySize_ books
+		//  the amount the spread has to cover divided by the smallest recent amount per offer in front of the spread
+		//  position, the thinnest recent book needs the most offers
+		//The second follows settings changes immediately and the first covers lumpy books. A miss grows the limit
+		//by how far short of that amount the fetched book came instead of a fixed step.
+		class LoanOrdersDepthEstimator
+		{
+		public:
+			static const uint16_t initialLimit_ = 100;
+			static const uint16_t minLimit_ = 20;
+			static const uint16_t maxLimit_ = 1500;
+			static const size_t historySize_ = 16;
+
+			//Fetches and response bytes it took to find the spread position, per refresh of the currency.
+			struct Stats
+			{
+				uint64_t decisions_ = 0, fetches_ = 0, responseBytes_ = 0, singleFetchDecisions_ = 0;
+
+				std::string toString() const
+				{
+					std::ostringstream os;
+					os.precision(2);
+					os << std::fixed << "decisions:" << decisions_ << " single fetch:" << singleFetchDecisions_
+						<< " fetches/decision:" << (decisions_ == 0 ? 0.0 : static_cast<double>(fetches_) / decisions_)
+						<< " KB/decision:" << (decisions_ == 0 ? 0.0 : responseBytes_ / 1024.0 / decisions_);
+					return os.str();
+				}
+			};
+
+			//spreadAmount: book amount the spread position has to cover at least
+			uint16_t limit(const FixedAmount &spreadAmount) const
+			{
+				if(positions_.empty())
+					return initialLimit_;
+
+				int64_t offers = *std::max_element(positions_.begin(), positions_.end());
+				int64_t perOffer = 0;
+				for(int64_t amount : amountPerOffer_)
+				{
+					if(amount > 0 && (perOffer == 0 || amount < perOffer))
+						perOffer = amount;
+				}
+				if(perOffer > 0)
+					offers = std::max(offers, spreadAmount.raw() / perOffer + 1);
+				return clamp(offers + offers / 4 + 4);
+			}
+
+			//The spread position wasn't within book, which came back full at limit. Next limit to try.
+			uint16_t deeperLimit(const LoanOrderBook &book, uint16_t limit, const FixedAmount &spreadAmount) const
+			{
+				int64_t grown = static_cast<int64_t>(limit) * 3 / 2;//at least 1.5x so a few misses reach maxLimit_
+				if(!book.empty())
+				{
+					int64_t covered = book.cumulativeAmount(book.size() - 1).raw();
+					if(covered > 0 && spreadAmount.raw() > covered)
+						grown = std::max(grown, static_cast<int64_t>(static_cast<double>(limit) * spreadAmount.raw() / covered * 5 / 4));
+				}
+				return clamp(grown);
+			}
+
+			//One fetched book and the spread position found in it, if any.
+			void record(const LoanOrderBook &book, const boost::optional<uint32_t> &position)
+			{
+				if(!position || *position == 0)
+					return;
+				positions_.push_front(*position);
+				if(positions_.size() > historySize_)
+					positions_.pop_back();
+				amountPerOffer_.push_front(book.cumulativeAmount(*position - 1).raw() / *position);
+				if(amountPerOffer_.size() > historySize_)
+					amountPerOffer_.pop_back();
+			}
+
+			void decided(uint32_t fetches, size_t responseBytes)
+			{
+				++stats_.decisions_;
+				stats_.fetches_ += fetches;
+				stats_.responseBytes_ += responseBytes;
+				if(fetches <= 1)
+					++stats_.singleFetchDecisions_;
+			}
+
+			const Stats &stats() const { return stats_; }
+
+		private:
+			std::deque<uint32_t> positions_;
+			std::deque<int64_t> amountPerOffer_;//FixedAmount raw
+			Stats stats_;
+
+			static uint16_t clamp(int64_t limit)
+			{
+				return static_cast<uint16_t>(std::min<int64_t>(std::max<int64_t>(limit, minLimit_), maxLimit_));
+			}
+		};
+	}
+}
@@ -0,0 +1,243 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "JsonStreamReader.hpp"
+#include "LoanOrderBook.hpp"
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/server.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Stand-in for the websocket push feed LoanOrderBookFeed reads (see there for the message layout), for
+		//testing and benchmarking the feed without the exchange. It only carries messages: subscribe and
+		//unsubscribe commands are logged and handed to the command handler, and whatever is pushed goes to every
+		//open connection, so the caller decides what the books hold, when heartbeats come and when a sequence skips.
+		class MockLoanOrderBookFeedServer
+		{
+		public:
+			typedef std::map<FixedRate::Raw, FixedAmount> Levels;//rate level -> amount, amount 0 removes in update()
+
+			//command is "subscribe" or "unsubscribe". Runs on the server thread; pushing from it is fine.
+			typedef std::function<void(MockLoanOrderBookFeedServer &server, const std::string &command, const std::string &channel)> CommandHandler;
+
+			//Listens on every interface
+			explicit MockLoanOrderBookFeedServer(uint16_t port, CommandHandler onCommand = CommandHandler()) :
+				onCommand_(onCommand)
+			{
+				server_.clear_access_channels(websocketpp::log::alevel::all);
+				server_.clear_error_channels(websocketpp::log::elevel::all);
+				server_.init_asio();
+				server_.set_reuse_addr(true);
+				server_.set_open_handler([this](websocketpp::connection_hdl connection) {
+					std::lock_guard<std::mutex> lock(mutex_);
+					connections_.insert(connection);
+					++connects_;
+				});
+				server_.set_close_handler([this](websocketpp::connection_hdl connection) {
+					std::lock_guard<std::mutex> lock(mutex_);
+					connections_.erase(connection);
+				});
+				server_.set_message_handler([this](websocketpp::connection_hdl, Server::message_ptr message) {
+					onMessage(message->get_payload());
+				});
+				server_.listen(port);
+				server_.start_accept();
+				thread_ = std::thread([this]() { server_.run(); });
+			}
+
+			~MockLoanOrderBookFeedServer()
+			{
+				websocketpp::lib::error_code error;
+				server_.stop_listening(error);
+				closeAll();
+				server_.stop();
+				if(thread_.joinable())
+					thread_.join();
+			}
+
+		private://noncopyable
+			MockLoanOrderBookFeedServer(const MockLoanOrderBookFeedServer &) = delete;
+			MockLoanOrderBookFeedServer& operator=(const MockLoanOrderBookFeedServer &) = delete;
+
+		public:
+			//To every open connection
+			void push(const std::string &message)
+			{
+				for(const auto &connection : openConnections())
+				{
+					websocketpp::lib::error_code error;
+					server_.send(connection, message, websocketpp::frame::opcode::text, error);//a closing connection just misses it
+				}
+			}
+
+			//Drops every connection, the way the exchange does on a restart
+			void closeAll()
+			{
+				for(const auto &connection : openConnections())
+				{
+					websocketpp::lib::error_code error;
+					server_.close(connection, websocketpp::close::status::going_away, "", error);
+				}
+			}
+
+			size_t connections()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return connections_.size();
+			}
+
+			//Connections ever opened
+			uint64_t connects()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return connects_;
+			}
+
+			//Every command received, "subscribe BTC" / "unsubscribe BTC", oldest first
+			std::vector<std::string> commands()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return commands_;
+			}
+
+			static std::string heartbeat() { return "[1010]"; }
+
+			//Full book, restarts the sequence at sequence
+			static std::string snapshot(const std::string &currency, uint64_t sequence, const Levels &offers)
+			{
+				std::ostringstream os;
+				os << "[\"" << currency << "\"," << sequence << ",[[\"i\",{\"offers\":[";
+				bool first = true;
+				for(const auto &level : offers)
+				{
+					os << (first ? "" : ",") << "[\"" << FixedRate::fromRaw(level.first).toString() << "\",\"" << level.second.toString() << "\"]";
+					first = false;
+				}
+				os << "],\"demands\":[]}]]]";
+				return os.str();
+			}
+
+			//Offer level changes, one sequence number for all of them
+			static std::string update(const std::string &currency, uint64_t sequence, const Levels &changes)
+			{
+				std::ostringstream os;
+				os << "[\"" << currency << "\"," << sequence << ",[";
+				bool first = true;
+				for(const auto &level : changes)
+				{
+					os << (first ? "" : ",") << "[\"o\",0,\"" << FixedRate::fromRaw(level.first).toString() << "\",\"" << level.second.toString() << "\"]";
+					first = false;
+				}
+				os << "]]";
+				return os.str();
+			}
+
+			//What update() has to carry to turn from into to
+			static Levels changes(const Levels &from, const Levels &to)
+			{
+				Levels changed;
+				for(const auto &level : from)
+				{
+					if(to.count(level.first) == 0)
+						changed[level.first] = FixedAmount();
+				}
+				for(const auto &level : to)
+				{
+					auto old = from.find(level.first);
+					if(old == from.end() || !(old->second == level.second))
+						changed[level.first] = level.second;
+				}
+				return changed;
+			}
+
+			//Rate levels of a book, offers sharing a rate summed, the way the feed keeps them
+			static Levels levels(const LoanOrderBook &book)
+			{
+				Levels levels;
+				for(const auto &offer : book)
+					levels[offer.rate_.raw()] += offer.amount_;
+				return levels;
+			}
+
+		private:
+			typedef websocketpp::server<websocketpp::config::asio> Server;
+
+			Server server_;
+			std::thread thread_;
+			CommandHandler onCommand_;
+
+			std::mutex mutex_;
+			std::set<websocketpp::connection_hdl, std::owner_less<websocketpp::connection_hdl>> connections_;
+			uint64_t connects_ = 0;
+			std::vector<std::string> commands_;
+
+			std::vector<websocketpp::connection_hdl> openConnections()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return std::vector<websocketpp::connection_hdl>(connections_.begin(), connections_.end());
+			}
+
+			//{"command":"subscribe","channel":"BTC"}, anything else is ignored like the exchange does
+			void onMessage(const std::string &text)
+			{
+				std::string command, channel;
+				try
+				{
+					JsonStreamReader reader(text);
+					JsonStreamReader::Slice key;
+					reader.beginObject();
+					while(reader.nextKey(key))
+					{
+						if(key == "command")
+							command = reader.readString().str();
+						else if(key == "channel")
+							channel = reader.readString().str();
+						else
+							reader.skipValue();
+					}
+				}
+				catch(const std::exception &)
+				{
+					return;
+				}
+				if(command != "subscribe" && command != "unsubscribe")
+					return;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					commands_.push_back(command + " " + channel);
+				}
+				if(onCommand_)
+					onCommand_(*this, command, channel);
+			}
+		};
+	}
+}
@@ -0,0 +1,478 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "cpprest_utilities.hpp"
+#include "LoanOrderBook.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Stand-in for the parts of the Poloniex http api the bot uses, for benchmarking without an account.
+		//Transport free: MockPoloniexServer feeds it requests. Checks keys, signatures and nonces like the
+		//exchange, answers over the request rate limit with 429, and keeps lending balances, open offers and
+		//active loans that move as the simulated books do. Simulated time runs at loanDay_ per lending day so
+		//loans come back within a benchmark run.
+		class MockPoloniexExchange
+		{
+		public:
+			struct Settings
+			{
+				std::string key_, secret_;
+				std::vector<std::string> currencies_;
+				uint32_t bookDepth_;//offers per simulated book
+				FixedAmount startingBalance_;//lending balance per currency
+				uint32_t requestsPerSecond_;
+				std::chrono::milliseconds loanDay_;
+				uint32_t seed_;
+
+				Settings() :
+					key_("benchmark"),
+					secret_("benchmark"),
+					currencies_({ "BTC", "ETH", "XMR" }),
+					bookDepth_(600),
+					startingBalance_(FixedAmount::fromInteger(10)),
+					requestsPerSecond_(6),
+					loanDay_(60000),
+					seed_(1)
+				{}
+			};
+
+			struct Response
+			{
+				uint16_t status_;
+				std::string reasonPhrase_;
+				std::string body_;
+			};
+
+			struct Stats
+			{
+				uint64_t requests_ = 0, rateLimited_ = 0, rejected_ = 0, publicRequests_ = 0, tradingRequests_ = 0;
+				uint64_t offersCreated_ = 0, offersCanceled_ = 0, offersFilled_ = 0, loansReturned_ = 0;
+			};
+
+			explicit MockPoloniexExchange(const Settings &settings = Settings()) :
+				settings_(settings),
+				signer_(settings.secret_),
+				random_(settings.seed_),
+				lastNonce_(0),
+				nextId_(1),
+				lastStep_(std::chrono::steady_clock::now())
+			{
+				for(const auto &currency : settings_.currencies_)
+				{
+					Market &market = markets_[currency];
+					market.baseRate_ = std::uniform_real_distribution<double>(0.0001, 0.0005)(random_);
+					regenerateBook(market);
+					balances_[currency] = settings_.startingBalance_;
+				}
+			}
+
+		private://noncopyable
+			MockPoloniexExchange(const MockPoloniexExchange &) = delete;
+			MockPoloniexExchange& operator=(const MockPoloniexExchange &) = delete;
+
+		public:
+			//query is the url query of a GET, body the form body of a POST. key and sign are the Key and Sign headers.
+			Response handle(const std::string &method, const std::string &path, const std::string &query, const std::string &body, const std::string &key, const std::string &sign)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto now = std::chrono::steady_clock::now();
+				if(path == "/mock/stats")//for the benchmark driver, not counted or limited
+					return ok(statsJson());
+				++stats_.requests_;
+
+				while(!recentRequests_.empty() && now - recentRequests_.front() >= std::chrono::seconds(1))
+					recentRequests_.pop_front();
+				if(recentRequests_.size() >= settings_.requestsPerSecond_)
+				{
+					++stats_.rateLimited_;
+					return { 429, "Too Many Requests", "{\"error\":\"Too Many Requests\"}" };
+				}
+				recentRequests_.push_back(now);
+
+				step(now);
+
+				if(path == "/public" && method == "GET")
+				{
+					++stats_.publicRequests_;
+					return publicApi(parseForm(query));
+				}
+				if(path == "/tradingApi" && method == "POST")
+				{
+					++stats_.tradingRequests_;
+					if(key != settings_.key_ || !equalsIgnoreCase(sign, signer_.sign(body)))
+					{
+						++stats_.rejected_;
+						return { 403, "Forbidden", "{\"error\":\"Invalid API key/secret pair.\"}" };
+					}
+					auto params = parseForm(body);
+					uint64_t nonce = std::strtoull(params["nonce"].c_str(), nullptr, 10);
+					if(nonce <= lastNonce_)
+					{
+						++stats_.rejected_;
+						return ok("{\"error\":\"Nonce must be greater than " + std::to_string(lastNonce_) + ". You provided " + params["nonce"] + ".\"}");
+					}
+					lastNonce_ = nonce;
+					return tradingApi(params);
+				}
+				return { 404, "Not Found", "{\"error\":\"Invalid command.\"}" };
+			}
+
+			Stats stats()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return stats_;
+			}
+
+			//Current book of currency, empty for one not simulated. Moves the simulation on like a request does, for
+			//the push feed stand-in, which reads books without requests.
+			LoanOrderBook book(const std::string &currency)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				step(std::chrono::steady_clock::now());
+				LoanOrderBook book;
+				auto market = markets_.find(currency);
+				if(market != markets_.end())
+				{
+					for(const auto &offer : market->second.book_)
+						book.insert(offer.rate_, offer.amount_, offer.rangeMin_, offer.rangeMax_);
+				}
+				return book;
+			}
+
+		private:
+			struct Market
+			{
+				double baseRate_;
+				std::vector<LoanOrderBook::Offer> book_;
+			};
+
+			struct Offer
+			{
+				std::string currency_;
+				FixedAmount amount_;
+				FixedRate rate_;
+				uint16_t duration_;
+				bool autoRenew_;
+				std::time_t date_;
+			};
+
+			struct Loan
+			{
+				Offer offer_;
+				std::chrono::steady_clock::time_point due_;
+			};
+
+			typedef std::map<std::string, std::string> Form;
+
+			Settings settings_;
+			CppRest::Utilities::HmacSha512Signer signer_;
+			std::mutex mutex_;
+			std::mt19937 random_;
+			std::deque<std::chrono::steady_clock::time_point> recentRequests_;
+			uint64_t lastNonce_;
+			uint64_t nextId_;
+			std::chrono::steady_clock::time_point lastStep_;
+			std::map<std::string, Market> markets_;
+			std::map<std::string, FixedAmount> balances_;
+			std::map<uint64_t, Offer> offers_;
+			std::map<uint64_t, Loan> loans_;
+			Stats stats_;
+
+			static Response ok(const std::string &body) { return { 200, "OK", body }; }
+
+			static bool equalsIgnoreCase(const std::string &a, const std::string &b)
+			{
+				return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y)); });
+			}
+
+			static Form parseForm(const std::string &text)
+			{
+				Form form;
+				size_t pos = 0;
+				while(pos < text.size())
+				{
+					size_t end = text.find('&', pos);
+					if(end == std::string::npos)
+						end = text.size();
+					size_t eq = text.find('=', pos);
+					if(eq != std::string::npos && eq < end)
+						form[decode(text.substr(pos, eq - pos))] = decode(text.substr(eq + 1, end - eq - 1));
+					pos = end + 1;
+				}
+				return form;
+			}
+
+			static std::string decode(const std::string &text)
+			{
+				std::string out;
+				for(size_t i = 0; i < text.size(); ++i)
+				{
+					if(text[i] == '%' && i + 2 < text.size())
+					{
+						out += static_cast<char>(std::strtol(text.substr(i + 1, 2).c_str(), nullptr, 16));
+						i += 2;
+					}
+					else
+						out += text[i] == '+' ? ' ' : text[i];
+				}
+				return out;
+			}
+
+			static std::string formatDate(std::time_t time)
+			{
+				std::tm utc = *std::gmtime(&time);
+				char buf[32];
+				std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &utc);
+				return buf;
+			}
+
+			static FixedRate toRate(double rate) { return FixedRate::fromRaw(std::max<int64_t>(1, static_cast<int64_t>(rate * 1e6))); }
+
+			void regenerateBook(Market &market)
+			{
+				std::lognormal_distribution<double> amount(0.0, 1.5);
+				std::uniform_int_distribution<int64_t> gap(0, 3);
+				market.book_.clear();
+				FixedRate rate = toRate(market.baseRate_);
+				for(uint32_t i = 0; i < settings_.bookDepth_; ++i)
+				{
+					rate = FixedRate::fromRaw(rate.raw() + gap(random_));
+					FixedAmount size = FixedAmount::fromRaw(std::max<int64_t>(1, static_cast<int64_t>(amount(random_) * 1e8)));
+					market.book_.push_back({ rate, size, 2, 2 });
+				}
+			}
+
+			//One step per simulated second since the last request: books drift (quiet ones stay as they are), our
+			//offers at or under the best rate get taken and loans that are due come back with interest.
+			void step(std::chrono::steady_clock::time_point now)
+			{
+				int steps = static_cast<int>(std::min<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(now - lastStep_).count(), 60));
+				if(steps == 0)
+					return;
+				lastStep_ = now;
+
+				std::uniform_real_distribution<double> uniform(0.0, 1.0);
+				std::normal_distribution<double> drift(0.0, 0.02);
+				for(int s = 0; s < steps; ++s)
+				{
+					for(auto &market : markets_)
+					{
+						double roll = uniform(random_);
+						if(roll < 0.3)
+						{
+							market.second.baseRate_ = std::min(0.05, std::max(0.00001, market.second.baseRate_ * std::exp(drift(random_))));
+							regenerateBook(market.second);
+						}
+						else if(roll < 0.5 && !market.second.book_.empty())
+						{
+							//activity deep in the book only
+							auto &offer = market.second.book_[market.second.book_.size() / 2 + static_cast<size_t>(uniform(random_) * (market.second.book_.size() / 2))];
+							offer.amount_ = FixedAmount::fromRaw(std::max<int64_t>(1, static_cast<int64_t>(offer.amount_.raw() * (0.5 + uniform(random_)))));
+						}
+					}
+
+					for(auto iter = offers_.begin(); iter != offers_.end(); )
+					{
+						const Market &market = markets_[iter->second.currency_];
+						bool taken = !market.book_.empty() && !(market.book_.front().rate_ < iter->second.rate_) && uniform(random_) < 0.5;
+						if(!taken && uniform(random_) < 0.02)//demand now and then reaches further up
+							taken = true;
+						if(taken)
+						{
+							++stats_.offersFilled_;
+							Loan loan = { iter->second, now + settings_.loanDay_ * iter->second.duration_ };
+							loan.offer_.date_ = std::time(nullptr);
+							loans_.emplace(iter->first, loan);
+							iter = offers_.erase(iter);
+						}
+						else
+							++iter;
+					}
+				}
+
+				for(auto iter = loans_.begin(); iter != loans_.end(); )
+				{
+					if(iter->second.due_ > now)
+					{
+						++iter;
+						continue;
+					}
+					++stats_.loansReturned_;
+					Offer offer = iter->second.offer_;
+					//interest = amount * rate * days, less the 15% fee
+					int64_t interest = static_cast<int64_t>(static_cast<double>(offer.amount_.raw()) * offer.rate_.raw() / 1e6 * offer.duration_ * 0.85);
+					balances_[offer.currency_] += FixedAmount::fromRaw(interest);
+					if(offer.autoRenew_)
+					{
+						offer.date_ = std::time(nullptr);
+						offers_.emplace(nextId_++, offer);
+					}
+					else
+						balances_[offer.currency_] += offer.amount_;
+					iter = loans_.erase(iter);
+				}
+			}
+
+			Response publicApi(Form params)
+			{
+				if(params["command"] != "returnLoanOrders")
+					return ok("{\"error\":\"Invalid command.\"}");
+				auto market = markets_.find(params["currency"]);
+				if(market == markets_.end())
+					return ok("{\"error\":\"Invalid currency.\"}");
+
+				size_t limit = params.count("limit") ? std::strtoul(params["limit"].c_str(), nullptr, 10) : 50;
+				std::ostringstream os;
+				os << "{\"offers\":[";
+				for(size_t i = 0; i < std::min(limit, market->second.book_.size()); ++i)
+				{
+					const auto &offer = market->second.book_[i];
+					os << (i == 0 ? "" : ",") << "{\"rate\":\"" << offer.rate_.toString() << "\",\"amount\":\"" << offer.amount_.toString()
+						<< "\",\"rangeMin\":" << offer.rangeMin_ << ",\"rangeMax\":" << offer.rangeMax_ << "}";
+				}
+				os << "],\"demands\":[]}";
+				return ok(os.str());
+			}
+
+			Response tradingApi(Form params)
+			{
+				const std::string &command = params["command"];
+				if(command == "returnAvailableAccountBalances")
+				{
+					std::ostringstream os;
+					bool any = false;
+					for(const auto &balance : balances_)
+					{
+						if(balance.second == FixedAmount())
+							continue;
+						os << (any ? "," : "") << "\"" << balance.first << "\":\"" << balance.second.toString() << "\"";
+						any = true;
+					}
+					return ok(any ? "{\"lending\":{" + os.str() + "}}" : "[]");
+				}
+				if(command == "returnOpenLoanOffers")
+				{
+					std::map<std::string, std::string> byCurrency;
+					for(const auto &offer : offers_)
+					{
+						std::string &list = byCurrency[offer.second.currency_];
+						list += (list.empty() ? "" : ",") + offerJson(offer.first, offer.second, false);
+					}
+					return ok(objectOfArrays(byCurrency));
+				}
+				if(command == "returnActiveLoans")
+				{
+					std::string provided;
+					for(const auto &loan : loans_)
+						provided += (provided.empty() ? "" : ",") + offerJson(loan.first, loan.second.offer_, true);
+					return ok("{\"provided\":[" + provided + "],\"used\":[]}");
+				}
+				if(command == "createLoanOffer")
+				{
+					auto balance = balances_.find(params["currency"]);
+					if(balance == balances_.end())
+						return ok("{\"error\":\"Invalid currency.\"}");
+					Offer offer;
+					offer.currency_ = balance->first;
+					offer.amount_ = FixedAmount::parse(params["amount"], Rounding::DOWN);
+					offer.rate_ = FixedRate::parse(params["lendingRate"], Rounding::DOWN);
+					offer.duration_ = static_cast<uint16_t>(std::strtoul(params["duration"].c_str(), nullptr, 10));
+					offer.autoRenew_ = params["autoRenew"] == "1";
+					offer.date_ = std::time(nullptr);
+					if(offer.amount_ <= FixedAmount() || balance->second < offer.amount_)
+						return ok("{\"error\":\"Not enough " + offer.currency_ + " available to offer.\"}");
+					balance->second -= offer.amount_;
+					uint64_t id = nextId_++;
+					offers_.emplace(id, offer);
+					++stats_.offersCreated_;
+					return ok("{\"success\":1,\"message\":\"Loan order placed.\",\"orderID\":" + std::to_string(id) + "}");
+				}
+				if(command == "cancelLoanOffer")
+				{
+					auto offer = offers_.find(std::strtoull(params["orderNumber"].c_str(), nullptr, 10));
+					if(offer == offers_.end())
+						return ok("{\"success\":0,\"error\":\"Error canceling loan order, or you are not the person who placed it.\"}");
+					balances_[offer->second.currency_] += offer->second.amount_;
+					offers_.erase(offer);
+					++stats_.offersCanceled_;
+					return ok("{\"success\":1,\"message\":\"Loan offer canceled.\"}");
+				}
+				if(command == "toggleAutoRenew")
+				{
+					auto loan = loans_.find(std::strtoull(params["orderNumber"].c_str(), nullptr, 10));
+					if(loan == loans_.end())
+						return ok("{\"error\":\"Invalid order number, or you are not the person who placed the order.\"}");
+					loan->second.offer_.autoRenew_ = !loan->second.offer_.autoRenew_;
+					return ok("{\"success\":1,\"message\":" + std::to_string(loan->second.offer_.autoRenew_ ? 1 : 0) + "}");
+				}
+				return ok("{\"error\":\"Invalid command.\"}");
+			}
+
+			static std::string offerJson(uint64_t id, const Offer &offer, bool loan)
+			{
+				std::ostringstream os;
+				os << "{\"id\":" << id << ",";
+				if(loan)
+					os << "\"currency\":\"" << offer.currency_ << "\",";
+				os << "\"rate\":\"" << offer.rate_.toString() << "\",\"amount\":\"" << offer.amount_.toString() << "\",\"duration\":" << offer.duration_
+					<< ",\"autoRenew\":" << (offer.autoRenew_ ? 1 : 0) << ",\"date\":\"" << formatDate(offer.date_) << "\"";
+				if(loan)
+					os << ",\"fees\":\"0.00000000\"";
+				os << "}";
+				return os.str();
+			}
+
+			//[] when empty, same as the exchange
+			static std::string objectOfArrays(const std::map<std::string, std::string> &arrays)
+			{
+				if(arrays.empty())
+					return "[]";
+				std::string out = "{";
+				for(const auto &array : arrays)
+					out += (out.size() == 1 ? "\"" : ",\"") + array.first + "\":[" + array.second + "]";
+				return out + "}";
+			}
+
+			std::string statsJson() const
+			{
+				std::ostringstream os;
+				os << "{\"requests\":" << stats_.requests_ << ",\"rateLimited\":" << stats_.rateLimited_ << ",\"rejected\":" << stats_.rejected_
+					<< ",\"publicRequests\":" << stats_.publicRequests_ << ",\"tradingRequests\":" << stats_.tradingRequests_
+					<< ",\"offersCreated\":" << stats_.offersCreated_ << ",\"offersCanceled\":" << stats_.offersCanceled_
+					<< ",\"offersFilled\":" << stats_.offersFilled_ << ",\"loansReturned\":" << stats_.loansReturned_ << "}";
+				return os.str();
+			}
+		};
+	}
+}
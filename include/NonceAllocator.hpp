@@ -0,0 +1,134 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#ifdef _WIN32
+#include <filesystem>
+namespace filesystem = std::experimental::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace filesystem = boost::filesystem;
+#endif
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Hands out increasing api nonces without a file write per request.
+		//The file holds a leased high-water mark: every nonce up to it may already have been sent, so it is
+		//written before the first nonce of each lease is handed out and a restart after a crash resumes above it.
+		class NonceAllocator
+		{
+		public:
+			static constexpr uint64_t defaultLeaseSize_ = 1000;
+
+			explicit NonceAllocator(const filesystem::path &file, uint64_t leaseSize = defaultLeaseSize_) :
+				file_(file),
+				leaseSize_(leaseSize),
+				last_(0),
+				leasedUntil_(0),
+				persistCount_(0)
+			{
+				if(leaseSize_ == 0)
+					throw std::invalid_argument("NonceAllocator leaseSize must be > 0");
+
+				if(filesystem::exists(file_))
+				{
+					std::ifstream f(file_.string());
+					f >> last_;
+					f.close();
+				}
+				leasedUntil_ = last_;
+			}
+
+			//Clean shutdown: record the last nonce actually used so the next run doesn't skip the unused lease.
+			~NonceAllocator()
+			{
+				try
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					persist(last_);
+				}
+				catch(...)
+				{
+				}
+			}
+
+		private://noncopyable
+			NonceAllocator(const NonceAllocator &) = delete;
+			NonceAllocator& operator=(const NonceAllocator &) = delete;
+
+		public:
+			uint64_t next()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				++last_;
+				if(last_ > leasedUntil_)
+				{
+					persist(last_ + leaseSize_ - 1);
+					leasedUntil_ = last_ + leaseSize_ - 1;
+				}
+				return last_;
+			}
+
+			//Next nonce handed out will be greater than minimumNonce. ("Nonce must be greater than x" api error)
+			void raiseTo(uint64_t minimumNonce)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if(minimumNonce > last_)
+					last_ = minimumNonce;
+			}
+
+			//Number of nonce file writes since construction.
+			uint64_t persistCount()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				return persistCount_;
+			}
+
+		private:
+			filesystem::path file_;
+			uint64_t leaseSize_;
+			uint64_t last_;
+			uint64_t leasedUntil_;
+			uint64_t persistCount_;
+			std::mutex mutex_;
+
+			//write then rename so a crash mid write can't leave a truncated (lower) value behind
+			void persist(uint64_t value)
+			{
+				filesystem::path tmpFile(file_.string() + ".tmp");
+				std::ofstream f(tmpFile.string(), std::ofstream::trunc);
+				if(f.is_open() == false)
+					throw std::runtime_error("Unable to open file(" + tmpFile.string() + ")");
+				f << value;
+				f.flush();
+				f.close();
+				if(f.fail())
+					throw std::runtime_error("Unable to write file(" + tmpFile.string() + ")");
+				filesystem::rename(tmpFile, file_);
+				++persistCount_;
+			}
+		};
+	}
+}
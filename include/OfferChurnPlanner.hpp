@@ -0,0 +1,303 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "OfferReconciler.hpp"
+#include "PoloniexApi.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Holds the cancels and creates that would bring the open offers in line with the plans, and each tick runs
+		//the ones worth the most that fit the tick's request budget. The rest wait for a later tick.
+		//
+		//Score is the change in daily yield, rate delta * amount:
+		//  cancel: distance from the offer's rate to the nearest planned rate
+		//  create: distance from the planned rate to the nearest rate being canceled, or the whole rate when the
+		//          money is idle (nothing of that currency is being canceled)
+		//The delta is at least one rate tick, so an amount change at the same rate still scores above 0.
+		//Each tick a change waits adds a quarter of its score so small changes aren't put off forever.
+		//A create only runs once the currency has the free balance for it, so cancels that fund it go first.
+		class OfferChurnPlanner
+		{
+		public:
+			enum class Kind
+			{
+				CANCEL,
+				CREATE
+			};
+
+			struct Change
+			{
+				Kind kind_;
+				CurrencyCode currency_;
+				PoloniexApi::OrderNumber offerId_;//CANCEL only
+				Amount amount_;
+				Rate rate_;
+				double score_;//yield/day, in units of the currency
+				uint32_t deferredTicks_;
+
+				double priority() const { return score_ * (1 + deferredTicks_ / 4.0); }
+			};
+
+			struct Offer
+			{
+				Amount amount_;
+				Rate rate_;
+			};
+
+			struct Stats
+			{
+				uint64_t ticks_ = 0, budget_ = 0, used_ = 0, failed_ = 0;
+				double scoreExecuted_ = 0;
+
+				std::string toString() const
+				{
+					std::ostringstream os;
+					os << "ticks:" << ticks_ << " requests used/budget:" << used_ << "/" << budget_ << " failed:" << failed_ << " yield/day moved:" << scoreExecuted_;
+					return os.str();
+				}
+			};
+
+			//Replaces currency's pending changes with the ones from a fresh look at its books. Returns how many there are.
+			//freeBalance: the currency's lending balance not tied up in open offers
+			size_t reconcile(const CurrencyCode &currency, const Amount &freeBalance, const std::vector<PoloniexApi::LoanOffer> &openOffers, const std::vector<Offer> &plan)
+			{
+				auto diff = OfferReconciler::diff(openOffers, plan);
+
+				std::vector<double> plannedRates, canceledRates;
+				for(const auto &offer : plan)
+					plannedRates.push_back(toDouble(offer.rate_));
+				for(size_t i : diff.cancel_)
+					canceledRates.push_back(toDouble(openOffers[i].rate_));
+				std::sort(plannedRates.begin(), plannedRates.end());
+				std::sort(canceledRates.begin(), canceledRates.end());
+
+				std::vector<Change> changes;
+				for(size_t i : diff.cancel_)
+				{
+					const auto &offer = openOffers[i];
+					double rate = toDouble(offer.rate_);
+					changes.push_back({ Kind::CANCEL, currency, offer.id_, offer.amount_, offer.rate_, score(offer.amount_, distanceToNearest(plannedRates, rate, rate)), 0 });
+				}
+				for(size_t i : diff.create_)
+				{
+					const auto &offer = plan[i];
+					double rate = toDouble(offer.rate_);
+					changes.push_back({ Kind::CREATE, currency, 0, offer.amount_, offer.rate_, score(offer.amount_, distanceToNearest(canceledRates, rate, rate)), 0 });
+				}
+
+				//carry the wait of changes that were already pending
+				Currency &pending = currencies_[currency];
+				std::map<PoloniexApi::OrderNumber, uint32_t> cancelWaits;
+				std::map<std::pair<Rate, Amount>, uint32_t> createWaits;
+				for(const auto &old : pending.changes_)
+				{
+					if(old.kind_ == Kind::CANCEL)
+						cancelWaits[old.offerId_] = old.deferredTicks_;
+					else
+						createWaits[std::make_pair(old.rate_, old.amount_)] = old.deferredTicks_;
+				}
+				for(auto &change : changes)
+				{
+					if(change.kind_ == Kind::CANCEL)
+					{
+						auto iter = cancelWaits.find(change.offerId_);
+						if(iter != cancelWaits.end())
+							change.deferredTicks_ = iter->second;
+					}
+					else
+					{
+						auto iter = createWaits.find(std::make_pair(change.rate_, change.amount_));
+						if(iter != createWaits.end())
+							change.deferredTicks_ = iter->second;
+					}
+				}
+				pending.changes_ = std::move(changes);
+				pending.freeBalance_ = freeBalance;
+				size_t count = pending.changes_.size();
+				if(count == 0)
+					currencies_.erase(currency);
+				return count;
+			}
+
+			//Drops pending changes of currencies not in keep
+			void retain(const std::unordered_set<CurrencyCode> &keep)
+			{
+				for(auto iter = currencies_.begin(); iter != currencies_.end(); )
+				{
+					if(keep.count(iter->first) == 0)
+						iter = currencies_.erase(iter);
+					else
+						++iter;
+				}
+			}
+
+			void clear(const CurrencyCode &currency) { currencies_.erase(currency); }
+
+			size_t pending() const
+			{
+				size_t count = 0;
+				for(const auto &currency : currencies_)
+					count += currency.second.changes_.size();
+				return count;
+			}
+
+			//Runs up to budget changes, one request each, highest priority first, of only that currency when only is given.
+			//apply returns false if the exchange refused the change; refused changes are dropped, the next reconcile
+			//brings them back if still needed. Returns the number of changes applied or refused.
+			//A tick can execute several times, endTick() once after the last.
+			size_t execute(size_t budget, const std::function<bool(const Change &)> &apply, const CurrencyCode *only = nullptr)
+			{
+				std::vector<Change *> order;
+				for(auto &pending : currencies_)
+				{
+					if(only != nullptr && pending.first != *only)
+						continue;
+					for(auto &change : pending.second.changes_)
+						order.push_back(&change);
+				}
+				std::stable_sort(order.begin(), order.end(), [](const Change *a, const Change *b) { return a->priority() > b->priority(); });
+
+				//pick with projected balances: a cancel picked anywhere in the order funds creates picked after it
+				std::map<CurrencyCode, Amount> projected;
+				for(const auto &currency : currencies_)
+					projected[currency.first] = currency.second.freeBalance_;
+				std::vector<Change *> picked;
+				std::unordered_set<const Change *> pickedSet;
+				for(int pass = 0; pass < 2 && picked.size() < budget; ++pass)//second pass: creates funded by cancels picked later in the first
+				{
+					for(auto *change : order)
+					{
+						if(picked.size() >= budget)
+							break;
+						if(pickedSet.count(change) != 0)
+							continue;
+						Amount &balance = projected[change->currency_];
+						if(change->kind_ == Kind::CANCEL)
+						{
+							if(pass != 0)
+								continue;
+							balance += change->amount_;
+						}
+						else
+						{
+							if(balance < change->amount_)
+								continue;
+							balance -= change->amount_;
+						}
+						picked.push_back(change);
+						pickedSet.insert(change);
+					}
+				}
+
+				//cancels first so their balance is free before the creates it funds
+				std::stable_partition(picked.begin(), picked.end(), [](const Change *change) { return change->kind_ == Kind::CANCEL; });
+				std::unordered_set<const Change *> done;
+				for(auto *change : picked)
+				{
+					Currency &currency = currencies_[change->currency_];
+					if(change->kind_ == Kind::CREATE && currency.freeBalance_ < change->amount_)
+						continue;//a cancel funding it was refused, leave it for later
+
+					bool applied = apply(*change);
+					++stats_.used_;
+					done.insert(change);
+					if(!applied)
+					{
+						++stats_.failed_;
+						continue;
+					}
+					stats_.scoreExecuted_ += change->score_;
+					if(change->kind_ == Kind::CANCEL)
+						currency.freeBalance_ += change->amount_;
+					else
+						currency.freeBalance_ -= change->amount_;
+				}
+
+				for(auto iter = currencies_.begin(); iter != currencies_.end(); )
+				{
+					auto &changes = iter->second.changes_;
+					changes.erase(std::remove_if(changes.begin(), changes.end(), [&done](const Change &change) { return done.count(&change) != 0; }), changes.end());
+					if(changes.empty())
+						iter = currencies_.erase(iter);
+					else
+						++iter;
+				}
+				return done.size();
+			}
+
+			//The tick's budget has been spent, what is still pending waited another tick
+			void endTick(size_t budget)
+			{
+				++stats_.ticks_;
+				stats_.budget_ += budget;
+				for(auto &currency : currencies_)
+					for(auto &change : currency.second.changes_)
+						++change.deferredTicks_;
+			}
+
+			const Stats &stats() const { return stats_; }
+
+		private:
+			struct Currency
+			{
+				Amount freeBalance_;
+				std::vector<Change> changes_;
+			};
+			std::map<CurrencyCode, Currency> currencies_;
+			Stats stats_;
+
+			static double toDouble(const DataTypes::Decimal &value)
+			{
+				return std::stod(to_string(value, 8));
+			}
+
+			//Aging multiplies the score, so a score of 0 would never gain priority
+			static double score(const Amount &amount, double rateDelta)
+			{
+				return toDouble(amount) * std::max(rateDelta, static_cast<double>(PoloniexApi::minimumRateIncrement_));
+			}
+
+			//fallback when rates is empty
+			static double distanceToNearest(const std::vector<double> &rates, double rate, double fallback)
+			{
+				if(rates.empty())
+					return fallback;
+				auto iter = std::lower_bound(rates.begin(), rates.end(), rate);
+				double distance = std::numeric_limits<double>::max();
+				if(iter != rates.end())
+					distance = *iter - rate;
+				if(iter != rates.begin())
+					distance = std::min(distance, rate - *(iter - 1));
+				return distance;
+			}
+		};
+	}
+}
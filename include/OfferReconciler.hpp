@@ -0,0 +1,96 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Smallest set of cancels and creates that turns the open offers into the planned ones. Offers are equal
+		//when rate and amount are, and both sides are multisets: two identical planned offers need two identical
+		//open ones. O(n log n), both sides are sorted by (rate, amount) and merged.
+		class OfferReconciler
+		{
+		public:
+			//Indexes into the inputs, ascending. Where several open offers are equal the earliest are kept.
+			struct Diff
+			{
+				std::vector<size_t> cancel_;
+				std::vector<size_t> create_;
+
+				bool empty() const { return cancel_.empty() && create_.empty(); }
+			};
+
+			//Open and Planned both need rate_ and amount_ members comparable with <
+			template<typename Open, typename Planned>
+			static Diff diff(const std::vector<Open> &open, const std::vector<Planned> &planned)
+			{
+				std::vector<size_t> openOrder = sortedOrder(open), plannedOrder = sortedOrder(planned);
+
+				Diff diff;
+				size_t o = 0, p = 0;
+				while(o < openOrder.size() && p < plannedOrder.size())
+				{
+					const Open &openOffer = open[openOrder[o]];
+					const Planned &plannedOffer = planned[plannedOrder[p]];
+					if(less(openOffer, plannedOffer))
+						diff.cancel_.push_back(openOrder[o++]);
+					else if(less(plannedOffer, openOffer))
+						diff.create_.push_back(plannedOrder[p++]);
+					else
+					{
+						++o;
+						++p;
+					}
+				}
+				diff.cancel_.insert(diff.cancel_.end(), openOrder.begin() + static_cast<std::ptrdiff_t>(o), openOrder.end());
+				diff.create_.insert(diff.create_.end(), plannedOrder.begin() + static_cast<std::ptrdiff_t>(p), plannedOrder.end());
+
+				//back to input order so offers are canceled and created in the order they were listed
+				std::sort(diff.cancel_.begin(), diff.cancel_.end());
+				std::sort(diff.create_.begin(), diff.create_.end());
+				return diff;
+			}
+
+		private:
+			template<typename A, typename B>
+			static bool less(const A &a, const B &b)
+			{
+				if(a.rate_ < b.rate_)
+					return true;
+				if(b.rate_ < a.rate_)
+					return false;
+				return a.amount_ < b.amount_;
+			}
+
+			//Stable so equal offers stay in input order
+			template<typename Offer>
+			static std::vector<size_t> sortedOrder(const std::vector<Offer> &offers)
+			{
+				std::vector<size_t> order(offers.size());
+				for(size_t i = 0; i < order.size(); ++i)
+					order[i] = i;
+				std::stable_sort(order.begin(), order.end(), [&offers](size_t a, size_t b) { return less(offers[a], offers[b]); });
+				return order;
+			}
+		};
+	}
+}
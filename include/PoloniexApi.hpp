@@ -15,8 +15,19 @@ limitations under the License.
 */
 
 #pragma once
+#include "ApiRecording.hpp"
 #include "cpprest_utilities.hpp"
 #include "Decimal.hpp"
+#include "FlightRecorder.hpp"
+#include "JsonStreamReader.hpp"
+#include "LoanOrderBook.hpp"
+#ifdef LOAN_ORDER_BOOK_FEED
+#include "LoanOrderBookFeed.hpp"
+#endif
+#include "LoanOrdersCache.hpp"
+#include "NonceAllocator.hpp"
+#include "RequestRateLimiter.hpp"
+#include "RequestScheduler.hpp"
 
 #include <cpprest/http_client.h>
 #include <cpprest/json.h>
@@ -32,10 +43,18 @@ namespace filesystem = std::experimental::filesystem;
 namespace filesystem = boost::filesystem;
 #endif
 
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <map>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 namespace tylawin
 {
@@ -53,25 +72,178 @@ namespace tylawin
 
 			static constexpr long double minimumRateIncrement_ = 0.000001L;
 
-			PoloniexApi(const std::string &key, const std::string &secret) :
+			typedef RequestScheduler::Priority Priority;
+
+			struct ConnectionSettings
+			{
+				std::string baseUri_;
+				std::chrono::seconds requestTimeout_;//one attempt
+				std::chrono::seconds callTimeout_;//default deadline for a call including its retries
+				std::chrono::seconds retryBackoff_;//wait before retrying a failed attempt (429s wait out the rate limiter instead)
+				//Requests sent concurrently. Connections are kept alive and reused so this is also the connection pool size.
+				size_t maxRequestsInFlight_;
+				bool warmup_;//open the pooled connections at construction
+				std::string loanOrderBookFeedUri_;//websocket push feed for loan order books, empty polls only
+				std::string recordFile_;//append every response here, empty records nothing
+				std::string replayFile_;//serve responses from this recording instead of the exchange
+				ApiReplay::Timing replayTiming_;
+				std::string flightRecorderFile_;//ring of the last requests and responses, empty disables
+				uint32_t flightRecorderEntries_;
+				uint32_t flightRecorderEntryBytes_;//per entry, longer responses are cut short
+
+				ConnectionSettings() :
+					baseUri_("https://poloniex.com"),
+					requestTimeout_(30),
+					callTimeout_(120),
+					retryBackoff_(5),
+					maxRequestsInFlight_(3),
+					warmup_(true),
+					replayTiming_(ApiReplay::Timing::ORIGINAL),
+					flightRecorderFile_("logs/flightrecorder.bin"),
+					flightRecorderEntries_(256),
+					flightRecorderEntryBytes_(16384)
+				{}
+			};
+
+			//Cancelled once check returns true, and stays cancelled. Copies share state.
+			class CancellationToken
+			{
+			public:
+				CancellationToken() {}
+				explicit CancellationToken(std::function<bool()> check) : state_(std::make_shared<State>())
+				{
+					state_->check_ = std::move(check);
+				}
+
+				bool cancelled() const
+				{
+					if(!state_)
+						return false;
+					if(!state_->cancelled_ && state_->check_ && state_->check_())
+						state_->cancelled_ = true;
+					return state_->cancelled_;
+				}
+
+			private:
+				struct State
+				{
+					std::atomic<bool> cancelled_{ false };
+					std::function<bool()> check_;
+				};
+				std::shared_ptr<State> state_;
+			};
+
+			struct CallOptions
+			{
+				boost::optional<std::chrono::steady_clock::time_point> deadline_;//none is now + ConnectionSettings::callTimeout_
+				CancellationToken cancel_;
+
+				CallOptions() {}
+				explicit CallOptions(CancellationToken cancel) : cancel_(cancel) {}
+			};
+
+			//A call that ran out of time or was cancelled. Not retried.
+			class CallAborted : public std::runtime_error
+			{
+			public:
+				CallAborted(const std::string &command, bool cancelled, const std::string &lastError = std::string()) :
+					std::runtime_error(command + (cancelled ? " cancelled" : " deadline exceeded") + (lastError.empty() ? "" : " (last error: " + lastError + ")")),
+					cancelled_(cancelled)
+				{}
+
+				bool cancelled() const { return cancelled_; }
+
+			private:
+				bool cancelled_;
+			};
+
+			//Outcome counts by api command.
+			struct CallStats
+			{
+				struct Command
+				{
+					uint64_t calls_ = 0, retries_ = 0, timeouts_ = 0, cancelled_ = 0, failed_ = 0;
+				};
+				std::map<std::string, Command> commands_;
+
+				std::string toString() const
+				{
+					std::ostringstream os;
+					for(const auto &command : commands_)
+					{
+						const Command &c = command.second;
+						os << (command.first == commands_.begin()->first ? "" : " ") << command.first << "(calls:" << c.calls_ << " retries:" << c.retries_
+							<< " timeouts:" << c.timeouts_ << " cancelled:" << c.cancelled_ << " failed:" << c.failed_ << ")";
+					}
+					return os.str();
+				}
+			};
+
+			//Request timing split by whether the request had to open a new (TLS) connection first.
+			//Cold minus warm headers time is about what a handshake costs.
+			struct ConnectionStats
+			{
+				uint64_t newConnections_ = 0;
+				uint64_t coldRequests_ = 0, warmRequests_ = 0, failedRequests_ = 0;
+				std::chrono::microseconds coldHeadersTime_{ 0 }, warmHeadersTime_{ 0 }, transferTime_{ 0 };
+
+				std::string toString() const
+				{
+					auto avgMs = [](std::chrono::microseconds total, uint64_t count) {
+						return count == 0 ? 0.0 : total.count() / 1000.0 / count;
+					};
+					std::ostringstream os;
+					os.precision(1);
+					os << std::fixed << "connections opened:" << newConnections_
+						<< " requests(cold:" << coldRequests_ << " warm:" << warmRequests_ << " failed:" << failedRequests_ << ")"
+						<< " avg headers ms(cold:" << avgMs(coldHeadersTime_, coldRequests_) << " warm:" << avgMs(warmHeadersTime_, warmRequests_) << ")"
+						<< " avg transfer ms:" << avgMs(transferTime_, coldRequests_ + warmRequests_);
+					return os.str();
+				}
+			};
+
+			PoloniexApi(const std::string &key, const std::string &secret, const ConnectionSettings &connectionSettings = ConnectionSettings()) :
 				key_(key),
-				secret_(secret),
-				nonce_(0)
+				signer_(secret),
+				nonce_("nonce.txt"),
+				connectionSettings_(connectionSettings),
+				rateLimiter_("ratelimits.txt"),//request rate limit: 6 per second max
+				scheduler_(connectionSettings.maxRequestsInFlight_)
 			{
-				httpClient = new web::http::client::http_client(web::uri(U("https://poloniex.com")));
-				if(filesystem::exists("nonce.txt"))
+				if(!connectionSettings_.replayFile_.empty())
+				{
+					replay_.reset(new ApiReplay(connectionSettings_.replayFile_, connectionSettings_.replayTiming_));
+					return;//offline: no connections, no push feed
+				}
+				if(!connectionSettings_.recordFile_.empty())
+					recorder_.reset(new ApiRecorder(connectionSettings_.recordFile_));
+				if(!connectionSettings_.flightRecorderFile_.empty())
 				{
-					std::ifstream f("nonce.txt");
-					f >> nonce_;
-					f.close();
+					filesystem::path p(connectionSettings_.flightRecorderFile_);
+					if(p.has_parent_path() && !filesystem::exists(p.parent_path()))
+						filesystem::create_directories(p.parent_path());
+					flightRecorder_.reset(new FlightRecorder(connectionSettings_.flightRecorderFile_, connectionSettings_.flightRecorderEntries_, connectionSettings_.flightRecorderEntryBytes_));
+				}
+
+				httpClient = makeHttpClient();
+				if(connectionSettings_.warmup_)
+					warmup();
+
+				if(!connectionSettings_.loanOrderBookFeedUri_.empty())
+				{
+#ifdef LOAN_ORDER_BOOK_FEED
+					LoanOrderBookFeed::Settings feedSettings;
+					feedSettings.uri_ = connectionSettings_.loanOrderBookFeedUri_;
+					loanOrderBookFeed_.reset(new LoanOrderBookFeed(feedSettings));
+#else
+					throw std::invalid_argument("loanOrderBookFeedUri is set but this build has no websocket support (LOAN_ORDER_BOOK_FEED)");
+#endif
 				}
 			}
 
 			~PoloniexApi()
 			{
-				delete httpClient;
-
-				saveNonce();
+				scheduler_.shutdown();
 			}
 
 		private://noncopyable
@@ -84,9 +256,9 @@ namespace tylawin
 				bool success_;
 				std::string msg_;
 			};
-			CancelLoanOfferResponse cancelLoanOffer(const OrderNumber &orderNumber)
+			CancelLoanOfferResponse cancelLoanOffer(const OrderNumber &orderNumber, const CallOptions &options = CallOptions())
 			{
-				auto jsonResponse = query(web::http::methods::POST, true, "/tradingApi", { {"command","cancelLoanOffer"}, {"orderNumber",std::to_string(orderNumber)} });
+				auto jsonResponse = query(Priority::TRADING, web::http::methods::POST, true, "/tradingApi", { {"command","cancelLoanOffer"}, {"orderNumber",std::to_string(orderNumber)} }, options);
 				CancelLoanOfferResponse response;
 				response.msg_ = "ERROR expected json response field missing";
 				if(!jsonResponse.has_field(U("success")) || jsonResponse[U("success")].as_integer() == false)
@@ -104,11 +276,11 @@ namespace tylawin
 				return response;
 			}
 
-			auto createLoanOffer(const std::string &currency, const std::string &amount, const uint8_t &maxDurationDays, bool autoRenew, const std::string &lendingRate)
+			auto createLoanOffer(const std::string &currency, const std::string &amount, const uint8_t &maxDurationDays, bool autoRenew, const std::string &lendingRate, const CallOptions &options = CallOptions())
 			{
 				if(maxDurationDays < 2 || maxDurationDays > 60)
 					throw std::runtime_error("Invalid argument(duration:" + std::to_string(maxDurationDays) + "). Poloniex duration range is [2,60].");
-				return query(web::http::methods::POST, true, "/tradingApi", { {"command","createLoanOffer"}, {"currency",currency}, {"amount",amount}, {"duration",std::to_string(maxDurationDays)}, {"autoRenew",std::to_string(autoRenew)}, {"lendingRate",lendingRate} });
+				return query(Priority::TRADING, web::http::methods::POST, true, "/tradingApi", { {"command","createLoanOffer"}, {"currency",currency}, {"amount",amount}, {"duration",std::to_string(maxDurationDays)}, {"autoRenew",std::to_string(autoRenew)}, {"lendingRate",lendingRate} }, options);
 			}
 
 			typedef size_t LoanId;
@@ -123,30 +295,53 @@ namespace tylawin
 				Amount fees_;
 			};
 			typedef std::unordered_map<CurrencyCode, std::unordered_map<LoanId, ActiveLoan>> ActiveLoans;
-			ActiveLoans getActiveLoans()
+			ActiveLoans getActiveLoans(const CallOptions &options = CallOptions())
 			{
-				auto jsonResponse = query(web::http::methods::POST, true, "/tradingApi", { {"command","returnActiveLoans"} });
+				return decodeActiveLoans(queryBody(Priority::ACCOUNT, web::http::methods::POST, true, "/tradingApi", { {"command","returnActiveLoans"} }, options));
+			}
 
+		private:
+			//{"provided":[{"id":75073,"currency":"LTC","rate":"0.00020000","amount":"0.72234880","duration":2,"autoRenew":0,"date":"2015-05-10 23:45:05","fees":"0.00006000"}],"used":[...]}
+			static ActiveLoans decodeActiveLoans(const std::string &body)
+			{
 				ActiveLoans activeLoans;
 
-				if(jsonResponse.has_field(U("provided")))
+				JsonStreamReader reader(body);
+				if(reader.peekType() != JsonStreamReader::Type::OBJECT)//[] when there are no loans
+					return activeLoans;
+
+				JsonStreamReader::Slice key;
+				reader.beginObject();
+				while(reader.nextKey(key))
 				{
-					auto providedLoans = jsonResponse[U("provided")].as_array();
+					if(key != "provided")
+					{
+						reader.skipValue();
+						continue;
+					}
 
-					for(auto loan : providedLoans)
+					reader.beginArray();
+					while(reader.nextElement())
 					{
 						CurrencyCode curCode;
-						ActiveLoan activeLoan;
+						ActiveLoan activeLoan = ActiveLoan();
+						RequiredFields fields("returnActiveLoans", 8);
 
-						curCode = CppRest::Utilities::u2s(loan[U("currency")].as_string());
-
-						activeLoan.id_        = loan[U("id")].as_integer();
-						activeLoan.amount_    = CppRest::Utilities::u2s(loan[U("amount")].as_string());
-						activeLoan.rate_      = CppRest::Utilities::u2s(loan[U("rate")].as_string());
-						activeLoan.duration_  = loan[U("duration")].as_integer();
-						activeLoan.autoRenew_ = loan[U("autoRenew")].as_integer() != 0;
-						activeLoan.dateTime_  = boost::posix_time::time_from_string(CppRest::Utilities::u2s(loan[U("date")].as_string()));
-						activeLoan.fees_      = CppRest::Utilities::u2s(loan[U("fees")].as_string());
+						reader.beginObject();
+						while(reader.nextKey(key))
+						{
+							if(key == "currency")       { curCode               = reader.readString().str();                        fields.seen(0); }
+							else if(key == "id")        { activeLoan.id_        = static_cast<LoanId>(reader.readUnsigned());       fields.seen(1); }
+							else if(key == "amount")    { activeLoan.amount_    = reader.readString().str();                        fields.seen(2); }
+							else if(key == "rate")      { activeLoan.rate_      = reader.readString().str();                        fields.seen(3); }
+							else if(key == "duration")  { activeLoan.duration_  = static_cast<uint16_t>(reader.readUnsigned());     fields.seen(4); }
+							else if(key == "autoRenew") { activeLoan.autoRenew_ = reader.readInteger() != 0;                        fields.seen(5); }
+							else if(key == "date")      { activeLoan.dateTime_  = parseDateTime(reader.readString());               fields.seen(6); }
+							else if(key == "fees")      { activeLoan.fees_      = reader.readString().str();                        fields.seen(7); }
+							else
+								reader.skipValue();
+						}
+						fields.check();
 
 						activeLoans[curCode].insert(std::make_pair(activeLoan.id_, activeLoan));
 					}
@@ -155,6 +350,8 @@ namespace tylawin
 				return activeLoans;
 			}
 
+		public:
+
 			enum class AccountTypes
 			{
 				EXCHANGE,
@@ -171,12 +368,12 @@ namespace tylawin
 				}
 			};
 			typedef std::unordered_map<AccountTypes, std::unordered_map<CurrencyCode, Amount>, AccountTypesHash> AccountBalances;
-			auto getAvailableAccountBalances(const boost::optional<AccountTypes> accountType = boost::none)
+			auto getAvailableAccountBalances(const boost::optional<AccountTypes> accountType = boost::none, const CallOptions &options = CallOptions())
 			{
 				web::json::value response;
 
 				if(!accountType)
-					response = query(web::http::methods::POST, true, "/tradingApi", { {"command","returnAvailableAccountBalances"} });
+					response = query(Priority::ACCOUNT, web::http::methods::POST, true, "/tradingApi", { {"command","returnAvailableAccountBalances"} }, options);
 				else
 				{
 					std::string type;
@@ -187,7 +384,7 @@ namespace tylawin
 						case AccountTypes::LENDING:  type = "lending";  break;
 						default: throw std::runtime_error("invalid accountType enum");
 					}
-					response = query(web::http::methods::POST, true, "/tradingApi", { {"command","returnAvailableAccountBalances"}, {"account",type} });
+					response = query(Priority::ACCOUNT, web::http::methods::POST, true, "/tradingApi", { {"command","returnAvailableAccountBalances"}, {"account",type} }, options);
 				}
 
 				AccountBalances accountBalances;
@@ -225,54 +422,108 @@ namespace tylawin
 			}
 
 			
-			struct LoanOrders
+			typedef poloniex::LoanOrders LoanOrders;
+			//demands_ is only filled when includeDemands is set; the lending strategy only looks at offers.
+			LoanOrders getLoanOrders(const std::string &currency, const boost::optional<uint16_t> limit = boost::none, bool includeDemands = false, const CallOptions &options = CallOptions())
+			{
+				return wait(getLoanOrdersAsync(currency, limit, includeDemands, options), options, "returnLoanOrders");
+			}
+
+			//Queued behind trading and account requests so polling books for statistics never delays offer updates.
+			//Answered from the push feed while it is live, else from loanOrdersCache_ when a fresh enough book of at
+			//least this depth was fetched recently.
+			std::future<LoanOrders> getLoanOrdersAsync(const std::string &currency, const boost::optional<uint16_t> limit = boost::none, bool includeDemands = false, const CallOptions &options = CallOptions())
 			{
-				struct Details
+				boost::optional<LoanOrders> ready;
+#ifdef LOAN_ORDER_BOOK_FEED
+				if(loanOrderBookFeed_)
+					ready = loanOrderBookFeed_->find(currency, limit, includeDemands);
+#endif
+				if(!ready)
+					ready = loanOrdersCache_.find(currency, limit, includeDemands);
+				if(ready)
 				{
-					Amount amount_;
-					uint16_t rangeMin_, rangeMax_;
-				};
-				typedef std::multimap<Rate, Details> Offers;
-				Offers offers_;
-				typedef std::multimap<Rate, Details> Demands;
-				Demands demands_;
-			};
-			LoanOrders getLoanOrders(const std::string &currency, const boost::optional<uint16_t> limit = boost::none)
+					std::promise<LoanOrders> promise;
+					promise.set_value(std::move(*ready));
+					return promise.get_future();
+				}
+
+				CppRest::Utilities::QueryParams params = { {"command","returnLoanOrders"}, {"currency",currency} };
+				if(limit)
+					params["limit"] = std::to_string(*limit);
+
+				return callAsync<LoanOrders>(Priority::MARKET_DATA, web::http::methods::GET, false, "/public", params, options, [this, currency, limit, includeDemands](const std::string &body) {
+					LoanOrders loanOrders = decodeLoanOrders(body, includeDemands);
+					loanOrders.responseBytes_ = body.size();
+					loanOrdersCache_.store(currency, limit, includeDemands, loanOrders);
+					return loanOrders;
+				});
+			}
+
+			//0 disables book caching
+			void loanOrdersCacheTtl(std::chrono::milliseconds ttl) { loanOrdersCache_.ttl(ttl); }
+			LoanOrdersCache::Stats loanOrdersCacheStats() { return loanOrdersCache_.stats(); }
+
+			//empty when the push feed is off
+			std::string loanOrderBookFeedStats()
 			{
-				web::json::value response;
-				if(!limit)
-					response = query(web::http::methods::GET, false, "/public", { {"command","returnLoanOrders"}, {"currency",currency} });
-				else
-					response = query(web::http::methods::GET, false, "/public", { {"command","returnLoanOrders"}, {"currency",currency}, {"limit",std::to_string(*limit)} });
+#ifdef LOAN_ORDER_BOOK_FEED
+				if(loanOrderBookFeed_)
+					return loanOrderBookFeed_->stats().toString();
+#endif
+				return std::string();
+			}
 
+		private:
+			//{"offers":[{"rate":"0.00200000","amount":"64.66305732","rangeMin":2,"rangeMax":8}],"demands":[...]}
+			static LoanOrders decodeLoanOrders(const std::string &body, bool includeDemands)
+			{
 				LoanOrders loanOrders;
-				LoanOrders::Details tmpDetails;
-				if(response.has_field(U("offers")) && response[U("offers")].size() != 0)
+
+				JsonStreamReader reader(body);
+				JsonStreamReader::Slice key;
+				reader.beginObject();
+				while(reader.nextKey(key))
 				{
-					for(auto offer : response[U("offers")].as_array())
+					LoanOrders::Offers *side;
+					if(key == "offers")
+						side = &loanOrders.offers_;
+					else if(key == "demands" && includeDemands)
+						side = &loanOrders.demands_;
+					else
 					{
-						tmpDetails.amount_ = CppRest::Utilities::u2s(offer[U("amount")].as_string());
-						tmpDetails.rangeMin_ = offer[U("rangeMin")].as_integer();
-						tmpDetails.rangeMax_ = offer[U("rangeMax")].as_integer();
-
-						loanOrders.offers_.insert(std::make_pair(CppRest::Utilities::u2s(offer[U("rate")].as_string()), tmpDetails));
+						reader.skipValue();
+						continue;
 					}
-				}
-				if(response.has_field(U("demands")) && response[U("demands")].size() != 0)
-				{
-					for(auto offer : response[U("demands")].as_array())
+
+					reader.beginArray();
+					while(reader.nextElement())
 					{
-						tmpDetails.amount_ = CppRest::Utilities::u2s(offer[U("amount")].as_string());
-						tmpDetails.rangeMin_ = offer[U("rangeMin")].as_integer();
-						tmpDetails.rangeMax_ = offer[U("rangeMax")].as_integer();
+						FixedRate rate;
+						FixedAmount amount;
+						uint16_t rangeMin = 0, rangeMax = 0;
+						RequiredFields fields("returnLoanOrders", 4);
 
-						loanOrders.demands_.insert(std::make_pair(CppRest::Utilities::u2s(offer[U("rate")].as_string()), tmpDetails));
+						reader.beginObject();
+						while(reader.nextKey(key))
+						{
+							if(key == "rate")          { rate     = parseFixed<FixedRate>(reader.readString());   fields.seen(0); }
+							else if(key == "amount")   { amount   = parseFixed<FixedAmount>(reader.readString()); fields.seen(1); }
+							else if(key == "rangeMin") { rangeMin = static_cast<uint16_t>(reader.readUnsigned()); fields.seen(2); }
+							else if(key == "rangeMax") { rangeMax = static_cast<uint16_t>(reader.readUnsigned()); fields.seen(3); }
+							else
+								reader.skipValue();
+						}
+						fields.check();
+
+						side->insert(rate, amount, rangeMin, rangeMax);
 					}
 				}
 
 				return loanOrders;
 			}
 
+		public:
 			struct LoanOffer
 			{
 				LoanId id_;
@@ -283,50 +534,188 @@ namespace tylawin
 				boost::posix_time::ptime date_;
 			};
 			typedef std::unordered_map<CurrencyCode, std::vector<LoanOffer>> LoanOffers;
-			auto getOpenLoanOffers()
+			auto getOpenLoanOffers(const CallOptions &options = CallOptions())
 			{
-				auto response = query(web::http::methods::POST, true, "/tradingApi", { { "command","returnOpenLoanOffers" } });
+				return decodeOpenLoanOffers(queryBody(Priority::ACCOUNT, web::http::methods::POST, true, "/tradingApi", { { "command","returnOpenLoanOffers" } }, options));
+			}
 
+		private:
+			//{"BTC":[{"id":10595,"rate":"0.00020000","amount":"3.00000000","duration":2,"autoRenew":1,"date":"2015-05-10 23:33:50"}],"LTC":[...]}
+			static LoanOffers decodeOpenLoanOffers(const std::string &body)
+			{
 				LoanOffers loanOffers;
-				if (response.size() != 0)
+
+				JsonStreamReader reader(body);
+				if(reader.peekType() != JsonStreamReader::Type::OBJECT)//[] when there are no offers
+					return loanOffers;
+
+				JsonStreamReader::Slice key;
+				reader.beginObject();
+				while(reader.nextKey(key))
 				{
-					for (auto cur : response.as_object())
+					auto &currencyOffers = loanOffers[key.str()];
+
+					reader.beginArray();
+					while(reader.nextElement())
 					{
-						CurrencyCode loanCurCode = CppRest::Utilities::u2s(cur.first);
-						for (auto offer : response[CppRest::Utilities::s2u(loanCurCode)].as_array())
+						LoanOffer offer = LoanOffer();
+						RequiredFields fields("returnOpenLoanOffers", 6);
+
+						reader.beginObject();
+						while(reader.nextKey(key))
 						{
-							loanOffers[loanCurCode].emplace_back(LoanOffer({
-								static_cast<LoanId>(offer[U("id")].as_integer()),
-								CppRest::Utilities::u2s(offer[U("amount")].as_string()),
-								CppRest::Utilities::u2s(offer[U("rate")].as_string()),
-								static_cast<uint16_t>(offer[U("duration")].as_integer()),
-								offer[U("autoRenew")].as_integer() != 0,
-								boost::posix_time::time_from_string(CppRest::Utilities::u2s(offer[U("date")].as_string()))
-							}));
+							if(key == "id")             { offer.id_        = static_cast<LoanId>(reader.readUnsigned());   fields.seen(0); }
+							else if(key == "amount")    { offer.amount_    = reader.readString().str();                    fields.seen(1); }
+							else if(key == "rate")      { offer.rate_      = reader.readString().str();                    fields.seen(2); }
+							else if(key == "duration")  { offer.duration_  = static_cast<uint16_t>(reader.readUnsigned()); fields.seen(3); }
+							else if(key == "autoRenew") { offer.autoRenew_ = reader.readInteger() != 0;                    fields.seen(4); }
+							else if(key == "date")      { offer.date_      = parseDateTime(reader.readString());           fields.seen(5); }
+							else
+								reader.skipValue();
 						}
+						fields.check();
+
+						currencyOffers.emplace_back(offer);
 					}
 				}
 
 				return loanOffers;
 			}
 
-			auto toggleAutoRenew(OrderNumber orderNumber)
+		public:
+
+			auto toggleAutoRenew(OrderNumber orderNumber, const CallOptions &options = CallOptions())
+			{
+				return query(Priority::TRADING, web::http::methods::POST, true, "/tradingApi", { {"command","toggleAutoRenew"}, {"orderNumber",std::to_string(orderNumber)} }, options);
+			}
+
+			RequestRateLimiter::State rateLimiterState() { return rateLimiter_.state(); }
+
+			ConnectionStats connectionStats()
 			{
-				return query(web::http::methods::POST, true, "/tradingApi", { {"command","toggleAutoRenew"}, {"orderNumber",std::to_string(orderNumber)} });
+				std::lock_guard<std::mutex> lock(statsMutex_);
+				return connectionStats_;
 			}
 
+			CallStats callStats()
+			{
+				std::lock_guard<std::mutex> lock(statsMutex_);
+				return callStats_;
+			}
+
+			//entries the flight recorder's writer fell too far behind to keep
+			uint64_t flightRecorderDropped() const { return flightRecorder_ ? flightRecorder_->dropped() : 0; }
+
 		private:
 			std::string key_;
-			std::string secret_;
-			uint64_t nonce_;
-			web::http::client::http_client *httpClient;
+			CppRest::Utilities::HmacSha512Signer signer_;
+			NonceAllocator nonce_;
+			ConnectionSettings connectionSettings_;
+
+			//Replaced after a transport failure so retries don't go out over pooled connections in an unknown state.
+			//Requests already in flight keep the client they started with.
+			std::mutex httpClientMutex_;
+			std::shared_ptr<web::http::client::http_client> httpClient;
+
+			std::mutex statsMutex_;
+			ConnectionStats connectionStats_;
+			CallStats callStats_;
+
+			LoanOrdersCache loanOrdersCache_;
+#ifdef LOAN_ORDER_BOOK_FEED
+			std::unique_ptr<LoanOrderBookFeed> loanOrderBookFeed_;
+#endif
+
+			RequestRateLimiter rateLimiter_;
+
+			std::unique_ptr<ApiRecorder> recorder_;
+			std::unique_ptr<ApiReplay> replay_;
+			std::unique_ptr<FlightRecorder> flightRecorder_;
+
+			//Held for the whole of each authenticated attempt so nonces reach the server in order.
+			std::mutex authenticatedRequestMutex_;
+
+			RequestScheduler scheduler_;
+
+			//New connections run the ssl context callback on the thread issuing the request, so a change in this
+			//count across a request means that request paid for a handshake.
+			static uint64_t &threadNewConnectionCount()
+			{
+				static thread_local uint64_t count = 0;
+				return count;
+			}
+
+			std::shared_ptr<web::http::client::http_client> makeHttpClient()
+			{
+				web::http::client::http_client_config config;
+				config.set_timeout(connectionSettings_.requestTimeout_);
+#ifndef _WIN32
+				//each new pooled connection gets its own context, so this is also where handshakes are counted
+				config.set_ssl_context_callback([this](boost::asio::ssl::context &)
+				{
+					++threadNewConnectionCount();
+					std::lock_guard<std::mutex> lock(statsMutex_);
+					++connectionStats_.newConnections_;
+				});
+#endif
+				return std::make_shared<web::http::client::http_client>(web::uri(CppRest::Utilities::s2u(connectionSettings_.baseUri_)), config);
+			}
+
+			std::shared_ptr<web::http::client::http_client> currentHttpClient()
+			{
+				std::lock_guard<std::mutex> lock(httpClientMutex_);
+				return httpClient;
+			}
 
-			void saveNonce()
+			void resetHttpClient()
 			{
-				std::ofstream f("nonce.txt", std::ofstream::trunc);
-				f << nonce_;
-				f.flush();
-				f.close();
+				auto client = makeHttpClient();
+				std::lock_guard<std::mutex> lock(httpClientMutex_);
+				httpClient = client;
+			}
+
+			//Opens the pooled connections before the first real request so trading calls don't wait on handshakes.
+			//Failures are only counted; the first real request retries as usual.
+			void warmup()
+			{
+				auto client = currentHttpClient();
+				std::vector<pplx::task<web::http::http_response>> requests;
+				for(size_t i = 0; i < connectionSettings_.maxRequestsInFlight_; ++i)
+				{
+					rateLimiter_.acquire(RequestRateLimiter::Endpoint::PUBLIC);
+					web::http::http_request request(web::http::methods::HEAD);
+					request.set_request_uri(U("/public"));
+					request.headers().add(U("Connection"), U("Keep-Alive"));
+					requests.push_back(client->request(request));
+				}
+				for(auto &request : requests)
+				{
+					try
+					{
+						request.get();
+					}
+					catch(const std::exception &)
+					{
+						std::lock_guard<std::mutex> lock(statsMutex_);
+						++connectionStats_.failedRequests_;
+					}
+				}
+			}
+
+			void recordRequestTiming(bool newConnection, std::chrono::steady_clock::duration headersTime, std::chrono::steady_clock::duration transferTime)
+			{
+				std::lock_guard<std::mutex> lock(statsMutex_);
+				if(newConnection)
+				{
+					++connectionStats_.coldRequests_;
+					connectionStats_.coldHeadersTime_ += std::chrono::duration_cast<std::chrono::microseconds>(headersTime);
+				}
+				else
+				{
+					++connectionStats_.warmRequests_;
+					connectionStats_.warmHeadersTime_ += std::chrono::duration_cast<std::chrono::microseconds>(headersTime);
+				}
+				connectionStats_.transferTime_ += std::chrono::duration_cast<std::chrono::microseconds>(transferTime);
 			}
 
 			web::http::http_request makeRequest(web::http::method method, bool authenticated, const std::string &path, CppRest::Utilities::QueryParams params = CppRest::Utilities::QueryParams())
@@ -334,16 +723,17 @@ namespace tylawin
 				web::http::http_request request;
 
 				request.set_method(method);
+				request.headers().add(U("Connection"), U("Keep-Alive"));
 
 				std::string urlEncodedParameters = "";
 				if (authenticated)
 				{
-					params["nonce"] = std::to_string(++nonce_);
-					saveNonce();
+					params["nonce"] = std::to_string(nonce_.next());
 					urlEncodedParameters = CppRest::Utilities::paramsToUrlString(params);
-					std::string signedUrlEncodedParameters = CppRest::Utilities::hmacSha512(secret_, urlEncodedParameters);
+					char sign[CppRest::Utilities::HmacSha512Signer::hexDigestSize_];
+					signer_.sign(urlEncodedParameters.data(), urlEncodedParameters.size(), sign);
 					request.headers().add(U("Content-Type"), U("application/x-www-form-urlencoded"));
-					request.headers().add(U("Sign"), CppRest::Utilities::s2u(signedUrlEncodedParameters));
+					request.headers().add(U("Sign"), utility::string_t(sign, sign + sizeof(sign)));//hex is ascii so widening each char is exact
 					request.headers().add(U("Key"), CppRest::Utilities::s2u(key_));
 					request.headers().add(U("Content-Length"), CppRest::Utilities::s2u(std::to_string(urlEncodedParameters.size())));
 				}
@@ -360,131 +750,389 @@ namespace tylawin
 				return request;
 			}
 
-			void writeQueryDebugOutputFile(const web::http::http_request &request, bool authenticated, const CppRest::Utilities::QueryParams &params, const web::json::value &res_json)
+			//Tracks which fields of a decoded record were present.
+			class RequiredFields
 			{
-				std::string fileName = "logs/query_" + CppRest::Utilities::paramUriToValidFileName(CppRest::Utilities::u2s(request.request_uri().to_string()));
-				if (authenticated)
-					fileName += "-" + CppRest::Utilities::paramUriToValidFileName(CppRest::Utilities::paramsToUrlString(params));
-				fileName += ".txt";
-				filesystem::path p(fileName);
-				if (!filesystem::exists(p.parent_path()))
-					filesystem::create_directories(p.parent_path());
-				utility::ofstream_t of(p.string());
-				if (of.is_open() == false)
+			public:
+				RequiredFields(const char *command, uint32_t count) : command_(command), expected_((1u << count) - 1), seen_(0) {}
+				void seen(uint32_t field) { seen_ |= 1u << field; }
+				void check() const
 				{
-					throw std::runtime_error("Unable to open file(" + fileName + ")");
+					if(seen_ != expected_)
+						throw std::runtime_error(std::string(command_) + " response missing expected field");
 				}
-				else
+			private:
+				const char *command_;
+				uint32_t expected_, seen_;
+			};
+
+			//api dates are always "YYYY-MM-DD HH:MM:SS" (UTC)
+			static boost::posix_time::ptime parseDateTime(const JsonStreamReader::Slice &text)
+			{
+				const char *str = text.data_;
+				if(text.size_ != 19 || str[4] != '-' || str[7] != '-' || str[10] != ' ' || str[13] != ':' || str[16] != ':')
+					throw std::runtime_error("unexpected date format: " + text.str());
+
+				auto number = [&](size_t pos, size_t count) {
+					int value = 0;
+					for(size_t i = pos; i < pos + count; ++i)
+					{
+						if(str[i] < '0' || str[i] > '9')
+							throw std::runtime_error("unexpected date format: " + text.str());
+						value = value * 10 + (str[i] - '0');
+					}
+					return value;
+				};
+
+				return boost::posix_time::ptime(
+					boost::gregorian::date(static_cast<unsigned short>(number(0, 4)), static_cast<unsigned short>(number(5, 2)), static_cast<unsigned short>(number(8, 2))),
+					boost::posix_time::time_duration(number(11, 2), number(14, 2), number(17, 2)));
+			}
+
+			//book values beyond exchange precision are truncated rather than rejected
+			template<typename Fixed>
+			static Fixed parseFixed(const JsonStreamReader::Slice &text)
+			{
+				return Fixed::parse(text.data_, text.size_, Rounding::DOWN);
+			}
+
+			//Api errors come back as 200 with an "error" field in the top level object.
+			void checkApiError(const std::string &body)
+			{
+				JsonStreamReader reader(body);
+				if(reader.atEnd())
+					throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: res_json is null");
+
+				auto type = reader.peekType();
+				if(type != JsonStreamReader::Type::OBJECT && type != JsonStreamReader::Type::ARRAY)
+					throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: not obj - " + body.substr(0, 500));
+				if(type == JsonStreamReader::Type::ARRAY)
+					return;
+
+				JsonStreamReader::Slice key;
+				reader.beginObject();
+				while(reader.nextKey(key))
 				{
-					of << U("--REQUEST--") << std::endl;
-					of << request.to_string() << std::endl << U("--RESPONSE--") << std::endl << std::endl;
-					of << CppRest::Utilities::s2u(CppRest::Utilities::convertJsonValueToFormattedString(res_json));
-					of.close();
+					if(key != "error")
+					{
+						reader.skipValue();
+						continue;
+					}
+
+					std::string errStr = reader.readString().str();
+					//{ error:"Nonce must be greater than 1460846370855. You provided 2." }
+					if (errStr.compare(0, std::string("Nonce must be greater than ").size(), "Nonce must be greater than ") == 0)
+					{
+						std::string minimumNonce = errStr.substr(std::string("Nonce must be greater than ").size());
+						nonce_.raiseTo(stoull(minimumNonce.substr(0, minimumNonce.find('.'))));
+						throw web::http::http_exception(errStr);
+					}
+					else if (errStr.compare(0, std::string("Error canceling loan order").size(), "Error canceling loan order") == 0)
+						return;
+					else
+						throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: unknown api error: " + body);
 				}
 			}
 
-			web::json::value query(web::http::method method, bool authenticated, const std::string &path, CppRest::Utilities::QueryParams params = CppRest::Utilities::QueryParams(), bool outputDebugFile = false)
+			//One api call across all of its attempts. Attempts run on the scheduler and a retry is posted back to it
+			//with a start time, so backing off never holds a worker or the caller's thread.
+			struct Call
 			{
-				//Request rate limit: 6 per second max
-				const static std::chrono::milliseconds minRequestRateLimitTime(1000 / 6);
-				static std::chrono::milliseconds requestRateLimitTime = minRequestRateLimitTime;
-				static std::chrono::time_point<std::chrono::steady_clock> lastTime = std::chrono::steady_clock::now() - requestRateLimitTime;
+				std::string command_;
+				Priority priority_;
+				web::http::method method_;
+				bool authenticated_;
+				std::string path_;
+				CppRest::Utilities::QueryParams params_;
+				std::chrono::steady_clock::time_point deadline_;
+				CancellationToken cancel_;
+				pplx::cancellation_token_source transport_;//aborts the request in flight when the call is abandoned
+				std::string lastError_;
+				std::function<void(const std::string &)> complete_;//must not throw
+				std::function<void(std::exception_ptr)> fail_;
 
-				bool retry = true;
-				while(retry)
+				//throws CallAborted when the call should stop
+				void checkAborted() const
 				{
-					web::http::http_request request = makeRequest(method, authenticated, path, params);
+					if(cancel_.cancelled())
+						throw CallAborted(command_, true, lastError_);
+					if(std::chrono::steady_clock::now() >= deadline_)
+						throw CallAborted(command_, false, lastError_);
+				}
+			};
 
-					auto now = std::chrono::steady_clock::now();
-					if(now - lastTime < requestRateLimitTime)
-						std::this_thread::sleep_for(requestRateLimitTime - (now - lastTime));
-					lastTime = std::chrono::steady_clock::now();
+			//How often a blocked wait looks at the deadline and cancellation token.
+			static std::chrono::milliseconds abortPollInterval() { return std::chrono::milliseconds(100); }
+			//Longer rate limiter waits (cooldown after a 429, a backed off rate) are rescheduled instead of slept on a worker.
+			static std::chrono::milliseconds maxRateLimitSleep() { return std::chrono::milliseconds(500); }
+
+			template<typename Result>
+			std::future<Result> callAsync(Priority priority, web::http::method method, bool authenticated, const std::string &path, const CppRest::Utilities::QueryParams &params, const CallOptions &options, std::function<Result(const std::string &)> decode)
+			{
+				auto promise = std::make_shared<std::promise<Result>>();
+				std::future<Result> result = promise->get_future();
 
-					retry = false;
+				auto call = std::make_shared<Call>();
+				auto command = params.find("command");
+				call->command_ = command != params.end() ? command->second : path;
+				call->priority_ = priority;
+				call->method_ = method;
+				call->authenticated_ = authenticated;
+				call->path_ = path;
+				call->params_ = params;
+				call->deadline_ = options.deadline_ ? *options.deadline_ : std::chrono::steady_clock::now() + connectionSettings_.callTimeout_;
+				call->cancel_ = options.cancel_;
+				call->complete_ = [promise, decode](const std::string &body) {
 					try
 					{
-						
-						web::json::value ret = httpClient->request(request).then([](web::http::http_response response) -> auto
-						{
-							if(response.status_code() == web::http::status_codes::OK && response.headers().content_type().substr(0, utility::string_t(U("application/json")).size()) == U("application/json"))
-							{
-								return response.extract_json();
-							}
-							else if(response.headers().content_type().substr(0, utility::string_t(U("text/html")).size()) == U("text/html"))
-							{
-								auto atask = response.extract_string();
-								try
-								{
-									auto str = atask.get();
-
-									return pplx::task_from_result<web::json::value>(web::json::value(str));
-								}
-								catch(const std::exception &e)
-								{
-									std::cout << __FILE__ ":" << __LINE__ << " - except: " << e.what() << std::endl;
-									return pplx::task_from_result<web::json::value>(web::json::value());
-								}
-								throw std::runtime_error("error: unexpected response (" + std::to_string(response.status_code()) + ": " + CppRest::Utilities::u2s(response.headers().content_type()) + ")");
-							}
-							else if(response.status_code() == 429 && response.reason_phrase() == U("Too Many Requests"))
-							{
-								throw web::http::http_exception(CppRest::Utilities::u2s(response.reason_phrase()));
-							}
-							else
-								throw std::runtime_error("error: unexpected status code (" + std::to_string(response.status_code()) + ") " + CppRest::Utilities::u2s(response.reason_phrase()));
-						}).then([=](web::json::value res_json) -> web::json::value
+						promise->set_value(decode(body));
+					}
+					catch(...)
+					{
+						promise->set_exception(std::current_exception());
+					}
+				};
+				call->fail_ = [promise](std::exception_ptr e) { promise->set_exception(e); };
+
+				{
+					std::lock_guard<std::mutex> lock(statsMutex_);
+					++callStats_.commands_[call->command_].calls_;
+				}
+				scheduleAttempt(call, std::chrono::steady_clock::time_point());
+				return result;
+			}
+
+			//Waits for a call's result but gives up as soon as the caller's token is cancelled. The call itself
+			//notices the same token and stops on its own.
+			template<typename Result>
+			Result wait(std::future<Result> result, const CallOptions &options, const std::string &command)
+			{
+				while(result.wait_for(abortPollInterval()) != std::future_status::ready)
+				{
+					if(options.cancel_.cancelled())
+						throw CallAborted(command, true);
+				}
+				return result.get();
+			}
+
+			web::json::value query(Priority priority, web::http::method method, bool authenticated, const std::string &path, const CppRest::Utilities::QueryParams &params, const CallOptions &options)
+			{
+				auto command = params.find("command");
+				return wait(callAsync<web::json::value>(priority, method, authenticated, path, params, options, [](const std::string &body) {
+					return web::json::value::parse(CppRest::Utilities::s2u(body));
+				}), options, command != params.end() ? command->second : path);
+			}
+
+			//Raw response text for the streaming decoders.
+			std::string queryBody(Priority priority, web::http::method method, bool authenticated, const std::string &path, const CppRest::Utilities::QueryParams &params, const CallOptions &options)
+			{
+				auto command = params.find("command");
+				return wait(callAsync<std::string>(priority, method, authenticated, path, params, options, [](const std::string &body) {
+					return body;
+				}), options, command != params.end() ? command->second : path);
+			}
+
+			void scheduleAttempt(const std::shared_ptr<Call> &call, std::chrono::steady_clock::time_point notBefore)
+			{
+				try
+				{
+					scheduler_.post(call->priority_, [this, call]() { attempt(call); }, notBefore);
+				}
+				catch(...)//shut down
+				{
+					failCall(*call, std::current_exception());
+				}
+			}
+
+			void failCall(Call &call, std::exception_ptr e)
+			{
+				{
+					std::lock_guard<std::mutex> lock(statsMutex_);
+					CallStats::Command &stats = callStats_.commands_[call.command_];
+					try
+					{
+						std::rethrow_exception(e);
+					}
+					catch(const CallAborted &aborted)
+					{
+						if(aborted.cancelled())
+							++stats.cancelled_;
+						else
+							++stats.timeouts_;
+					}
+					catch(...)
+					{
+						++stats.failed_;
+					}
+				}
+				call.fail_(e);
+			}
+
+			void retryCall(const std::shared_ptr<Call> &call, std::chrono::steady_clock::time_point retryAt)
+			{
+				if(retryAt >= call->deadline_)
+				{
+					failCall(*call, std::make_exception_ptr(CallAborted(call->command_, false, call->lastError_)));
+					return;
+				}
+				{
+					std::lock_guard<std::mutex> lock(statsMutex_);
+					++callStats_.commands_[call->command_].retries_;
+				}
+				scheduleAttempt(call, retryAt);
+			}
+
+			//Blocks on an in flight request no longer than the call is allowed to run.
+			template<typename Result>
+			Result waitTransport(pplx::task<Result> task, Call &call)
+			{
+				auto promise = std::make_shared<std::promise<Result>>();
+				std::future<Result> result = promise->get_future();
+				task.then([promise](pplx::task<Result> finished) {
+					try
+					{
+						promise->set_value(finished.get());
+					}
+					catch(...)
+					{
+						promise->set_exception(std::current_exception());
+					}
+				});
+				while(result.wait_for(abortPollInterval()) != std::future_status::ready)
+				{
+					try
+					{
+						call.checkAborted();
+					}
+					catch(const CallAborted &)
+					{
+						call.transport_.cancel();
+						throw;
+					}
+				}
+				return result.get();
+			}
+
+			void recordFlight(const Call &call, std::chrono::system_clock::time_point sentAt, std::chrono::microseconds latency, uint16_t status, uint16_t flags, const std::string &body)
+			{
+				if(!flightRecorder_)
+					return;
+				FlightRecorder::Entry entry;
+				entry.time_ = sentAt;
+				entry.latency_ = latency;
+				entry.status_ = status;
+				entry.flags_ = flags | (call.authenticated_ ? FlightRecorder::AUTHENTICATED : 0);
+				entry.request_ = recordingKey(CppRest::Utilities::u2s(call.method_), call.path_, call.params_);
+				entry.body_ = body;
+				flightRecorder_->record(std::move(entry));
+			}
+
+			//One attempt of call. Completes or fails it, or schedules the next attempt. Retries on transport errors,
+			//429 and stale nonces until the call's deadline.
+			void attempt(std::shared_ptr<Call> call)
+			{
+				RequestRateLimiter::Endpoint endpoint = call->authenticated_ ? RequestRateLimiter::Endpoint::PRIVATE : RequestRateLimiter::Endpoint::PUBLIC;
+				std::chrono::system_clock::time_point sentAt;
+				try
+				{
+					call->checkAborted();
+
+					RecordedResponse response;
+					bool newConnection = false;
+					std::chrono::steady_clock::duration headersTime(0), transferTime(0);
+					if(replay_)
+						response = replay_->respond(recordingKey(CppRest::Utilities::u2s(call->method_), call->path_, call->params_));
+					else
+					{
+						auto readyAt = rateLimiter_.readyAt(endpoint);
+						if(readyAt - std::chrono::steady_clock::now() > maxRateLimitSleep())
 						{
-							if(outputDebugFile)
-								writeQueryDebugOutputFile(request, authenticated, params, res_json);
+							if(readyAt >= call->deadline_)
+								throw CallAborted(call->command_, false, call->lastError_);
+							scheduleAttempt(call, readyAt);
+							return;
+						}
 
-							if(res_json.is_null())
-								throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: res_json is null");
+						std::unique_lock<std::mutex> authenticatedLock(authenticatedRequestMutex_, std::defer_lock);
+						if(call->authenticated_)
+							authenticatedLock.lock();
 
-							if (!res_json.is_object() && !res_json.is_array())
-								throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: not obj - " + CppRest::Utilities::u2s(res_json.serialize()).substr(0, 500));
+						web::http::http_request request = makeRequest(call->method_, call->authenticated_, call->path_, call->params_);
 
-							if(res_json.has_field(U("error")))
-							{
-								utility::string_t errStr = res_json[U("error")].as_string();
-								//{ error:"Nonce must be greater than 1460846370855. You provided 2." }
-								if (errStr.compare(0, utility::string_t(U("Nonce must be greater than ")).size(), U("Nonce must be greater than ")) == 0)
-								{
-									errStr = errStr.substr(utility::string_t(U("Nonce must be greater than ")).size());
-									nonce_ = stoull(errStr.substr(0, errStr.find(U('.'))));
-									throw web::http::http_exception(CppRest::Utilities::u2s(res_json[U("error")].as_string()));
-								}
-								else if (errStr.compare(0, utility::string_t(U("Error canceling loan order")).size(), U("Error canceling loan order")) == 0)
-									return res_json;
-								else
-									throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: unknown api error: " + CppRest::Utilities::u2s(res_json.serialize()));
-							}
+						rateLimiter_.acquire(endpoint);
 
-							return res_json;
-						}).get();
+						auto client = currentHttpClient();
+						uint64_t newConnectionsBefore = threadNewConnectionCount();
+						auto startTime = std::chrono::steady_clock::now();
+						sentAt = std::chrono::system_clock::now();
 
-						return ret;
+						web::http::http_response httpResponse = waitTransport(client->request(request, call->transport_.get_token()), *call);
+						auto headersReceived = std::chrono::steady_clock::now();
+						newConnection = threadNewConnectionCount() != newConnectionsBefore;
+
+						response.status_ = httpResponse.status_code();
+						response.reasonPhrase_ = CppRest::Utilities::u2s(httpResponse.reason_phrase());
+						response.contentType_ = CppRest::Utilities::u2s(httpResponse.headers().content_type());
+						response.body_ = waitTransport(httpResponse.extract_utf8string(true), *call);
+
+						auto bodyReceived = std::chrono::steady_clock::now();
+						headersTime = headersReceived - startTime;
+						transferTime = bodyReceived - headersReceived;
+						response.latency_ = std::chrono::duration_cast<std::chrono::microseconds>(bodyReceived - startTime);
+
+						if(recorder_)
+							recorder_->append(recordingKey(CppRest::Utilities::u2s(call->method_), call->path_, call->params_), response);
+						recordFlight(*call, sentAt, response.latency_, response.status_, 0, response.body_);
 					}
-					catch(const web::http::http_exception &e)
+
+					if(response.status_ != web::http::status_codes::OK || response.contentType_.compare(0, std::string("application/json").size(), "application/json") != 0)
 					{
-						std::cout << "http request exception: " << e.what() << std::endl;
-						if (strcmp(e.what(), "Too Many Requests") == 0)
+						if(response.contentType_.compare(0, std::string("text/html").size(), "text/html") == 0)
+							throw std::runtime_error(__FILE__ ":" STR__LINE__ " e: not obj - " + response.body_.substr(0, 500));
+						if(response.status_ == 429 && response.reasonPhrase_ == "Too Many Requests")
 						{
-							requestRateLimitTime *= 2;
-							std::this_thread::sleep_for(std::chrono::seconds(25));
+							if(!replay_)
+								rateLimiter_.onRateLimited(endpoint);
+							throw web::http::http_exception(CppRest::Utilities::s2u(response.reasonPhrase_));
 						}
-						std::this_thread::sleep_for(std::chrono::seconds(5));
-						retry = true;
+						throw std::runtime_error("error: unexpected status code (" + std::to_string(response.status_) + ") " + response.reasonPhrase_);
 					}
-				}
 
-				if (requestRateLimitTime > minRequestRateLimitTime)
+					if(!replay_)
+					{
+						recordRequestTiming(newConnection, headersTime, transferTime);
+						rateLimiter_.onSuccess(endpoint);
+					}
+
+					checkApiError(response.body_);
+
+					call->complete_(response.body_);
+				}
+				catch(const web::http::http_exception &e)
+				{
+					std::cout << "http request exception: " << e.what() << std::endl;
+					if(e.error_code())//transport failure, not an api response; rate limiting is counted by the limiter
+					{
+						{
+							std::lock_guard<std::mutex> lock(statsMutex_);
+							++connectionStats_.failedRequests_;
+						}
+						resetHttpClient();
+						if(!replay_ && sentAt != std::chrono::system_clock::time_point())
+							recordFlight(*call, sentAt, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - sentAt), 0, FlightRecorder::TRANSPORT_ERROR, e.what());
+					}
+					call->lastError_ = e.what();
+					if(replay_)//the recording already holds the retry's response
+						retryCall(call, std::chrono::steady_clock::time_point());
+					else if(strcmp(e.what(), "Too Many Requests") == 0)//waits out the limiter's cooldown instead
+						retryCall(call, rateLimiter_.readyAt(endpoint));
+					else
+						retryCall(call, std::chrono::steady_clock::now() + connectionSettings_.retryBackoff_);
+				}
+				catch(...)
 				{
-					requestRateLimitTime -= std::chrono::milliseconds(1);
-					if (requestRateLimitTime < minRequestRateLimitTime)
-						requestRateLimitTime = minRequestRateLimitTime;
+					failCall(*call, std::current_exception());
 				}
-
-				return web::json::value();
 			}
 		};
 	}
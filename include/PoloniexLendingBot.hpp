@@ -16,8 +16,16 @@ limitations under the License.
 
 #pragma once
 
+#include "LoanOrderBookHistory.hpp"
+#include "LoanOrdersDepthEstimator.hpp"
 #include "logging.hpp"
+#include "OfferChurnPlanner.hpp"
 #include "PoloniexApi.hpp"
+#include "RateHistoryFile.hpp"
+#include "RollingRateStatistics.hpp"
+#include "SpreadLendPlanCache.hpp"
+#include "SpreadLendStrategy.hpp"
+#include "StagedPipeline.hpp"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #undef BOOST_NO_EXCEPTIONS
@@ -38,7 +46,10 @@ namespace filesystem = boost::filesystem;
 
 #include <deque>
 #include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -63,6 +74,7 @@ namespace tylawin
 				Rate rate_;
 			};
 
+		public://for tools that read coin settings, e.g. PoloLendingBotBacktest
 			class Settings
 			{
 			public:
@@ -104,12 +116,28 @@ namespace tylawin
 						stopLending_(false)
 					{}
 
+					//Strategy runs at exchange precision so settings it uses must not need rounding to get there.
+					template<typename Fixed>
+					static std::string exchangePrecisionValue(const boost::property_tree::ptree &pt, const std::string &name)
+					{
+						std::string value = pt.get<std::string>(name);
+						try
+						{
+							Fixed::parse(value);
+						}
+						catch(const std::exception &)
+						{
+							throw std::invalid_argument(name + "(" + value + ") must be a plain decimal number with at most " + std::to_string(Fixed().toString().size() - 2) + " decimal places");
+						}
+						return value;
+					}
+
 					void ptree(boost::property_tree::ptree &pt)
 					{
-						lowestOffersDustSkipAmount_ = Amount(pt.get<std::string>("lowestOffersDustSkipAmount"));
-						spreadDustSkipAmount_ = Amount(pt.get<std::string>("spreadDustSkipAmount"));
+						lowestOffersDustSkipAmount_ = Amount(exchangePrecisionValue<FixedAmount>(pt, "lowestOffersDustSkipAmount"));
+						spreadDustSkipAmount_ = Amount(exchangePrecisionValue<FixedAmount>(pt, "spreadDustSkipAmount"));
 
-						minRateSkipAmount_ = Amount(pt.get<std::string>("minRateSkipAmount"));
+						minRateSkipAmount_ = Amount(exchangePrecisionValue<FixedRate>(pt, "minRateSkipAmount"));
 						if(minRateSkipAmount_ < Decimal(".000001") || minRateSkipAmount_ > Decimal(".01"))
 							throw std::invalid_argument("minRateSkipAmount(" + to_string(minRateSkipAmount_) + ") valid range is [0.000001, 0.01]");
 
@@ -117,7 +145,7 @@ namespace tylawin
 						if(lendOrdersToSpread_ < 1 || lendOrdersToSpread_ > 50)
 							throw std::invalid_argument("lendOrdersToSpread(" + std::to_string(lendOrdersToSpread_) + ") valid range is [1, 50]");
 
-						minLendOfferAmount_ = Amount(pt.get<std::string>("minLendOfferAmount"));
+						minLendOfferAmount_ = Amount(exchangePrecisionValue<FixedAmount>(pt, "minLendOfferAmount"));
 						if(minLendOfferAmount_ < Decimal(".00000001") || minLendOfferAmount_ > Decimal("10000000"))
 							throw std::invalid_argument("minLendOfferAmount(" + to_string(minLendOfferAmount_) + ") valid range is [.00000001, 10000000]");
 
@@ -129,11 +157,11 @@ namespace tylawin
 						if(maxTotalLendOrdersToSpread_ < 1 || maxTotalLendOrdersToSpread_ > 50000)
 							throw std::invalid_argument("maxTotalLendOrdersToSpread(" + std::to_string(maxTotalLendOrdersToSpread_) + ") valid range is [1, 50000]");
 
-						minDailyRate_ = Rate(pt.get<std::string>("minDailyRate"));
+						minDailyRate_ = Rate(exchangePrecisionValue<FixedRate>(pt, "minDailyRate"));
 						if(minDailyRate_ < Decimal("0.000001") || minDailyRate_ > Decimal("0.05")) // 5% max on Poloniex
 							throw std::invalid_argument("minDailyRate(" + to_string(minDailyRate_) + ") valid range is [0.000001, 0.05]");
 
-						maxDailyRate_ = Rate(pt.get<std::string>("maxDailyRate"));
+						maxDailyRate_ = Rate(exchangePrecisionValue<FixedRate>(pt, "maxDailyRate"));
 						if(maxDailyRate_ < Decimal("0.000001") || maxDailyRate_ > Decimal("0.05"))
 							throw std::invalid_argument("maxDailyRate(" + to_string(minDailyRate_) + ") valid range is [0.000001, 0.05]");
 
@@ -184,6 +212,30 @@ namespace tylawin
 
 						return pt;
 					}
+
+					SpreadLendStrategy::Params strategyParams() const
+					{
+						SpreadLendStrategy::Params params;
+						params.lowestOffersDustSkipAmount_ = toFixed<FixedAmount>(lowestOffersDustSkipAmount_);
+						params.spreadDustSkipAmount_ = toFixed<FixedAmount>(spreadDustSkipAmount_);
+						params.minLendOfferAmount_ = toFixed<FixedAmount>(minLendOfferAmount_);
+						params.minRateSkipAmount_ = toFixed<FixedRate>(minRateSkipAmount_);
+						params.minDailyRate_ = toFixed<FixedRate>(minDailyRate_);
+						params.maxDailyRate_ = toFixed<FixedRate>(maxDailyRate_);
+						params.minTotalLendOrdersToSpread_ = minTotalLendOrdersToSpread_;
+						params.maxTotalLendOrdersToSpread_ = maxTotalLendOrdersToSpread_;
+						params.lendOrdersToSpread_ = lendOrdersToSpread_;
+						return params;
+					}
+
+					//dayThreshold_ on the rate grid. Rounded up, so offer rate >= threshold compares the same.
+					std::map<FixedRate, uint8_t> dayThresholds() const
+					{
+						std::map<FixedRate, uint8_t> thresholds;
+						for(const auto &threshold : dayThreshold_)
+							thresholds[toFixed<FixedRate>(threshold.first, Rounding::UP)] = threshold.second;
+						return thresholds;
+					}
 				};
 
 				struct Data
@@ -193,6 +245,13 @@ namespace tylawin
 					std::chrono::seconds startupStatisticsInitializeInterval_;
 					std::chrono::seconds updateRateStatisticsInterval_;
 					std::chrono::seconds refreshLoansInterval_;
+					std::chrono::seconds loanOrdersCacheTtl_;
+					std::chrono::seconds offerChangeBudget_;
+					std::vector<std::chrono::seconds> rateStatisticsWindows_;//read at startup only
+					std::chrono::seconds strategyRateStatisticsWindow_;//read at startup only
+					std::string rateStatisticsDirectory_;//read at startup only, empty disables
+					std::string loanOrderBookHistoryDirectory_;//read at startup only, empty disables
+					PoloniexApi::ConnectionSettings connection_;//read at startup only
 				};
 				Data data_;
 
@@ -203,6 +262,13 @@ namespace tylawin
 					data_.startupStatisticsInitializeInterval_ = rhs.data_.startupStatisticsInitializeInterval_;
 					data_.updateRateStatisticsInterval_ = rhs.data_.updateRateStatisticsInterval_;
 					data_.refreshLoansInterval_ = rhs.data_.refreshLoansInterval_;
+					data_.loanOrdersCacheTtl_ = rhs.data_.loanOrdersCacheTtl_;
+					data_.offerChangeBudget_ = rhs.data_.offerChangeBudget_;
+					data_.rateStatisticsWindows_ = rhs.data_.rateStatisticsWindows_;
+					data_.strategyRateStatisticsWindow_ = rhs.data_.strategyRateStatisticsWindow_;
+					data_.rateStatisticsDirectory_ = rhs.data_.rateStatisticsDirectory_;
+					data_.loanOrderBookHistoryDirectory_ = rhs.data_.loanOrderBookHistoryDirectory_;
+					data_.connection_ = rhs.data_.connection_;
 					data_.coinSettings_ = rhs.data_.coinSettings_;
 					settingsFile_ = rhs.settingsFile_;
 				}
@@ -213,6 +279,11 @@ namespace tylawin
 					data_.startupStatisticsInitializeInterval_ = std::chrono::seconds(60 * 15);
 					data_.updateRateStatisticsInterval_ = std::chrono::seconds(10);
 					data_.refreshLoansInterval_ = std::chrono::seconds(60);
+					data_.loanOrdersCacheTtl_ = std::chrono::seconds(5);
+					data_.offerChangeBudget_ = std::chrono::seconds(3);
+					data_.rateStatisticsWindows_ = { std::chrono::seconds(60), std::chrono::seconds(60 * 15), std::chrono::seconds(3600), std::chrono::seconds(3600 * 24) };
+					data_.strategyRateStatisticsWindow_ = std::chrono::seconds(60 * 15);
+					data_.rateStatisticsDirectory_ = "logs/ratestatistics";
 					data_ = readDataFromFile();
 				}
 
@@ -226,6 +297,13 @@ namespace tylawin
 					data_.startupStatisticsInitializeInterval_ = rhs.data_.startupStatisticsInitializeInterval_;
 					data_.updateRateStatisticsInterval_ = rhs.data_.updateRateStatisticsInterval_;
 					data_.refreshLoansInterval_ = rhs.data_.refreshLoansInterval_;
+					data_.loanOrdersCacheTtl_ = rhs.data_.loanOrdersCacheTtl_;
+					data_.offerChangeBudget_ = rhs.data_.offerChangeBudget_;
+					data_.rateStatisticsWindows_ = rhs.data_.rateStatisticsWindows_;
+					data_.strategyRateStatisticsWindow_ = rhs.data_.strategyRateStatisticsWindow_;
+					data_.rateStatisticsDirectory_ = rhs.data_.rateStatisticsDirectory_;
+					data_.loanOrderBookHistoryDirectory_ = rhs.data_.loanOrderBookHistoryDirectory_;
+					data_.connection_ = rhs.data_.connection_;
 					settingsFile_ = rhs.settingsFile_;
 					return *this;
 				}
@@ -274,6 +352,82 @@ namespace tylawin
 						if(tmpData.refreshLoansInterval_ < std::chrono::seconds(1) || tmpData.refreshLoansInterval_ > std::chrono::seconds(3600))
 							throw std::invalid_argument("refreshLoansInterval(" + std::to_string(tmpData.refreshLoansInterval_.count()) + ") valid range is [1, 3600] seconds");
 
+						//optional so older config files keep working
+						tmpData.loanOrdersCacheTtl_ = std::chrono::seconds(pt.get<int>("loanOrdersCacheTtl", 5));
+						if(tmpData.loanOrdersCacheTtl_ < std::chrono::seconds(0) || tmpData.loanOrdersCacheTtl_ > std::chrono::seconds(60))
+							throw std::invalid_argument("loanOrdersCacheTtl(" + std::to_string(tmpData.loanOrdersCacheTtl_.count()) + ") valid range is [0, 60] seconds");
+
+						tmpData.offerChangeBudget_ = std::chrono::seconds(pt.get<int>("offerChangeBudget", 3));
+						if(tmpData.offerChangeBudget_ < std::chrono::seconds(1) || tmpData.offerChangeBudget_ > std::chrono::seconds(3600))
+							throw std::invalid_argument("offerChangeBudget(" + std::to_string(tmpData.offerChangeBudget_.count()) + ") valid range is [1, 3600] seconds");
+
+						tmpData.rateStatisticsWindows_ = { std::chrono::seconds(60), std::chrono::seconds(60 * 15), std::chrono::seconds(3600), std::chrono::seconds(3600 * 24) };
+						auto windowsTree = pt.get_child_optional("rateStatisticsWindows");
+						if(windowsTree)
+						{
+							tmpData.rateStatisticsWindows_.clear();
+							for(auto pr : *windowsTree)
+							{
+								std::chrono::seconds window(pr.second.get_value<int>());
+								if(window < std::chrono::seconds(1) || window > std::chrono::seconds(3600 * 24 * 7))
+									throw std::invalid_argument("rateStatisticsWindows(" + std::to_string(window.count()) + ") valid range is [1, 3600*24*7] seconds");
+								tmpData.rateStatisticsWindows_.push_back(window);
+							}
+						}
+						tmpData.strategyRateStatisticsWindow_ = std::chrono::seconds(pt.get<int>("strategyRateStatisticsWindow", 60 * 15));
+						if(std::find(tmpData.rateStatisticsWindows_.begin(), tmpData.rateStatisticsWindows_.end(), tmpData.strategyRateStatisticsWindow_) == tmpData.rateStatisticsWindows_.end())
+							throw std::invalid_argument("strategyRateStatisticsWindow(" + std::to_string(tmpData.strategyRateStatisticsWindow_.count()) + ") must be one of rateStatisticsWindows");
+						tmpData.rateStatisticsDirectory_ = pt.get<std::string>("rateStatisticsDirectory", "logs/ratestatistics");
+						tmpData.loanOrderBookHistoryDirectory_ = pt.get<std::string>("loanOrderBookHistoryDirectory", "");
+
+						tmpData.connection_.baseUri_ = pt.get<std::string>("apiBaseUri", tmpData.connection_.baseUri_);
+						if(tmpData.connection_.baseUri_.compare(0, 7, "http://") != 0 && tmpData.connection_.baseUri_.compare(0, 8, "https://") != 0)
+							throw std::invalid_argument("apiBaseUri(" + tmpData.connection_.baseUri_ + ") must start with http:// or https://");
+
+						tmpData.connection_.requestTimeout_ = std::chrono::seconds(pt.get<int>("requestTimeout", static_cast<int>(tmpData.connection_.requestTimeout_.count())));
+						if(tmpData.connection_.requestTimeout_ < std::chrono::seconds(1) || tmpData.connection_.requestTimeout_ > std::chrono::seconds(600))
+							throw std::invalid_argument("requestTimeout(" + std::to_string(tmpData.connection_.requestTimeout_.count()) + ") valid range is [1, 600] seconds");
+
+						tmpData.connection_.callTimeout_ = std::chrono::seconds(pt.get<int>("callTimeout", static_cast<int>(tmpData.connection_.callTimeout_.count())));
+						if(tmpData.connection_.callTimeout_ < tmpData.connection_.requestTimeout_ || tmpData.connection_.callTimeout_ > std::chrono::seconds(3600))
+							throw std::invalid_argument("callTimeout(" + std::to_string(tmpData.connection_.callTimeout_.count()) + ") valid range is [requestTimeout, 3600] seconds");
+
+						tmpData.connection_.retryBackoff_ = std::chrono::seconds(pt.get<int>("retryBackoff", static_cast<int>(tmpData.connection_.retryBackoff_.count())));
+						if(tmpData.connection_.retryBackoff_ < std::chrono::seconds(1) || tmpData.connection_.retryBackoff_ > std::chrono::seconds(300))
+							throw std::invalid_argument("retryBackoff(" + std::to_string(tmpData.connection_.retryBackoff_.count()) + ") valid range is [1, 300] seconds");
+
+						tmpData.connection_.maxRequestsInFlight_ = pt.get<size_t>("maxRequestsInFlight", tmpData.connection_.maxRequestsInFlight_);
+						if(tmpData.connection_.maxRequestsInFlight_ < 1 || tmpData.connection_.maxRequestsInFlight_ > 16)
+							throw std::invalid_argument("maxRequestsInFlight(" + std::to_string(tmpData.connection_.maxRequestsInFlight_) + ") valid range is [1, 16]");
+
+						tmpData.connection_.warmup_ = pt.get<bool>("connectionWarmup", tmpData.connection_.warmup_);
+
+						tmpData.connection_.loanOrderBookFeedUri_ = pt.get<std::string>("loanOrderBookFeedUri", tmpData.connection_.loanOrderBookFeedUri_);
+						if(!tmpData.connection_.loanOrderBookFeedUri_.empty() && tmpData.connection_.loanOrderBookFeedUri_.compare(0, 5, "ws://") != 0 && tmpData.connection_.loanOrderBookFeedUri_.compare(0, 6, "wss://") != 0)
+							throw std::invalid_argument("loanOrderBookFeedUri(" + tmpData.connection_.loanOrderBookFeedUri_ + ") must be empty or start with ws:// or wss://");
+
+						tmpData.connection_.recordFile_ = pt.get<std::string>("recordApiFile", tmpData.connection_.recordFile_);
+						tmpData.connection_.replayFile_ = pt.get<std::string>("replayApiFile", tmpData.connection_.replayFile_);
+						if(!tmpData.connection_.recordFile_.empty() && !tmpData.connection_.replayFile_.empty())
+							throw std::invalid_argument("recordApiFile and replayApiFile can't both be set");
+						std::string replayTiming = pt.get<std::string>("replayTiming", tmpData.connection_.replayTiming_ == ApiReplay::Timing::FAST ? "fast" : "original");
+						if(replayTiming == "original")
+							tmpData.connection_.replayTiming_ = ApiReplay::Timing::ORIGINAL;
+						else if(replayTiming == "fast")
+							tmpData.connection_.replayTiming_ = ApiReplay::Timing::FAST;
+						else
+							throw std::invalid_argument("replayTiming(" + replayTiming + ") must be original or fast");
+
+						tmpData.connection_.flightRecorderFile_ = pt.get<std::string>("flightRecorderFile", tmpData.connection_.flightRecorderFile_);
+						tmpData.connection_.flightRecorderEntries_ = pt.get<uint32_t>("flightRecorderEntries", tmpData.connection_.flightRecorderEntries_);
+						if(tmpData.connection_.flightRecorderEntries_ < 1 || tmpData.connection_.flightRecorderEntries_ > 65536)
+							throw std::invalid_argument("flightRecorderEntries(" + std::to_string(tmpData.connection_.flightRecorderEntries_) + ") valid range is [1, 65536]");
+						tmpData.connection_.flightRecorderEntryBytes_ = pt.get<uint32_t>("flightRecorderEntryBytes", tmpData.connection_.flightRecorderEntryBytes_);
+						if(tmpData.connection_.flightRecorderEntryBytes_ < 1024 || tmpData.connection_.flightRecorderEntryBytes_ > 1048576)
+							throw std::invalid_argument("flightRecorderEntryBytes(" + std::to_string(tmpData.connection_.flightRecorderEntryBytes_) + ") valid range is [1024, 1048576]");
+						if(tmpData.connection_.flightRecorderEntryBytes_ % 8 != 0)
+							throw std::invalid_argument("flightRecorderEntryBytes(" + std::to_string(tmpData.connection_.flightRecorderEntryBytes_) + ") must be a multiple of 8");
+
 						boost::property_tree::ptree pt2 = pt.get_child("CoinSettings");
 						std::string curCode;
 						for(auto pr : pt2)
@@ -314,6 +468,32 @@ namespace tylawin
 					pt.add("startupStatisticsInitializeInterval", data.startupStatisticsInitializeInterval_.count());
 					pt.add("updateRateStatisticsInterval", data.updateRateStatisticsInterval_.count());
 					pt.add("refreshLoansInterval", data.refreshLoansInterval_.count());
+					pt.add("loanOrdersCacheTtl", data.loanOrdersCacheTtl_.count());
+					pt.add("offerChangeBudget", data.offerChangeBudget_.count());
+					boost::property_tree::ptree windowsTree;
+					for(auto window : data.rateStatisticsWindows_)
+					{
+						boost::property_tree::ptree windowTree;
+						windowTree.put_value(window.count());
+						windowsTree.push_back(make_pair("", windowTree));
+					}
+					pt.add_child("rateStatisticsWindows", windowsTree);
+					pt.add("strategyRateStatisticsWindow", data.strategyRateStatisticsWindow_.count());
+					pt.add("rateStatisticsDirectory", data.rateStatisticsDirectory_);
+					pt.add("loanOrderBookHistoryDirectory", data.loanOrderBookHistoryDirectory_);
+					pt.add("apiBaseUri", data.connection_.baseUri_);
+					pt.add("requestTimeout", data.connection_.requestTimeout_.count());
+					pt.add("callTimeout", data.connection_.callTimeout_.count());
+					pt.add("retryBackoff", data.connection_.retryBackoff_.count());
+					pt.add("maxRequestsInFlight", data.connection_.maxRequestsInFlight_);
+					pt.add("connectionWarmup", data.connection_.warmup_);
+					pt.add("loanOrderBookFeedUri", data.connection_.loanOrderBookFeedUri_);
+					pt.add("recordApiFile", data.connection_.recordFile_);
+					pt.add("replayApiFile", data.connection_.replayFile_);
+					pt.add("replayTiming", data.connection_.replayTiming_ == ApiReplay::Timing::FAST ? "fast" : "original");
+					pt.add("flightRecorderFile", data.connection_.flightRecorderFile_);
+					pt.add("flightRecorderEntries", data.connection_.flightRecorderEntries_);
+					pt.add("flightRecorderEntryBytes", data.connection_.flightRecorderEntryBytes_);
 
 					boost::property_tree::ptree coinPt;
 					for(auto coinSetting : data.coinSettings_)
@@ -347,6 +527,13 @@ namespace tylawin
 						data_.startupStatisticsInitializeInterval_ = tmpData.startupStatisticsInitializeInterval_;
 						data_.updateRateStatisticsInterval_ = tmpData.updateRateStatisticsInterval_;
 						data_.refreshLoansInterval_ = tmpData.refreshLoansInterval_;
+						data_.loanOrdersCacheTtl_ = tmpData.loanOrdersCacheTtl_;
+						data_.offerChangeBudget_ = tmpData.offerChangeBudget_;
+						data_.connection_ = tmpData.connection_;
+						data_.rateStatisticsWindows_ = tmpData.rateStatisticsWindows_;//kept for the next start, so the write below doesn't revert the edit
+						data_.strategyRateStatisticsWindow_ = tmpData.strategyRateStatisticsWindow_;
+						data_.rateStatisticsDirectory_ = tmpData.rateStatisticsDirectory_;
+						data_.loanOrderBookHistoryDirectory_ = tmpData.loanOrderBookHistoryDirectory_;
 						for(auto pr : tmpData.coinSettings_)
 						{
 							data_.coinSettings_[pr.first] = pr.second;
@@ -357,30 +544,99 @@ namespace tylawin
 				}
 			};
 
+		private:
 			std::map<CurrencyCode, LentItemInfo> totalLent_;
 			std::map<CurrencyCode, LentAndLendableCurrencyInfo> totalLentAndLendable_;
 			std::unordered_map<CurrencyCode, uint32_t> loanCount_;
 			bool dryRun_ = false;
 			Settings settings_;
+			const Settings::Data startupSettings_;//what the settings read at startup only are read from, settings_ holds edits to them until the next start
 			PoloniexApi poloApi;
 			std::function<bool()> doQuit_;
+			PoloniexApi::CancellationToken quit_;//cancels api calls in progress as soon as doQuit_ returns true
 			PoloniexApi::ActiveLoans activeLoans_;
-			std::unordered_map<CurrencyCode, uint32_t> curGetLoanOrdersFloatingLimit_;
+			std::unordered_map<CurrencyCode, LoanOrdersDepthEstimator> loanOrdersDepth_;
+			std::unordered_map<CurrencyCode, SpreadLendStrategy::Params> strategyParams_;//cleared when settings are reloaded
+			SpreadLendPlanCache spreadLendPlans_;
+			uint64_t reconcileSkips_ = 0;//refreshes where the reused plan was already on the books
+			OfferChurnPlanner offerChanges_;
+
+			//Decimal -> exchange precision. exact is set false if rounding changed the value.
+			template<typename Fixed>
+			static Fixed toFixed(const Decimal &value, Rounding rounding = Rounding::EXACT, bool *exact = nullptr)
+			{
+				std::string str = to_string(value, 18);
+				Fixed result = Fixed::parse(str, rounding);
+				if(exact)
+					*exact = (rounding == Rounding::EXACT) || Fixed::parse(str, Rounding::DOWN) == Fixed::parse(str, Rounding::UP);
+				return result;
+			}
+
+			static Decimal toDecimal(const FixedAmount &value) { return Decimal(value.toString()); }
+			static Decimal toDecimal(const FixedRate &value) { return Decimal(value.toString()); }
+
+			//Calls made while running are abandoned on ^c. Calls made while shutting down are not.
+			PoloniexApi::CallOptions runningCall() const { return PoloniexApi::CallOptions(quit_); }
+
+			//Sleeps for duration unless ^c comes first. Returns true on quit.
+			bool sleepUnlessQuit(std::chrono::steady_clock::duration duration)
+			{
+				auto until = std::chrono::steady_clock::now() + duration;
+				while(!quit_.cancelled())
+				{
+					auto now = std::chrono::steady_clock::now();
+					if(now >= until)
+						return false;
+					std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(until - now, std::chrono::milliseconds(100)));
+				}
+				return true;
+			}
+
+			static bool isQuitAbort(const std::exception &e)
+			{
+				auto aborted = dynamic_cast<const PoloniexApi::CallAborted *>(&e);
+				return aborted && aborted->cancelled();
+			}
+
+			const SpreadLendStrategy::Params &strategyParams(const CurrencyCode &curCode)
+			{
+				auto iter = strategyParams_.find(curCode);
+				if(iter == strategyParams_.end())
+					iter = strategyParams_.emplace(curCode, settings_.data_.coinSettings_[curCode].strategyParams()).first;
+				return iter->second;
+			}
 
 		public:
 			void dryRun(const bool setValue) { dryRun_ = setValue; }
 
+			//Called around the work of each main loop pass (not its sleep). end_ is told whether loans were refreshed.
+			//For benchmarks; a pass that throws doesn't call end_.
+			struct TickObserver
+			{
+				std::function<void()> begin_;
+				std::function<void(bool refreshed)> end_;
+			};
+			void tickObserver(const TickObserver &observer) { tickObserver_ = observer; }
+
+		private:
+			TickObserver tickObserver_;
+
+		public:
 			PoloniexLendingBot(std::function<bool()> doQuit, filesystem::path settingsFile = "config.json") :
 				settings_(settingsFile),
-				poloApi(settings_.data_.apiKey_, settings_.data_.apiSecret_),
-				doQuit_(doQuit)
-			{}
+				startupSettings_(settings_.data_),
+				poloApi(settings_.data_.apiKey_, settings_.data_.apiSecret_, settings_.data_.connection_),
+				doQuit_(doQuit),
+				quit_(doQuit)
+			{
+				poloApi.loanOrdersCacheTtl(settings_.data_.loanOrdersCacheTtl_);
+			}
 
 			void refreshActiveLoansAndTotalLent()
 			{
-				auto lendingAccountBalances = poloApi.getAvailableAccountBalances(PoloniexApi::AccountTypes::LENDING)[PoloniexApi::AccountTypes::LENDING];
-				auto loanOffers = poloApi.getOpenLoanOffers();
-				activeLoans_ = poloApi.getActiveLoans();
+				auto lendingAccountBalances = poloApi.getAvailableAccountBalances(PoloniexApi::AccountTypes::LENDING, runningCall())[PoloniexApi::AccountTypes::LENDING];
+				auto loanOffers = poloApi.getOpenLoanOffers(runningCall());
+				activeLoans_ = poloApi.getActiveLoans(runningCall());
 
 				for(auto& lent : totalLent_)
 				{
@@ -517,7 +773,7 @@ namespace tylawin
 
 				web::json::value response;
 				if(dryRun_ == false)
-					response = poloApi.createLoanOffer(curCode, amtStr, days, 0, to_string(rate, 6));
+					response = poloApi.createLoanOffer(curCode, amtStr, days, 0, to_string(rate, 6), runningCall());
 				else
 					response[U("message")] = web::json::value(U("dryrun"));
 
@@ -529,7 +785,7 @@ namespace tylawin
 			{
 				if(dryRun_ == true)
 					return;
-				auto loanOffers = poloApi.getOpenLoanOffers();
+				auto loanOffers = poloApi.getOpenLoanOffers(runningCall());
 				if(loanOffers.size() == 0)//api returns array when empty instead of object... [] vs {} then the next loop crashes...
 					return;
 
@@ -544,23 +800,19 @@ namespace tylawin
 							rsp.success_ = true;
 							rsp.msg_ = "dryrun";
 							if(dryRun_ == false)
-								rsp = poloApi.cancelLoanOffer(offer.id_);
+								rsp = poloApi.cancelLoanOffer(offer.id_, runningCall());
 							INFO << " Canceling " << loanCurCode << " order... " << (rsp.success_ ? "Canceled - msg: " : "Failed - error: ") << rsp.msg_;
 						}
 					}
 				}
 			}
 
-			boost::optional<Rate> lowestOfferRateAboveDustAmount(PoloniexApi::LoanOrders::Offers &loanOffers, CurrencyCode curCode)
+			boost::optional<Rate> lowestOfferRateAboveDustAmount(const PoloniexApi::LoanOrders::Offers &loanOffers, CurrencyCode curCode)
 			{
-				Amount amt(0);
-				for(auto offer : loanOffers)
-				{
-					amt += offer.second.amount_;
-					if(amt >= settings_.data_.coinSettings_.at(curCode).lowestOffersDustSkipAmount_)
-						return offer.first;
-				}
-				return boost::none;
+				auto rate = SpreadLendStrategy::lowestOfferRateAboveDustAmount(strategyParams(curCode), loanOffers);
+				if(!rate)
+					return boost::none;
+				return toDecimal(*rate);
 			}
 
 		private:
@@ -570,115 +822,116 @@ namespace tylawin
 				class Coin
 				{
 				public:
-					std::deque<Rate> lendingRateHist_15m;
-					Decimal lendingRateLow_15m;
-					Decimal lendingRateHigh_15m;
-					Decimal movingAvgLendingRate_15m;
+					RollingRateStatistics rates_;//rateStatisticsWindows
+					std::unique_ptr<RateHistoryFile> history_;//every sample in rates_, null when rateStatisticsDirectory is empty
+					Decimal lendingRateLow_;//strategyRateStatisticsWindow
+					Decimal lendingRateHigh_;
+					Decimal movingAvgLendingRate_;
 
 					Coin() :
-						lendingRateLow_15m(-1),
-						lendingRateHigh_15m(-1),
-						movingAvgLendingRate_15m(-1)
+						lendingRateLow_(-1),
+						lendingRateHigh_(-1),
+						movingAvgLendingRate_(-1)
 					{}
 				};
 
-				static Rate lowestRate(const std::deque<Rate> &dq)
-				{
-					Rate min(500000);
-					for(auto rate : dq)
-					{
-						if(rate < min)
-							min = rate;
-					}
-					return min;
-				}
-
-				static Rate highestRate(const std::deque<Rate> &dq)
-				{
-					Rate max(0);
-					for(auto rate : dq)
-					{
-						if(rate > max)
-							max = rate;
-					}
-					return max;
-				}
-
-				static Rate averageRate(const std::deque<Rate> &dq)
-				{
-					Rate avgSum(0);
-					for(auto rate : dq)
-						avgSum += rate;
-					return avgSum / dq.size();
-				}
-
 				std::unordered_map<CurrencyCode, Coin> coinStats_;
 			private:
 			};
 			LendingStatistics lendingStatistics_;
 
-			boost::optional<uint32_t> calcPositionOfLastOfferToSpreadLendUnder(const CurrencyCode &curCode, PoloniexApi::LoanOrders::Offers &loanOffers)
+			boost::optional<uint32_t> calcPositionOfLastOfferToSpreadLendUnder(const CurrencyCode &curCode, const PoloniexApi::LoanOrders::Offers &loanOffers)
 			{
-				uint32_t offerCount = 0;
-				uint16_t spreadCount = 0;
-
-				Amount sum;
-				for(auto offer : loanOffers)
-				{
-					sum += offer.second.amount_;
-					if(spreadCount == 0 && sum >= settings_.data_.coinSettings_.at(curCode).lowestOffersDustSkipAmount_)
-					{
-						++spreadCount;
-						sum = 0;
-					}
-					else if(spreadCount != 0 && sum >= settings_.data_.coinSettings_.at(curCode).spreadDustSkipAmount_)
-					{
-						++spreadCount;
-						sum = 0;
-					}
-					++offerCount;
-					if(spreadCount >= settings_.data_.coinSettings_.at(curCode).lendOrdersToSpread_)
-						return offerCount;
-				}
+				return SpreadLendStrategy::positionOfLastOfferToSpreadLendUnder(strategyParams(curCode), loanOffers);
+			}
 
-				return boost::none;
+			uint16_t loanOrdersLimit(const CurrencyCode &curCode)
+			{
+				return loanOrdersDepth_[curCode].limit(SpreadLendStrategy::amountToSpreadLendUnder(strategyParams(curCode)));
 			}
 
-			PoloniexApi::LoanOrders::Offers getLoanOrdersAndAdjustLimit(const CurrencyCode &curCode)
+			//prefetched must have been requested with loanOrdersLimit(curCode)
+			PoloniexApi::LoanOrders::Offers getLoanOrdersAndAdjustLimit(const CurrencyCode &curCode, std::future<PoloniexApi::LoanOrders> prefetched = std::future<PoloniexApi::LoanOrders>())
 			{
-				if(curGetLoanOrdersFloatingLimit_.find(curCode) == curGetLoanOrdersFloatingLimit_.end())
-					curGetLoanOrdersFloatingLimit_.insert(std::make_pair(curCode, 100));
+				LoanOrdersDepthEstimator &depth = loanOrdersDepth_[curCode];
+				FixedAmount spreadAmount = SpreadLendStrategy::amountToSpreadLendUnder(strategyParams(curCode));
+				uint16_t limit = depth.limit(spreadAmount);
 
-				auto loans = poloApi.getLoanOrders(curCode, curGetLoanOrdersFloatingLimit_[curCode]);
+				auto loans = prefetched.valid() ? prefetched.get() : poloApi.getLoanOrders(curCode, limit, false, runningCall());
+				uint32_t fetches = 1;
+				size_t responseBytes = loans.responseBytes_;
 
 				auto lastPos = calcPositionOfLastOfferToSpreadLendUnder(curCode, loans.offers_);
-
-				if(lastPos && (*lastPos) < curGetLoanOrdersFloatingLimit_[curCode] / 2)
+				depth.record(loans.offers_, lastPos);
+				while(!lastPos && loans.offers_.size() == limit && limit < LoanOrdersDepthEstimator::maxLimit_)
 				{
-					if(curGetLoanOrdersFloatingLimit_[curCode] > 50)
-						curGetLoanOrdersFloatingLimit_[curCode] -= 2;
+					limit = depth.deeperLimit(loans.offers_, limit, spreadAmount);
+
+					loans = poloApi.getLoanOrders(curCode, limit, false, runningCall());
+					++fetches;
+					responseBytes += loans.responseBytes_;
+
+					lastPos = calcPositionOfLastOfferToSpreadLendUnder(curCode, loans.offers_);
+					depth.record(loans.offers_, lastPos);
 				}
-				else
-				{
-					while(!lastPos && loans.offers_.size() == curGetLoanOrdersFloatingLimit_[curCode])
-					{
-						if(curGetLoanOrdersFloatingLimit_[curCode] >= 1500)
-							break;
+				depth.decided(fetches, responseBytes);
 
-						curGetLoanOrdersFloatingLimit_[curCode] += 20;
+				recordLoanOrderBook(curCode, loans.offers_);
+				return loans.offers_;
+			}
 
-						loans = poloApi.getLoanOrders(curCode, curGetLoanOrdersFloatingLimit_[curCode]);
+			std::mutex bookHistoryMutex_;
+			std::map<CurrencyCode, std::unique_ptr<LoanOrderBookHistoryWriter>> bookHistory_;//null after a failure
 
-						lastPos = calcPositionOfLastOfferToSpreadLendUnder(curCode, loans.offers_);
+			//Appends the book to the currency's file in loanOrderBookHistoryDirectory
+			void recordLoanOrderBook(const CurrencyCode &curCode, const LoanOrderBook &book)
+			{
+				if(startupSettings_.loanOrderBookHistoryDirectory_.empty())
+					return;
+				std::lock_guard<std::mutex> lock(bookHistoryMutex_);
+				auto iter = bookHistory_.find(curCode);
+				try
+				{
+					if(iter == bookHistory_.end())
+					{
+						iter = bookHistory_.emplace(curCode, nullptr).first;
+						filesystem::path dir(startupSettings_.loanOrderBookHistoryDirectory_);
+						if(!filesystem::exists(dir))
+							filesystem::create_directories(dir);
+						iter->second.reset(new LoanOrderBookHistoryWriter((dir / (curCode + ".books")).string()));
 					}
+					if(iter->second)
+						iter->second->append(LoanOrderBookHistory::Clock::now(), book);
 				}
+				catch(const std::exception &e)
+				{
+					WARN << "Loan order book history for " << curCode << " stopped. (" << boost::diagnostic_information(e) << ")";
+					iter->second.reset();
+				}
+			}
 
-				return loans.offers_;
+			std::string bookHistoryStats()
+			{
+				std::lock_guard<std::mutex> lock(bookHistoryMutex_);
+				std::ostringstream os;
+				for(const auto &history : bookHistory_)
+				{
+					if(history.second)
+						os << history.first << "(snapshots:" << history.second->snapshots() << " bytes:" << history.second->bytesWritten() << ") ";
+					else
+						os << history.first << "(stopped) ";
+				}
+				return os.str();
 			}
 
 		public:
 			void lendingRateStatistics()
 			{
+				//request every book up front so they are fetched concurrently
+				std::map<CurrencyCode, std::future<PoloniexApi::LoanOrders>> prefetchedLoanOrders;
+				for(auto coin : settings_.data_.coinSettings_)
+					prefetchedLoanOrders.emplace(coin.first, poloApi.getLoanOrdersAsync(coin.first, loanOrdersLimit(coin.first), false, runningCall()));
+
 				std::ostringstream msg;
 				for(auto coin : settings_.data_.coinSettings_)
 				{
@@ -689,80 +942,106 @@ namespace tylawin
 					//  delete stats // need logic elsewhere to collect stats before createOffers if lendable added after initial startup
 					//	continue;
 
-					auto loans = getLoanOrdersAndAdjustLimit(curCode);
+					auto loans = getLoanOrdersAndAdjustLimit(curCode, std::move(prefetchedLoanOrders[curCode]));
 
-					auto lowestRate = lowestOfferRateAboveDustAmount(loans, curCode);
+					auto lowestRate = SpreadLendStrategy::lowestOfferRateAboveDustAmount(strategyParams(curCode), loans);
 					if(!lowestRate)
-						lowestRate = coin.second.maxDailyRate_;
-
-					coinStats.lendingRateHist_15m.push_front(*lowestRate);
-					if(coinStats.lendingRateHist_15m.size() > 6 * 15)
-						coinStats.lendingRateHist_15m.pop_back();
-					coinStats.lendingRateLow_15m = LendingStatistics::lowestRate(coinStats.lendingRateHist_15m);
-					coinStats.lendingRateHigh_15m = LendingStatistics::highestRate(coinStats.lendingRateHist_15m);
-					coinStats.movingAvgLendingRate_15m = LendingStatistics::averageRate(coinStats.lendingRateHist_15m);
-					msg << "[" << curCode << "(low:" << to_string(coinStats.lendingRateLow_15m * 100, 4) << "% dust:" << to_string((*lowestRate) * 100, 4) << "% avg:" << to_string(coinStats.movingAvgLendingRate_15m * 100, 4) << "% high:" << to_string(coinStats.lendingRateHigh_15m * 100, 4) << "%)] ";
+						lowestRate = strategyParams(curCode).maxDailyRate_;
+
+					if(coinStats.rates_.size() == 0)
+						loadRateStatistics(curCode, coinStats);
+					auto now = RollingRateStatistics::Clock::now();
+					coinStats.rates_.add(now, *lowestRate);
+					if(coinStats.history_)
+						coinStats.history_->append(now, *lowestRate);
+
+					const RollingRateWindow &window = updateLendingRates(coinStats);
+					msg << "[" << curCode << "(low:" << to_string(coinStats.lendingRateLow_ * 100, 4) << "% dust:" << to_string(toDecimal(*lowestRate) * 100, 4) << "% avg:" << to_string(coinStats.movingAvgLendingRate_ * 100, 4) << "% high:" << to_string(coinStats.lendingRateHigh_ * 100, 4) << "%";
+					for(const auto &other : coinStats.rates_)
+					{
+						if(&other != &window)
+							msg << " " << RollingRateStatistics::lengthName(other.length()) << ":" << to_string(toDecimal(other.low()) * 100, 4) << "/" << to_string(toDecimal(other.average()) * 100, 4) << "/" << to_string(toDecimal(other.high()) * 100, 4) << "%";
+					}
+					msg << ")] ";
 				}
 				INFO << msg.str();
 			}
 
-			Rate firstLendOfferRate(PoloniexApi::LoanOrders::Offers &availableLoans, const CurrencyCode &curCode, const LendingStatistics::Coin &coinStats)
+			//Sets coinStats' windows up and replays the coin's saved samples into them. Returns how much of the last
+			//startupStatisticsInitializeInterval the saved samples span, ending at the newest: the part of the warmup
+			//that doesn't need doing again.
+			RollingRateStatistics::Clock::duration loadRateStatistics(const CurrencyCode &curCode, LendingStatistics::Coin &coinStats)
 			{
-				const auto& coinSettings = settings_.data_.coinSettings_[curCode];
-
-				boost::optional<Decimal> lowestOfferRateAboveDust = lowestOfferRateAboveDustAmount(availableLoans, curCode);
-				Rate beginningRateAboveDust = lowestOfferRateAboveDust ? *lowestOfferRateAboveDust : coinSettings.maxDailyRate_ + PoloniexApi::minimumRateIncrement_;
-
-				if(beginningRateAboveDust < coinSettings.minDailyRate_)
-					beginningRateAboveDust = coinSettings.minDailyRate_;
+				typedef RollingRateStatistics::Clock Clock;
+				std::vector<Clock::duration> windows(startupSettings_.rateStatisticsWindows_.begin(), startupSettings_.rateStatisticsWindows_.end());
+				coinStats.rates_ = RollingRateStatistics(windows);
+				if(startupSettings_.rateStatisticsDirectory_.empty())
+					return Clock::duration::zero();
 
-				if(beginningRateAboveDust < (coinStats.lendingRateLow_15m + coinStats.movingAvgLendingRate_15m) / 2)
-					beginningRateAboveDust = (coinStats.lendingRateLow_15m + coinStats.movingAvgLendingRate_15m) / 2;
+				//room for the longest window at the current sample interval
+				auto longest = *std::max_element(startupSettings_.rateStatisticsWindows_.begin(), startupSettings_.rateStatisticsWindows_.end());
+				uint32_t capacity = static_cast<uint32_t>(longest.count() / settings_.data_.updateRateStatisticsInterval_.count() + 1);
 
-				return beginningRateAboveDust;
-			}
-
-			Amount calcSpreadLendAmount(const CurrencyCode &curCode, const Amount &availableLendBalance)
-			{
-				const auto& coinSettings = settings_.data_.coinSettings_[curCode];
-
-				uint32_t tmpSpreadLendCount = coinSettings.lendOrdersToSpread_;
-
-				uint32_t activeLoanCount = static_cast<uint32_t>(activeLoans_[curCode].size());
-
-				if (activeLoanCount + tmpSpreadLendCount < std::max(activeLoanCount, tmpSpreadLendCount))
-					throw std::runtime_error("uint32_t overflow. activeLoanCount + tmpSpreadLendCount.");
-
-				if(activeLoanCount + tmpSpreadLendCount < coinSettings.minTotalLendOrdersToSpread_)
-					tmpSpreadLendCount = coinSettings.minTotalLendOrdersToSpread_;
-
-				if (activeLoanCount + tmpSpreadLendCount > coinSettings.maxTotalLendOrdersToSpread_)
+				filesystem::path dir(startupSettings_.rateStatisticsDirectory_);
+				try
 				{
-					if (activeLoanCount > coinSettings.maxTotalLendOrdersToSpread_)
-						tmpSpreadLendCount = 0u;
-					else
-						tmpSpreadLendCount = coinSettings.maxTotalLendOrdersToSpread_ - activeLoanCount;
+					if(!filesystem::exists(dir))
+						filesystem::create_directories(dir);
+					coinStats.history_.reset(new RateHistoryFile((dir / (curCode + ".bin")).string(), capacity));
+				}
+				catch(const std::exception &e)
+				{
+					WARN << "Rate history for " << curCode << " not saved. (" << boost::diagnostic_information(e) << ")";
+					return Clock::duration::zero();
 				}
 
-				if(tmpSpreadLendCount == 0u)
+				auto samples = coinStats.history_->samples();
+				Clock::time_point now = Clock::now(), oldest = now - longest, newest = oldest;
+				size_t replayed = 0;
+				for(const auto &sample : samples)
 				{
-					if(availableLendBalance < coinSettings.minLendOfferAmount_)
-						return Amount(0u);
-					else
-						return availableLendBalance;
+					if(sample.time_ < oldest || sample.time_ < newest || sample.time_ > now)
+						continue;//expired, out of order or from the future
+					coinStats.rates_.add(sample.time_, sample.rate_);
+					newest = sample.time_;
+					++replayed;
 				}
-				
-				while(availableLendBalance / tmpSpreadLendCount < coinSettings.minLendOfferAmount_)
+				if(replayed == 0)
+					return Clock::duration::zero();
+				updateLendingRates(coinStats);
+
+				Clock::duration covered = Clock::duration::zero();
+				for(const auto &sample : samples)
 				{
-					tmpSpreadLendCount -= 1u;
-					if(tmpSpreadLendCount == 0u)
+					if(sample.time_ >= now - settings_.data_.startupStatisticsInitializeInterval_ && sample.time_ <= newest)
 					{
-						WARN << "balance < " << coinSettings.minLendOfferAmount_;
-						return Amount(0u);
+						covered = newest - sample.time_;
+						break;
 					}
 				}
+				INFO << "Rate history for " << curCode << " replayed " << replayed << " samples, newest " << std::chrono::duration_cast<std::chrono::seconds>(now - newest).count() << "s old, covering " << std::chrono::duration_cast<std::chrono::seconds>(covered).count() << "s of the warmup";
+				return covered;
+			}
 
-				return availableLendBalance / tmpSpreadLendCount;
+			//From the strategy window, left alone while it is empty
+			const RollingRateWindow &updateLendingRates(LendingStatistics::Coin &coinStats)
+			{
+				const RollingRateWindow &window = *coinStats.rates_.window(startupSettings_.strategyRateStatisticsWindow_);
+				if(window.empty())
+					return window;
+				coinStats.lendingRateLow_ = toDecimal(window.low());
+				coinStats.lendingRateHigh_ = toDecimal(window.high());
+				coinStats.movingAvgLendingRate_ = toDecimal(window.sum()) / window.count();
+				return window;
+			}
+
+			SpreadLendStrategy::RecentRates recentRates(const LendingStatistics::Coin &coinStats)
+			{
+				SpreadLendStrategy::RecentRates recent = SpreadLendStrategy::RecentRates();
+				const RollingRateWindow *window = coinStats.rates_.window(startupSettings_.strategyRateStatisticsWindow_);
+				if(window && !window->empty())
+					recent = { window->low(), window->high(), window->sum().raw(), window->count() };
+				return recent;
 			}
 
 			struct OptimalOffer
@@ -771,76 +1050,33 @@ namespace tylawin
 				Rate rate_;
 			};
 			typedef std::vector<OptimalOffer> OptimalOffers;
-			auto calcOptimalSpreadLendOffers(const CurrencyCode &curCode, Amount availableLendBalance)
+			//planReused is set true when nothing the plan depends on changed since the last one for curCode
+			OptimalOffers calcOptimalSpreadLendOffers(const CurrencyCode &curCode, Amount availableLendBalance, bool *planReused = nullptr)
 			{
-				OptimalOffers optimalOffers;
+				if(planReused)
+					*planReused = false;
 
-				const auto& coinSettings = settings_.data_.coinSettings_[curCode];
+				if(availableLendBalance < settings_.data_.coinSettings_[curCode].minLendOfferAmount_)
+					return OptimalOffers();
 
-				if(availableLendBalance < coinSettings.minLendOfferAmount_)
-					return optimalOffers;
+				return planSpreadLendOffers(curCode, availableLendBalance, getLoanOrdersAndAdjustLimit(curCode), planReused);
+			}
 
-				LendingStatistics::Coin &coinStats = lendingStatistics_.coinStats_[curCode];
+			//calcOptimalSpreadLendOffers after the book has been fetched
+			OptimalOffers planSpreadLendOffers(const CurrencyCode &curCode, Amount availableLendBalance, const PoloniexApi::LoanOrders::Offers &availableLoans, bool *planReused)
+			{
+				OptimalOffers optimalOffers;
 
-				auto availableLoans = getLoanOrdersAndAdjustLimit(curCode);
+				LendingStatistics::Coin &coinStats = lendingStatistics_.coinStats_[curCode];
 
 				loanCount_[curCode] = 0;
 
-				Rate beginningRateAboveDust = firstLendOfferRate(availableLoans, curCode, coinStats);
-
-				if (beginningRateAboveDust >= coinSettings.maxDailyRate_ || availableLoans.size() == 0)
-				{
-					if (beginningRateAboveDust == coinSettings.maxDailyRate_)
-						optimalOffers.emplace_back(OptimalOffer({ availableLendBalance, coinSettings.maxDailyRate_ - PoloniexApi::minimumRateIncrement_ }));
-					else
-						optimalOffers.emplace_back(OptimalOffer({ availableLendBalance, coinSettings.maxDailyRate_ }));
-				}
-				else
-				{
-					Amount spreadLendAmount = calcSpreadLendAmount(curCode, availableLendBalance);
-
-					spreadLendAmount = Amount(to_string(spreadLendAmount, 8));//round off
-
-					uint16_t createLoanOfferCount = 0;
-					Amount offerAmountSum(0);
-					Rate previousCreatedOfferRate(0);
-					for (auto offer : availableLoans)
-					{
-						const Rate &rate = offer.first;
-						if ((rate - PoloniexApi::minimumRateIncrement_) - previousCreatedOfferRate < coinSettings.minRateSkipAmount_)
-							continue;
-
-						offerAmountSum += offer.second.amount_;
-
-						if (offerAmountSum > coinSettings.spreadDustSkipAmount_ && rate >= beginningRateAboveDust && offer.second.amount_ > coinSettings.spreadDustSkipAmount_ / 2)
-						{
-							if (availableLendBalance - spreadLendAmount < 0 || availableLendBalance - spreadLendAmount < coinSettings.minLendOfferAmount_)
-								spreadLendAmount = availableLendBalance;
-							previousCreatedOfferRate = rate - PoloniexApi::minimumRateIncrement_;
-							optimalOffers.emplace_back(OptimalOffer({ spreadLendAmount, previousCreatedOfferRate }));
-							availableLendBalance -= spreadLendAmount;
-							++createLoanOfferCount;
-							offerAmountSum = 0;
-						}
-						if (availableLendBalance == 0 || createLoanOfferCount >= coinSettings.lendOrdersToSpread_)
-							break;
-					}
+				auto inputs = SpreadLendStrategy::inputs(strategyParams(curCode), availableLoans, recentRates(coinStats), toFixed<FixedAmount>(availableLendBalance, Rounding::DOWN), static_cast<uint32_t>(activeLoans_[curCode].size()));
 
-					if (availableLendBalance > coinSettings.minLendOfferAmount_ && previousCreatedOfferRate + PoloniexApi::minimumRateIncrement_ < coinStats.lendingRateHigh_15m)
-					{
-						const Rate &lastRate = availableLoans.rbegin()->first;
-						if (lastRate < coinStats.lendingRateHigh_15m)
-						{
-							if (availableLendBalance - spreadLendAmount != 0.0 && availableLendBalance - spreadLendAmount < coinSettings.minLendOfferAmount_)
-								spreadLendAmount = availableLendBalance;
-							optimalOffers.emplace_back(OptimalOffer({ spreadLendAmount, coinStats.lendingRateHigh_15m - PoloniexApi::minimumRateIncrement_ }));
-							availableLendBalance -= spreadLendAmount;
-						}
-					}
+				const SpreadLendStrategy::Offers &offers = spreadLendPlans_.plan(curCode, strategyParams(curCode), availableLoans, inputs, planReused);
 
-					if (availableLendBalance > coinSettings.minLendOfferAmount_)
-						optimalOffers.emplace_back(OptimalOffer({ availableLendBalance, coinSettings.maxDailyRate_ }));
-				}
+				for(const auto &offer : offers)
+					optimalOffers.emplace_back(OptimalOffer({ toDecimal(offer.amount_), toDecimal(offer.rate_) }));
 
 				return optimalOffers;
 			}
@@ -852,110 +1088,177 @@ namespace tylawin
 					createLoanOffer(curCode, offer.amount_, offer.rate_);
 			}
 
+			struct RefreshFetched
+			{
+				Amount availableBalance_;
+				bool stopLending_ = false;
+				bool booked_ = false;//book_ was fetched; false when the balance is too small to lend
+				PoloniexApi::LoanOrders::Offers book_;
+			};
+			struct RefreshPlan
+			{
+				bool stopLending_ = false;
+				bool planReused_ = false;
+				OptimalOffers offers_;
+			};
+
+			//Each currency goes through StagedPipeline: book fetch, then plan, then handing the differences from the open
+			//offers to offerChanges_ and running the currency's share of this tick's request budget on them, so one
+			//currency's offers are submitted while the next one's plan is computed and the one after that is fetched.
+			//Whatever budget is left then goes to the most valuable changes still pending in any currency.
+			//Stage ownership while the pipeline runs:
+			//  fetch:   loanOrdersDepth_
+			//  compute: spreadLendPlans_, loanCount_
+			//  execute: offerChanges_, reconcileSkips_
+			//Everything else is only read, and every per currency map entry the stages use is created beforehand.
 			void refreshLoans()
 			{
-				uint8_t loopResetCounter = 0;
-				bool needRefreshLoans = true;
-				while (needRefreshLoans)
 				{
-					if (loopResetCounter > 3)
-						break;
-					loopResetCounter++;
-					needRefreshLoans = false;
-					auto lendingBalances = poloApi.getAvailableAccountBalances(PoloniexApi::AccountTypes::LENDING)[PoloniexApi::AccountTypes::LENDING];
+					auto lendingBalances = poloApi.getAvailableAccountBalances(PoloniexApi::AccountTypes::LENDING, runningCall())[PoloniexApi::AccountTypes::LENDING];
 
 					std::unordered_set<CurrencyCode> currenciesToRefreshLoansOf;
 					for (auto avail : lendingBalances)
 						currenciesToRefreshLoansOf.insert(avail.first);
-					auto loanOffers = poloApi.getOpenLoanOffers();
+					auto loanOffers = poloApi.getOpenLoanOffers(runningCall());
 					for (auto loansByCurrency : loanOffers)
 						currenciesToRefreshLoansOf.insert(loansByCurrency.first);
 
-					Amount availableBalance;
-					for (auto curCode : currenciesToRefreshLoansOf)
+					std::vector<CurrencyCode> currencies(currenciesToRefreshLoansOf.begin(), currenciesToRefreshLoansOf.end());
+					size_t budget = offerChangeBudget(), used = 0, handled = 0;
+					std::unordered_map<CurrencyCode, Amount> availableBalances;
+					for (const auto &curCode : currencies)
 					{
-						try
-						{
-							if (settings_.data_.coinSettings_[curCode].stopLending_)
-							{
-								cancelAllOpenLoanOffers(curCode);
-								continue;
-							}
-
-							availableBalance = 0;
-							if(lendingBalances.find(curCode) != lendingBalances.end())
-								availableBalance += lendingBalances.at(curCode);
-							if(loanOffers.find(curCode) != loanOffers.end())
-								for (auto loanOffer : loanOffers.at(curCode))
-									availableBalance += loanOffer.amount_;
+						settings_.data_.coinSettings_[curCode];
+						strategyParams(curCode);
+						lendingStatistics_.coinStats_[curCode];
+						loanCount_[curCode];
+						activeLoans_[curCode];
+
+						Amount &availableBalance = availableBalances[curCode];
+						availableBalance = 0;
+						if(lendingBalances.find(curCode) != lendingBalances.end())
+							availableBalance += lendingBalances.at(curCode);
+						if(loanOffers.find(curCode) != loanOffers.end())
+							for (auto loanOffer : loanOffers.at(curCode))
+								availableBalance += loanOffer.amount_;
+					}
 
-							auto optimalSpreadOffers = calcOptimalSpreadLendOffers(curCode, availableBalance);
+					StagedPipeline<CurrencyCode, RefreshFetched, RefreshPlan>::Stages stages;
+					stages.fetch_ = [&](const CurrencyCode &curCode) {
+						RefreshFetched fetched;
+						fetched.stopLending_ = settings_.data_.coinSettings_.at(curCode).stopLending_;
+						fetched.availableBalance_ = availableBalances.at(curCode);
+						if (!fetched.stopLending_ && !(fetched.availableBalance_ < settings_.data_.coinSettings_.at(curCode).minLendOfferAmount_))
+						{
+							fetched.book_ = getLoanOrdersAndAdjustLimit(curCode);
+							fetched.booked_ = true;
+						}
+						return fetched;
+					};
+					stages.compute_ = [&](const CurrencyCode &curCode, RefreshFetched &fetched) {
+						RefreshPlan plan;
+						plan.stopLending_ = fetched.stopLending_;
+						if (fetched.booked_)
+							plan.offers_ = planSpreadLendOffers(curCode, fetched.availableBalance_, fetched.book_, &plan.planReused_);
+						return plan;
+					};
+					stages.execute_ = [&](const CurrencyCode &curCode, RefreshPlan &plan) {
+						++handled;
+						if (plan.stopLending_)
+						{
+							offerChanges_.clear(curCode);
+							cancelAllOpenLoanOffers(curCode);
+							return;
+						}
 
-							//cancel offers that are not optimal
-							bool cancelLoanOfferFailed = false;
-							if (loanOffers.find(curCode) != loanOffers.end())
-								for (auto existingOfferIter = loanOffers.at(curCode).begin(); existingOfferIter != loanOffers.at(curCode).end(); )
-								{
-									auto &existingOffer = *existingOfferIter;
-									auto iter = std::find_if(optimalSpreadOffers.begin(), optimalSpreadOffers.end(), [&](const auto &optimalOffer) { 
-										return (existingOffer.amount_ == optimalOffer.amount_ && existingOffer.rate_ == optimalOffer.rate_);
-									});
-									if (iter != optimalSpreadOffers.end())
-									{
-										optimalSpreadOffers.erase(iter);
-										++existingOfferIter;
-									}
-									else //if (!isOptimal)
-									{
-										auto rsp = poloApi.cancelLoanOffer(existingOffer.id_);
-										INFO << " Canceling " << curCode << " order of " << existingOffer.amount_ << " at " << to_string(existingOffer.rate_ * 100, 4) << "%... " << (rsp.success_ ? "Canceled - msg: " : "Failed - error: ") << rsp.msg_;
-										if (rsp.success_)
-										{
-											existingOfferIter = loanOffers.at(curCode).erase(existingOfferIter);
-										}
-										else
-										{
-											cancelLoanOfferFailed = true;
-											++existingOfferIter;
-										}
-									}
-								}
+						static const PoloniexApi::LoanOffers::mapped_type noOpenOffers;
+						auto openIter = loanOffers.find(curCode);
+						const auto &openOffers = openIter != loanOffers.end() ? openIter->second : noOpenOffers;
+						Amount freeBalance = lendingBalances.find(curCode) != lendingBalances.end() ? lendingBalances.at(curCode) : Amount(0);
 
-							if (cancelLoanOfferFailed)
-							{
-								needRefreshLoans = true;//reset loop to recalculate available balance and optimal offers
-								continue;
-							}
+						std::vector<OfferChurnPlanner::Offer> planned;
+						for (const auto &offer : plan.offers_)
+							planned.push_back({ offer.amount_, offer.rate_ });
 
-							//create offers that are optimal
-							for (auto newOffer : optimalSpreadOffers)
-							{
-								bool existsAlready = false;
-								if (loanOffers.find(curCode) != loanOffers.end())
-									for (auto existingOffer : loanOffers.at(curCode))
-									{
-										if (newOffer.amount_ == existingOffer.amount_ && newOffer.rate_ == existingOffer.rate_)
-											existsAlready = true;
-									}
-
-								if (!existsAlready)
-									createLoanOffer(curCode, newOffer.amount_, newOffer.rate_);
-							}
+						//already on the books: nothing to cancel or create
+						if (offerChanges_.reconcile(curCode, freeBalance, openOffers, planned) == 0)
+						{
+							if (plan.planReused_)
+								++reconcileSkips_;
+							return;
+						}
+						used += executeOfferChanges(budget * handled / currencies.size() - used, &curCode);
+					};
+					stages.failed_ = [&](const CurrencyCode &curCode, std::exception_ptr error) {
+						++handled;
+						try
+						{
+							std::rethrow_exception(error);
 						}
 						catch(const std::exception &e)
 						{
+							if(isQuitAbort(e))
+								throw;
 							ERROR << "Refresh loans failed for " << curCode << ". exception: " << e.what();
 						}
 						catch(...)
 						{
 							ERROR << "Refresh loans failed for " << curCode;
 						}
-					}
+					};
+					StagedPipeline<CurrencyCode, RefreshFetched, RefreshPlan>::run(currencies, stages);
+					offerChanges_.retain(currenciesToRefreshLoansOf);
+					used += executeOfferChanges(budget - used);
+					endOfferChangeTick(budget, used);
 				}
 
 				refreshActiveLoansAndTotalLent();
 			}
 
+			//Trading api requests in offerChangeBudget seconds of the learned request rate
+			size_t offerChangeBudget()
+			{
+				double requestsPerSecond = poloApi.rateLimiterState().requestsPerSecond_[static_cast<int>(RequestRateLimiter::Endpoint::PRIVATE)];
+				return std::max<size_t>(1, static_cast<size_t>(requestsPerSecond * settings_.data_.offerChangeBudget_.count()));
+			}
+
+			void endOfferChangeTick(size_t budget, size_t used)
+			{
+				if(used == 0 && offerChanges_.pending() == 0)
+					return;
+				offerChanges_.endTick(budget);
+				INFO << "Offer changes requests used/budget:" << used << "/" << budget << " deferred:" << offerChanges_.pending();
+			}
+
+			//Cancels and creates the most valuable pending offer changes, of only curCode when given, up to budget
+			//requests. Returns the requests used.
+			size_t executeOfferChanges(size_t budget, const CurrencyCode *only = nullptr)
+			{
+				if(budget == 0 || offerChanges_.pending() == 0)
+					return 0;
+
+				return offerChanges_.execute(budget, [this](const OfferChurnPlanner::Change &change) {
+					try
+					{
+						if(change.kind_ == OfferChurnPlanner::Kind::CANCEL)
+						{
+							auto rsp = poloApi.cancelLoanOffer(change.offerId_, runningCall());
+							INFO << " Canceling " << change.currency_ << " order of " << change.amount_ << " at " << to_string(change.rate_ * 100, 4) << "%... " << (rsp.success_ ? "Canceled - msg: " : "Failed - error: ") << rsp.msg_;
+							return rsp.success_;
+						}
+						createLoanOffer(change.currency_, change.amount_, change.rate_);
+						return true;
+					}
+					catch(const std::exception &e)
+					{
+						if(isQuitAbort(e))
+							throw;
+						ERROR << "Offer change failed for " << change.currency_ << ". exception: " << e.what();
+						return false;
+					}
+				}, only);
+			}
+
 			void setAllAutoRenew(bool autoRenew)
 			{
 				if(dryRun_ == true)
@@ -1003,24 +1306,45 @@ namespace tylawin
 
 			int run()
 			{
-				//turn off autoRenew on loans since we are running now
-				setAllAutoRenew(false);
+				try
+				{
+					//turn off autoRenew on loans since we are running now
+					setAllAutoRenew(false);
 
-				//cancel suboptimal open offers
-				cancelAllOpenLoanOffers();
+					//cancel suboptimal open offers
+					cancelAllOpenLoanOffers();
 
-				refreshActiveLoansAndTotalLent();
+					refreshActiveLoansAndTotalLent();
+				}
+				catch(const std::exception &e)
+				{
+					if(!isQuitAbort(e))
+						throw;
+					return quit();
+				}
 				INFO << getStatusStringLentAmountAndRates();
 				INFO << getStatusStringTotalLentAndLendAccountAmountsAndRates();
+				INFO << "Api " << poloApi.connectionStats().toString();
+
+				//saved rate history counts toward the warmup, only the gap since it was written needs sampling again
+				std::chrono::seconds warmedUp = settings_.data_.startupStatisticsInitializeInterval_;
+				for(auto coin : settings_.data_.coinSettings_)
+				{
+					auto covered = std::chrono::duration_cast<std::chrono::seconds>(loadRateStatistics(coin.first, lendingStatistics_.coinStats_[coin.first]));
+					warmedUp = std::min(warmedUp, covered);
+				}
+				if(warmedUp == settings_.data_.startupStatisticsInitializeInterval_)
+					INFO << "Rate history covers the warmup, lending right away";
 
 				boost::posix_time::ptime nowTime;
-				boost::posix_time::ptime startTime = boost::posix_time::second_clock::universal_time();
-				while(true)//establish moving average before setting our lending rate
+				boost::posix_time::ptime startTime = boost::posix_time::second_clock::universal_time() - boost::posix_time::seconds(static_cast<long>(warmedUp.count()));
+				while(warmedUp < settings_.data_.startupStatisticsInitializeInterval_)//establish moving average before setting our lending rate
 				{
 					try
 					{
 						lendingRateStatistics();
-						std::this_thread::sleep_for(settings_.data_.updateRateStatisticsInterval_);
+						if(sleepUnlessQuit(settings_.data_.updateRateStatisticsInterval_))
+							return quit();
 						nowTime = boost::posix_time::second_clock::universal_time();
 						if(dryRun_)
 						{
@@ -1032,29 +1356,40 @@ namespace tylawin
 					}
 					catch(const std::exception &e)
 					{
-						ERROR << boost::diagnostic_information(e);
-						std::this_thread::sleep_for(std::chrono::seconds(10));
-						continue;
+						if(!isQuitAbort(e))
+						{
+							ERROR << boost::diagnostic_information(e);
+							sleepUnlessQuit(std::chrono::seconds(10));
+						}
 					}
 
-					if(doQuit_())
-					{
-						setAllAutoRenew(true);
-						INFO << "^c - quit";
-						return 0;
-					}
+					if(quit_.cancelled())
+						return quit();
 				}
 
-				refreshActiveLoansAndTotalLent();
+				try
+				{
+					refreshActiveLoansAndTotalLent();
+				}
+				catch(const std::exception &e)
+				{
+					if(!isQuitAbort(e))
+						throw;
+					return quit();
+				}
 				startTime = boost::posix_time::second_clock::universal_time() - boost::posix_time::seconds(static_cast<long>(settings_.data_.refreshLoansInterval_.count()));
 				while(true)
 				{
 					try
 					{
 						nowTime = boost::posix_time::second_clock::universal_time();
+						if(tickObserver_.begin_)
+							tickObserver_.begin_();
+						bool refreshed = false;
 						lendingRateStatistics();
 						if(nowTime - startTime >= boost::posix_time::seconds(static_cast<long>(settings_.data_.refreshLoansInterval_.count())))
 						{
+							refreshed = true;
 							try
 							{
 								settings_.update();
@@ -1063,6 +1398,8 @@ namespace tylawin
 							{
 								WARN << "Reading settings file failed. (" << boost::diagnostic_information(e) << ") Continuing with old settings.";
 							}
+							strategyParams_.clear();
+							poloApi.loanOrdersCacheTtl(settings_.data_.loanOrdersCacheTtl_);
 
 							startTime = nowTime;
 
@@ -1070,25 +1407,57 @@ namespace tylawin
 
 							INFO << getStatusStringLentAmountAndRates();
 							INFO << getStatusStringTotalLentAndLendAccountAmountsAndRates();
+							INFO << "Api " << poloApi.connectionStats().toString();
+							INFO << "Api calls " << poloApi.callStats().toString();
+							if(poloApi.flightRecorderDropped() != 0)
+								INFO << "Flight recorder dropped:" << poloApi.flightRecorderDropped();
+							INFO << "Rate limits " << poloApi.rateLimiterState().toString();
+							auto cacheStats = poloApi.loanOrdersCacheStats();
+							INFO << "Loan order book cache hits:" << cacheStats.hits_ << " misses:" << cacheStats.misses_;
+							for(const auto &depth : loanOrdersDepth_)
+								INFO << "Loan order depth " << depth.first << "(" << depth.second.stats().toString() << ")";
+							INFO << "Spread lend plans computed:" << spreadLendPlans_.stats().computed_ << " reused:" << spreadLendPlans_.stats().reused_ << " reconcile skipped:" << reconcileSkips_;
+							INFO << "Offer changes " << offerChanges_.stats().toString();
+							if(!startupSettings_.loanOrderBookHistoryDirectory_.empty())
+								INFO << "Loan order book history " << bookHistoryStats();
+							auto feedStats = poloApi.loanOrderBookFeedStats();
+							if(!feedStats.empty())
+								INFO << "Loan order book feed " << feedStats;
 						}
-						std::this_thread::sleep_for(settings_.data_.updateRateStatisticsInterval_);
+						else
+						{
+							//changes a previous refresh's budget didn't cover
+							size_t budget = offerChangeBudget();
+							endOfferChangeTick(budget, executeOfferChanges(budget));
+						}
+						if(tickObserver_.end_)
+							tickObserver_.end_(refreshed);
+						sleepUnlessQuit(settings_.data_.updateRateStatisticsInterval_);
 					}
 					catch(const std::exception &e)
 					{
-						ERROR << boost::diagnostic_information(e);
-						std::this_thread::sleep_for(std::chrono::seconds(10));
-						continue;
+						if(!isQuitAbort(e))
+						{
+							ERROR << boost::diagnostic_information(e);
+							sleepUnlessQuit(std::chrono::seconds(10));
+						}
 					}
 
-					if(doQuit_())
-					{
-						setAllAutoRenew(true);
-						return 0;
-					}
+					if(quit_.cancelled())
+						return quit();
 				}
 
 				return 1;
 			}
+
+		private:
+			//Api calls still in progress have already been abandoned; these run to their own deadline.
+			int quit()
+			{
+				setAllAutoRenew(true);
+				INFO << "^c - quit";
+				return 0;
+			}
 		};
 	}
 }
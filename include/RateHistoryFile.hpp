@@ -0,0 +1,193 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "LoanOrderBook.hpp"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//One coin's last capacity rate samples in a fixed size memory mapped file, oldest overwritten first, so rate
+		//statistics can be replayed after a restart instead of sampled all over again. A sample is a store into the
+		//mapping; the OS writes it back, so it survives the process crashing or being killed.
+		class RateHistoryFile
+		{
+		public:
+			typedef std::chrono::system_clock Clock;
+
+			struct FileHeader
+			{
+				char magic_[8];
+				uint32_t version_;
+				uint32_t capacity_;
+				uint64_t nextSequence_;
+			};
+
+			//sequence_ is written last; 0 marks a slot that is empty or mid write
+			struct Slot
+			{
+				uint64_t sequence_;
+				int64_t unixTimeUs_;
+				FixedRate::Raw rate_;
+			};
+
+			struct Sample
+			{
+				Clock::time_point time_;
+				FixedRate rate_;
+			};
+
+			static const char *magic() { return "PLBRATE"; }
+			static const uint32_t version_ = 1;
+
+			//Reuses an existing file. One with a different capacity is rewritten keeping its newest samples.
+			RateHistoryFile(const std::string &file, uint32_t capacity)
+			{
+				if(capacity == 0)
+					throw std::invalid_argument("RateHistoryFile needs capacity > 0");
+
+				uint32_t existingCapacity = 0;
+				std::vector<Sample> carried;
+				{
+					std::ifstream existing(file, std::ios::binary);
+					if(existing.is_open())
+					{
+						std::vector<char> bytes((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+						if(valid(bytes.data(), bytes.size()))
+						{
+							existingCapacity = reinterpret_cast<const FileHeader *>(bytes.data())->capacity_;
+							if(existingCapacity != capacity)
+								carried = read(bytes.data());
+						}
+					}
+				}
+				if(existingCapacity != capacity)
+				{
+					std::ofstream create(file, std::ios::binary | std::ios::trunc);
+					if(!create.is_open())
+						throw std::runtime_error("Unable to create rate history file(" + file + ")");
+					FileHeader header = FileHeader();
+					memcpy(header.magic_, magic(), sizeof(header.magic_));
+					header.version_ = version_;
+					header.capacity_ = capacity;
+					header.nextSequence_ = 1;
+					create.write(reinterpret_cast<const char *>(&header), sizeof(header));
+					std::vector<char> zeros(sizeof(Slot) * capacity, 0);
+					create.write(zeros.data(), zeros.size());
+					if(!create)
+						throw std::runtime_error("Unable to size rate history file(" + file + ")");
+				}
+
+				mapping_ = boost::interprocess::file_mapping(file.c_str(), boost::interprocess::read_write);
+				region_ = boost::interprocess::mapped_region(mapping_, boost::interprocess::read_write);
+				header_ = static_cast<FileHeader *>(region_.get_address());
+				slots_ = reinterpret_cast<Slot *>(static_cast<char *>(region_.get_address()) + sizeof(FileHeader));
+
+				//a crash can leave the header behind the slots
+				for(uint32_t i = 0; i < header_->capacity_; ++i)
+					header_->nextSequence_ = std::max(header_->nextSequence_, slots_[i].sequence_ + 1);
+
+				size_t skip = carried.size() > capacity ? carried.size() - capacity : 0;
+				for(size_t i = skip; i < carried.size(); ++i)
+					append(carried[i].time_, carried[i].rate_);
+			}
+
+			~RateHistoryFile()
+			{
+				region_.flush();
+			}
+
+		private://noncopyable
+			RateHistoryFile(const RateHistoryFile &) = delete;
+			RateHistoryFile& operator=(const RateHistoryFile &) = delete;
+
+		public:
+			void append(Clock::time_point time, const FixedRate &rate)
+			{
+				uint64_t sequence = header_->nextSequence_++;
+				Slot &slot = slots_[sequence % header_->capacity_];
+
+				slot.sequence_ = 0;
+				std::atomic_thread_fence(std::memory_order_release);
+				slot.unixTimeUs_ = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+				slot.rate_ = rate.raw();
+				std::atomic_thread_fence(std::memory_order_release);
+				slot.sequence_ = sequence;
+			}
+
+			//Oldest first
+			std::vector<Sample> samples() const
+			{
+				return read(static_cast<const char *>(region_.get_address()));
+			}
+
+			uint32_t capacity() const { return header_->capacity_; }
+
+		private:
+			boost::interprocess::file_mapping mapping_;
+			boost::interprocess::mapped_region region_;
+			FileHeader *header_;
+			Slot *slots_;
+
+			static bool valid(const char *bytes, size_t size)
+			{
+				if(size < sizeof(FileHeader))
+					return false;
+				auto header = reinterpret_cast<const FileHeader *>(bytes);
+				return memcmp(header->magic_, magic(), sizeof(header->magic_)) == 0 && header->version_ == version_ && header->capacity_ != 0
+					&& size == sizeof(FileHeader) + static_cast<uint64_t>(header->capacity_) * sizeof(Slot);
+			}
+
+			//bytes must be valid()
+			static std::vector<Sample> read(const char *bytes)
+			{
+				auto header = reinterpret_cast<const FileHeader *>(bytes);
+				auto slots = reinterpret_cast<const Slot *>(bytes + sizeof(FileHeader));
+				std::vector<const Slot *> used;
+				for(uint32_t i = 0; i < header->capacity_; ++i)
+				{
+					if(slots[i].sequence_ != 0)
+						used.push_back(&slots[i]);
+				}
+				std::sort(used.begin(), used.end(), [](const Slot *a, const Slot *b) { return a->sequence_ < b->sequence_; });
+
+				std::vector<Sample> samples;
+				samples.reserve(used.size());
+				for(auto slot : used)
+				{
+					Sample sample = { Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::microseconds(slot->unixTimeUs_))), FixedRate::fromRaw(slot->rate_) };
+					samples.push_back(sample);
+				}
+				return samples;
+			}
+		};
+	}
+}
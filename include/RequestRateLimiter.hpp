@@ -0,0 +1,245 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#ifdef _WIN32
+#include <filesystem>
+namespace filesystem = std::experimental::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace filesystem = boost::filesystem;
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Spaces requests out with separately learned rates for public and private (trading api) endpoints under
+		//a shared cap. Additive increase on each success, multiplicative decrease plus a short cooldown on 429.
+		//Learned rates are written to file so a restart doesn't start over from the top and hit 429 again.
+		class RequestRateLimiter
+		{
+		public:
+			enum class Endpoint
+			{
+				PUBLIC = 0,
+				PRIVATE = 1
+			};
+
+			struct Settings
+			{
+				double maxRequestsPerSecond_;//shared cap over both endpoints
+				double minRequestsPerSecond_;
+				double increasePerSuccess_;
+				double decreaseFactor_;
+				std::chrono::milliseconds cooldown_;
+				uint32_t successesPerPersist_;
+
+				Settings() :
+					maxRequestsPerSecond_(6),
+					minRequestsPerSecond_(0.2),
+					increasePerSuccess_(0.05),
+					decreaseFactor_(0.5),
+					cooldown_(2000),
+					successesPerPersist_(100)
+				{}
+			};
+
+			struct State
+			{
+				double requestsPerSecond_[2];
+				uint64_t rateLimitedCount_[2];
+				std::chrono::milliseconds cooldownRemaining_[2];
+
+				std::string toString() const
+				{
+					std::ostringstream os;
+					os.precision(2);
+					os << std::fixed;
+					const char *names[2] = { "public", "private" };
+					for(int i = 0; i < 2; ++i)
+					{
+						os << (i ? " " : "") << names[i] << "(" << requestsPerSecond_[i] << "/s 429s:" << rateLimitedCount_[i];
+						if(cooldownRemaining_[i].count() > 0)
+							os << " cooldown:" << cooldownRemaining_[i].count() << "ms";
+						os << ")";
+					}
+					return os.str();
+				}
+			};
+
+			explicit RequestRateLimiter(const filesystem::path &file, const Settings &settings = Settings()) :
+				file_(file),
+				settings_(settings),
+				lastRequestTime_(std::chrono::steady_clock::now() - std::chrono::seconds(1)),
+				successesSincePersist_(0)
+			{
+				if(settings_.minRequestsPerSecond_ <= 0 || settings_.minRequestsPerSecond_ > settings_.maxRequestsPerSecond_)
+					throw std::invalid_argument("RequestRateLimiter minRequestsPerSecond must be in (0, maxRequestsPerSecond]");
+
+				for(auto &budget : budgets_)
+				{
+					budget.requestsPerSecond_ = settings_.maxRequestsPerSecond_;
+					budget.lastRequestTime_ = lastRequestTime_;
+					budget.cooldownUntil_ = lastRequestTime_;
+					budget.rateLimitedCount_ = 0;
+				}
+
+				if(filesystem::exists(file_))
+				{
+					std::ifstream f(file_.string());
+					std::string name;
+					double rate;
+					while(f >> name >> rate)
+					{
+						if(name == "public")
+							budgets_[0].requestsPerSecond_ = clamp(rate);
+						else if(name == "private")
+							budgets_[1].requestsPerSecond_ = clamp(rate);
+					}
+				}
+			}
+
+			~RequestRateLimiter()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				persist();
+			}
+
+		private://noncopyable
+			RequestRateLimiter(const RequestRateLimiter &) = delete;
+			RequestRateLimiter& operator=(const RequestRateLimiter &) = delete;
+
+		public:
+			//Reserves the next send slot for endpoint and waits for it.
+			void acquire(Endpoint endpoint)
+			{
+				std::chrono::steady_clock::time_point slot;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					Budget &budget = budgets_[static_cast<int>(endpoint)];
+					auto now = std::chrono::steady_clock::now();
+					slot = std::max({ now, lastRequestTime_ + interval(settings_.maxRequestsPerSecond_), budget.lastRequestTime_ + interval(budget.requestsPerSecond_), budget.cooldownUntil_ });
+					lastRequestTime_ = slot;
+					budget.lastRequestTime_ = slot;
+				}
+				std::this_thread::sleep_until(slot);
+			}
+
+			//Earliest time acquire(endpoint) could send without waiting. Reserves nothing.
+			std::chrono::steady_clock::time_point readyAt(Endpoint endpoint)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				const Budget &budget = budgets_[static_cast<int>(endpoint)];
+				return std::max({ lastRequestTime_ + interval(settings_.maxRequestsPerSecond_), budget.lastRequestTime_ + interval(budget.requestsPerSecond_), budget.cooldownUntil_ });
+			}
+
+			void onSuccess(Endpoint endpoint)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				Budget &budget = budgets_[static_cast<int>(endpoint)];
+				budget.requestsPerSecond_ = clamp(budget.requestsPerSecond_ + settings_.increasePerSuccess_);
+				if(++successesSincePersist_ >= settings_.successesPerPersist_)
+					persist();
+			}
+
+			//429 Too Many Requests
+			void onRateLimited(Endpoint endpoint)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				Budget &budget = budgets_[static_cast<int>(endpoint)];
+				budget.requestsPerSecond_ = clamp(budget.requestsPerSecond_ * settings_.decreaseFactor_);
+				budget.cooldownUntil_ = std::chrono::steady_clock::now() + settings_.cooldown_;
+				++budget.rateLimitedCount_;
+				persist();
+			}
+
+			State state()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				State state;
+				auto now = std::chrono::steady_clock::now();
+				for(int i = 0; i < 2; ++i)
+				{
+					state.requestsPerSecond_[i] = budgets_[i].requestsPerSecond_;
+					state.rateLimitedCount_[i] = budgets_[i].rateLimitedCount_;
+					state.cooldownRemaining_[i] = budgets_[i].cooldownUntil_ > now ? std::chrono::duration_cast<std::chrono::milliseconds>(budgets_[i].cooldownUntil_ - now) : std::chrono::milliseconds(0);
+				}
+				return state;
+			}
+
+		private:
+			struct Budget
+			{
+				double requestsPerSecond_;
+				std::chrono::steady_clock::time_point lastRequestTime_;
+				std::chrono::steady_clock::time_point cooldownUntil_;
+				uint64_t rateLimitedCount_;
+			};
+
+			filesystem::path file_;
+			Settings settings_;
+			std::mutex mutex_;
+			std::chrono::steady_clock::time_point lastRequestTime_;
+			Budget budgets_[2];
+			uint32_t successesSincePersist_;
+
+			static std::chrono::steady_clock::duration interval(double requestsPerSecond)
+			{
+				return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / requestsPerSecond));
+			}
+
+			double clamp(double requestsPerSecond) const
+			{
+				return std::min(settings_.maxRequestsPerSecond_, std::max(settings_.minRequestsPerSecond_, requestsPerSecond));
+			}
+
+			//Write then rename, same as the nonce file. Learned rates are only a starting hint for the next run
+			//so a failed write is ignored rather than failing the request that triggered it.
+			void persist()
+			{
+				successesSincePersist_ = 0;
+				filesystem::path tmpFile(file_.string() + ".tmp");
+				std::ofstream f(tmpFile.string(), std::ofstream::trunc);
+				if(f.is_open() == false)
+					return;
+				f << "public " << budgets_[0].requestsPerSecond_ << "\n";
+				f << "private " << budgets_[1].requestsPerSecond_ << "\n";
+				f.close();
+				if(f.fail())
+					return;
+				try
+				{
+					filesystem::rename(tmpFile, file_);
+				}
+				catch(const std::exception &)
+				{
+				}
+			}
+		};
+	}
+}
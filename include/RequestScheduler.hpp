@@ -0,0 +1,145 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Runs api requests on a small pool of worker threads so several can be in flight at once.
+		//Queued requests start highest priority first, then in submission order. Jobs can be held back until a
+		//given time (retry backoff) without occupying a worker while they wait.
+		class RequestScheduler
+		{
+		public:
+			enum class Priority
+			{
+				TRADING = 0,    //create/cancel offers, toggle autoRenew
+				ACCOUNT = 1,    //balances, open offers, active loans
+				MARKET_DATA = 2 //public order books used for statistics
+			};
+
+			explicit RequestScheduler(size_t maxInFlight) :
+				stop_(false),
+				nextSequence_(0)
+			{
+				if(maxInFlight == 0)
+					throw std::invalid_argument("RequestScheduler maxInFlight must be > 0");
+
+				for(size_t i = 0; i < maxInFlight; ++i)
+					workers_.emplace_back([this]() { workerLoop(); });
+			}
+
+			~RequestScheduler()
+			{
+				shutdown();
+			}
+
+		private://noncopyable
+			RequestScheduler(const RequestScheduler &) = delete;
+			RequestScheduler& operator=(const RequestScheduler &) = delete;
+
+		public:
+			typedef std::chrono::steady_clock::time_point TimePoint;
+
+			//job must not throw
+			void post(Priority priority, std::function<void()> job, TimePoint notBefore = TimePoint())
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if(stop_)
+						throw std::runtime_error("RequestScheduler is shut down");
+					QueueKey key = std::make_pair(priority, nextSequence_++);
+					if(notBefore > std::chrono::steady_clock::now())
+						delayed_.emplace(notBefore, std::make_pair(key, std::move(job)));
+					else
+						queue_.emplace(key, std::move(job));
+				}
+				cv_.notify_one();
+			}
+
+			//Finishes already queued requests, delayed ones without waiting for their time, then joins the workers.
+			void shutdown()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if(stop_ && workers_.empty())
+						return;
+					stop_ = true;
+				}
+				cv_.notify_all();
+				for(auto &worker : workers_)
+					if(worker.joinable())
+						worker.join();
+				workers_.clear();
+			}
+
+		private:
+			typedef std::pair<Priority, uint64_t> QueueKey;
+
+			std::mutex mutex_;
+			std::condition_variable cv_;
+			std::map<QueueKey, std::function<void()>> queue_;
+			std::multimap<TimePoint, std::pair<QueueKey, std::function<void()>>> delayed_;
+			std::vector<std::thread> workers_;
+			bool stop_;
+			uint64_t nextSequence_;
+
+			void workerLoop()
+			{
+				while(true)
+				{
+					std::function<void()> job;
+					{
+						std::unique_lock<std::mutex> lock(mutex_);
+						while(true)
+						{
+							auto now = std::chrono::steady_clock::now();
+							while(!delayed_.empty() && (stop_ || delayed_.begin()->first <= now))
+							{
+								queue_.emplace(std::move(delayed_.begin()->second));
+								delayed_.erase(delayed_.begin());
+							}
+							if(!queue_.empty() || stop_)
+								break;
+							if(delayed_.empty())
+								cv_.wait(lock);
+							else
+								cv_.wait_until(lock, delayed_.begin()->first);
+						}
+						if(queue_.empty())
+							return;//stopping and drained
+						job = std::move(queue_.begin()->second);
+						queue_.erase(queue_.begin());
+					}
+					job();
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,159 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "LoanOrderBook.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Low, high and mean of the rate samples from the last length_ of time. Amortized O(1) per sample no matter
+		//how long the window is: the mean is a running sum, low and high are monotonic deques (a sample is dropped
+		//from the low deque as soon as a lower one arrives after it, since it can never be the low again).
+		class RollingRateWindow
+		{
+		public:
+			typedef std::chrono::system_clock Clock;
+
+			explicit RollingRateWindow(Clock::duration length) :
+				length_(length)
+			{
+				if(length <= Clock::duration::zero())
+					throw std::invalid_argument("RollingRateWindow length must be > 0");
+			}
+
+			//Samples must come in time order. Samples older than length_ before time drop out.
+			void add(Clock::time_point time, const FixedRate &rate)
+			{
+				Sample sample = { nextSequence_++, time, rate.raw() };
+				samples_.push_back(sample);
+				sum_ += sample.rate_;
+
+				while(!lows_.empty() && lows_.back().rate_ >= sample.rate_)
+					lows_.pop_back();
+				lows_.push_back(sample);
+				while(!highs_.empty() && highs_.back().rate_ <= sample.rate_)
+					highs_.pop_back();
+				highs_.push_back(sample);
+
+				expire(time);
+			}
+
+			bool empty() const { return samples_.empty(); }
+			size_t count() const { return samples_.size(); }
+			Clock::duration length() const { return length_; }
+
+			//Empty window: all zero
+			FixedRate low() const { return FixedRate::fromRaw(lows_.empty() ? 0 : lows_.front().rate_); }
+			FixedRate high() const { return FixedRate::fromRaw(highs_.empty() ? 0 : highs_.front().rate_); }
+			FixedRate sum() const { return FixedRate::fromRaw(sum_); }
+			FixedRate average(Rounding rounding = Rounding::HALF_EVEN) const
+			{
+				if(samples_.empty())
+					return FixedRate();
+				return sum().divide(static_cast<int64_t>(samples_.size()), rounding);
+			}
+
+		private:
+			struct Sample
+			{
+				uint64_t sequence_;
+				Clock::time_point time_;
+				FixedRate::Raw rate_;
+			};
+
+			Clock::duration length_;
+			std::deque<Sample> samples_;
+			std::deque<Sample> lows_;//rates increasing front to back
+			std::deque<Sample> highs_;//rates decreasing front to back
+			FixedRate::Raw sum_ = 0;
+			uint64_t nextSequence_ = 0;
+
+			void expire(Clock::time_point now)
+			{
+				while(!samples_.empty() && now - samples_.front().time_ >= length_)
+				{
+					const Sample &oldest = samples_.front();
+					sum_ -= oldest.rate_;
+					if(lows_.front().sequence_ == oldest.sequence_)
+						lows_.pop_front();
+					if(highs_.front().sequence_ == oldest.sequence_)
+						highs_.pop_front();
+					samples_.pop_front();
+				}
+			}
+		};
+
+		//One coin's rate samples over several window lengths at once, e.g. 1m, 15m, 1h and 24h.
+		class RollingRateStatistics
+		{
+		public:
+			typedef RollingRateWindow::Clock Clock;
+
+			RollingRateStatistics() = default;
+
+			explicit RollingRateStatistics(const std::vector<Clock::duration> &lengths)
+			{
+				for(auto length : lengths)
+					windows_.emplace_back(length);
+			}
+
+			void add(Clock::time_point time, const FixedRate &rate)
+			{
+				for(auto &window : windows_)
+					window.add(time, rate);
+			}
+
+			size_t size() const { return windows_.size(); }
+			const RollingRateWindow &operator[](size_t i) const { return windows_[i]; }
+			std::vector<RollingRateWindow>::const_iterator begin() const { return windows_.begin(); }
+			std::vector<RollingRateWindow>::const_iterator end() const { return windows_.end(); }
+
+			//Window with exactly that length, nullptr if none
+			const RollingRateWindow *window(Clock::duration length) const
+			{
+				for(const auto &window : windows_)
+				{
+					if(window.length() == length)
+						return &window;
+				}
+				return nullptr;
+			}
+
+			//"90s" "15m" "1h" "24h"
+			static std::string lengthName(Clock::duration length)
+			{
+				auto seconds = std::chrono::duration_cast<std::chrono::seconds>(length).count();
+				if(seconds % 3600 == 0)
+					return std::to_string(seconds / 3600) + "h";
+				if(seconds % 60 == 0)
+					return std::to_string(seconds / 60) + "m";
+				return std::to_string(seconds) + "s";
+			}
+
+		private:
+			std::vector<RollingRateWindow> windows_;
+		};
+	}
+}
@@ -0,0 +1,281 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "LoanOrderBookHistory.hpp"
+#include "OfferReconciler.hpp"
+#include "RollingRateStatistics.hpp"
+#include "SpreadLendStrategy.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//One coin's spread lending replayed over recorded books, the way the bot's main loop runs it: every book is a
+		//rate statistics sample, and every refreshInterval_ after the warmup the open offers are reconciled with a
+		//fresh SpreadLendStrategy plan.
+		//
+		//Fill model: the recorded books don't have our offers in them, so an offer counts as lent, whole, once a
+		//later book's lowest rate has moved up past it. That only happens when borrowers took the front of the
+		//book, which is where our offers sit. A loan pays for loanDuration_ (or its day term if shorter) and its
+		//amount comes back to be offered again at the next refresh.
+		class SpreadLendBacktest
+		{
+		public:
+			typedef LoanOrderBookHistory::Clock Clock;
+
+			struct Config
+			{
+				SpreadLendStrategy::Params params_;
+				std::map<FixedRate, uint8_t> dayThresholds_;//offer rate >= key lends for value days, else 2
+				FixedAmount balance_;
+				Clock::duration strategyRateStatisticsWindow_ = std::chrono::minutes(15);
+				Clock::duration startupStatisticsInitializeInterval_ = std::chrono::minutes(15);
+				Clock::duration refreshInterval_ = std::chrono::seconds(60);
+				Clock::duration loanDuration_ = std::chrono::hours(24);
+				double fee_ = 0.15;
+			};
+
+			struct Result
+			{
+				uint64_t books_ = 0, refreshes_ = 0;
+				uint64_t privateCalls_ = 0;//balances and open offers per refresh, plus every cancel and create
+				uint64_t cancels_ = 0, creates_ = 0, loans_ = 0;
+				double interest_ = 0;//after fees, in units of the coin
+				double seconds_ = 0;//replayed
+				double balanceSeconds_ = 0, lentSeconds_ = 0;//amount * time
+
+				double days() const { return seconds_ / 86400; }
+				double utilization() const { return balanceSeconds_ == 0 ? 0 : lentSeconds_ / balanceSeconds_; }
+				//simple annual rate on the balance
+				double annualYield() const { return balanceSeconds_ == 0 ? 0 : interest_ / (balanceSeconds_ / 86400) * 365; }
+
+				std::string toString() const
+				{
+					std::ostringstream os;
+					os << "days:" << days() << " yield:" << annualYield() * 100 << "% utilization:" << utilization() * 100 << "% interest:" << interest_
+						<< " loans:" << loans_ << " cancels:" << cancels_ << " creates:" << creates_
+						<< " api calls(public:" << books_ << " private:" << privateCalls_ << ")";
+					return os.str();
+				}
+			};
+
+			explicit SpreadLendBacktest(const Config &config) :
+				config_(config),
+				rates_({ config.strategyRateStatisticsWindow_ }),
+				free_(config.balance_)
+			{}
+
+			//Books must come in time order
+			void book(Clock::time_point time, const LoanOrderBook &book)
+			{
+				if(result_.books_ == 0)
+				{
+					start_ = time;
+					lastRefresh_ = time - config_.refreshInterval_;
+				}
+				else
+					account(time);
+				++result_.books_;
+
+				returnLoans(time);
+				fill(time, book);
+
+				auto lowest = SpreadLendStrategy::lowestOfferRateAboveDustAmount(config_.params_, book);
+				rates_.add(time, lowest ? *lowest : config_.params_.maxDailyRate_);
+
+				if(time - start_ >= config_.startupStatisticsInitializeInterval_ && time - lastRefresh_ >= config_.refreshInterval_)
+				{
+					lastRefresh_ = time;
+					refresh(book);
+				}
+				previousBest_ = book.empty() ? boost::optional<FixedRate>() : book.front().rate_;
+			}
+
+			//Interest of loans still out, up to the last book
+			Result finish()
+			{
+				Result result = result_;
+				while(!loans_.empty())
+				{
+					const Loan &loan = loans_.top();
+					result.interest_ += interest(loan, std::min(loan.end_, last_) - loan.start_);
+					loans_.pop();
+				}
+				return result;
+			}
+
+			static Result run(const LoanOrderBookHistoryReader &history, const Config &config)
+			{
+				SpreadLendBacktest backtest(config);
+				history.forEach([&backtest](Clock::time_point time, const LoanOrderBook &book) { backtest.book(time, book); });
+				return backtest.finish();
+			}
+
+			//Every config over one decode of the history; decoding costs more than a config's strategy work, so
+			//parameter sweeps should hand in as many configs at once as they can.
+			static std::vector<Result> run(const LoanOrderBookHistoryReader &history, const std::vector<Config> &configs)
+			{
+				std::vector<SpreadLendBacktest> backtests;
+				backtests.reserve(configs.size());
+				for(const auto &config : configs)
+					backtests.emplace_back(config);
+				history.forEach([&backtests](Clock::time_point time, const LoanOrderBook &book) {
+					for(auto &backtest : backtests)
+						backtest.book(time, book);
+				});
+
+				std::vector<Result> results;
+				results.reserve(backtests.size());
+				for(auto &backtest : backtests)
+					results.push_back(backtest.finish());
+				return results;
+			}
+
+		private:
+			struct OpenOffer
+			{
+				FixedAmount amount_;
+				FixedRate rate_;
+			};
+
+			struct Loan
+			{
+				FixedAmount amount_;
+				FixedRate rate_;
+				Clock::time_point start_, end_;
+
+				bool operator>(const Loan &rhs) const { return end_ > rhs.end_; }
+			};
+
+			Config config_;
+			RollingRateStatistics rates_;
+			FixedAmount free_, lent_;
+			std::vector<OpenOffer> open_;
+			std::priority_queue<Loan, std::vector<Loan>, std::greater<Loan>> loans_;
+			Clock::time_point start_, last_, lastRefresh_;
+			boost::optional<FixedRate> previousBest_;
+			SpreadLendStrategy::Offers plan_;
+			Result result_;
+
+			static double toDouble(const FixedAmount &amount) { return static_cast<double>(amount.raw()) / 1e8; }
+			static double toDouble(const FixedRate &rate) { return static_cast<double>(rate.raw()) / 1e6; }
+
+			double interest(const Loan &loan, Clock::duration lent) const
+			{
+				double days = std::chrono::duration<double>(lent).count() / 86400;
+				return toDouble(loan.amount_) * toDouble(loan.rate_) * days * (1 - config_.fee_);
+			}
+
+			void account(Clock::time_point time)
+			{
+				double seconds = std::chrono::duration<double>(time - last_).count();
+				result_.seconds_ += seconds;
+				result_.balanceSeconds_ += toDouble(config_.balance_) * seconds;
+				result_.lentSeconds_ += toDouble(lent_) * seconds;
+				last_ = time;
+			}
+
+			void returnLoans(Clock::time_point time)
+			{
+				last_ = time;
+				while(!loans_.empty() && loans_.top().end_ <= time)
+				{
+					const Loan &loan = loans_.top();
+					result_.interest_ += interest(loan, loan.end_ - loan.start_);
+					lent_ -= loan.amount_;
+					free_ += loan.amount_;
+					loans_.pop();
+				}
+			}
+
+			void fill(Clock::time_point time, const LoanOrderBook &book)
+			{
+				if(book.empty() || !previousBest_ || !(*previousBest_ < book.front().rate_))
+					return;
+				for(size_t i = 0; i < open_.size(); )
+				{
+					if(open_[i].rate_ < book.front().rate_)
+					{
+						Clock::duration term = std::chrono::hours(24) * days(open_[i].rate_);
+						Loan loan = { open_[i].amount_, open_[i].rate_, time, time + std::min(config_.loanDuration_, term) };
+						loans_.push(loan);
+						lent_ += loan.amount_;
+						++result_.loans_;
+						open_[i] = open_.back();
+						open_.pop_back();
+					}
+					else
+						++i;
+				}
+			}
+
+			int days(const FixedRate &rate) const
+			{
+				int days = 2;
+				for(const auto &threshold : config_.dayThresholds_)
+				{
+					if(days < threshold.second && !(rate < threshold.first))
+						days = threshold.second;
+				}
+				return days;
+			}
+
+			void refresh(const LoanOrderBook &book)
+			{
+				++result_.refreshes_;
+				result_.privateCalls_ += 2;
+
+				FixedAmount available = free_;
+				for(const auto &offer : open_)
+					available += offer.amount_;
+
+				plan_.clear();
+				if(!(available < config_.params_.minLendOfferAmount_))
+				{
+					const RollingRateWindow &window = rates_[0];
+					SpreadLendStrategy::RecentRates recent = { window.low(), window.high(), window.sum().raw(), window.count() };
+					auto inputs = SpreadLendStrategy::inputs(config_.params_, book, recent, available, static_cast<uint32_t>(loans_.size()));
+					SpreadLendStrategy::optimalSpreadLendOffers(config_.params_, book, inputs, plan_);
+				}
+
+				auto diff = OfferReconciler::diff(open_, plan_);
+				result_.cancels_ += diff.cancel_.size();
+				result_.creates_ += diff.create_.size();
+				result_.privateCalls_ += diff.cancel_.size() + diff.create_.size();
+				for(auto i = diff.cancel_.rbegin(); i != diff.cancel_.rend(); ++i)
+				{
+					free_ += open_[*i].amount_;
+					open_.erase(open_.begin() + static_cast<std::ptrdiff_t>(*i));
+				}
+				for(size_t i : diff.create_)
+				{
+					free_ -= plan_[i].amount_;
+					open_.push_back({ plan_[i].amount_, plan_[i].rate_ });
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,111 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "SpreadLendStrategy.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Last spread lend plan per currency along with everything it was computed from: params, inputs and the
+		//rates and amounts of the book offers the strategy read. A refresh where none of those changed gets the
+		//same plan back without running the strategy. The read prefix is kept as a copy rather than a hash so a
+		//collision can never hand back a stale plan.
+		class SpreadLendPlanCache
+		{
+		public:
+			struct Stats
+			{
+				uint64_t computed_ = 0, reused_ = 0;
+			};
+
+			//reused is set true when the previous plan was still valid
+			const SpreadLendStrategy::Offers &plan(const std::string &currency, const SpreadLendStrategy::Params &params, const LoanOrderBook &book, const SpreadLendStrategy::Inputs &inputs, bool *reused = nullptr)
+			{
+				Entry &entry = entries_[currency];
+				bool same = entry.valid_ && unchanged(entry, params, book, inputs);
+				if(reused)
+					*reused = same;
+				if(same)
+				{
+					++stats_.reused_;
+					return entry.plan_;
+				}
+
+				++stats_.computed_;
+				entry.valid_ = false;
+				entry.plan_.clear();
+				size_t offersRead = SpreadLendStrategy::optimalSpreadLendOffers(params, book, inputs, entry.plan_);
+				entry.params_ = params;
+				entry.inputs_ = inputs;
+				entry.wholeBook_ = offersRead == book.size();
+				entry.offersRead_.clear();
+				for(size_t i = 0; i < offersRead; ++i)
+					entry.offersRead_.push_back({ book[i].amount_, book[i].rate_ });
+				entry.valid_ = true;
+				return entry.plan_;
+			}
+
+			const Stats &stats() const { return stats_; }
+
+		private:
+			struct Entry
+			{
+				bool valid_ = false;
+				SpreadLendStrategy::Params params_;
+				SpreadLendStrategy::Inputs inputs_;
+				std::vector<SpreadLendStrategy::Offer> offersRead_;
+				bool wholeBook_;//plan also depends on the book's length
+				SpreadLendStrategy::Offers plan_;
+			};
+
+			std::unordered_map<std::string, Entry> entries_;
+			Stats stats_;
+
+			static bool unchanged(const Entry &entry, const SpreadLendStrategy::Params &params, const LoanOrderBook &book, const SpreadLendStrategy::Inputs &inputs)
+			{
+				const SpreadLendStrategy::Params &p = entry.params_;
+				if(p.lowestOffersDustSkipAmount_ != params.lowestOffersDustSkipAmount_ || p.spreadDustSkipAmount_ != params.spreadDustSkipAmount_
+					|| p.minLendOfferAmount_ != params.minLendOfferAmount_ || p.minRateSkipAmount_ != params.minRateSkipAmount_
+					|| p.minDailyRate_ != params.minDailyRate_ || p.maxDailyRate_ != params.maxDailyRate_
+					|| p.minTotalLendOrdersToSpread_ != params.minTotalLendOrdersToSpread_ || p.maxTotalLendOrdersToSpread_ != params.maxTotalLendOrdersToSpread_
+					|| p.lendOrdersToSpread_ != params.lendOrdersToSpread_)
+					return false;
+
+				const SpreadLendStrategy::Inputs &i = entry.inputs_;
+				if(i.availableLendBalance_ != inputs.availableLendBalance_ || i.activeLoanCount_ != inputs.activeLoanCount_
+					|| i.beginningRate_ != inputs.beginningRate_ || i.beginningRateExact_ != inputs.beginningRateExact_
+					|| i.recentHighRate_ != inputs.recentHighRate_)
+					return false;
+
+				if(entry.wholeBook_ ? book.size() != entry.offersRead_.size() : book.size() < entry.offersRead_.size())
+					return false;
+				for(size_t n = 0; n < entry.offersRead_.size(); ++n)
+				{
+					if(book[n].rate_ != entry.offersRead_[n].rate_ || book[n].amount_ != entry.offersRead_[n].amount_)
+						return false;
+				}
+				return true;
+			}
+		};
+	}
+}
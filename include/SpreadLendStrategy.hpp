@@ -0,0 +1,261 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "FixedPoint.hpp"
+#include "LoanOrderBook.hpp"
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace tylawin
+{
+	namespace poloniex
+	{
+		//Spread lending decisions on fixed point values. No allocation other than the output vector and no
+		//api or settings access, so it can be run against recorded books as well as live ones.
+		class SpreadLendStrategy
+		{
+		public:
+			//Coin settings at exchange precision
+			struct Params
+			{
+				FixedAmount lowestOffersDustSkipAmount_, spreadDustSkipAmount_, minLendOfferAmount_;
+				FixedRate minRateSkipAmount_, minDailyRate_, maxDailyRate_;
+				uint32_t minTotalLendOrdersToSpread_, maxTotalLendOrdersToSpread_, lendOrdersToSpread_;
+			};
+
+			struct Inputs
+			{
+				FixedAmount availableLendBalance_;
+				uint32_t activeLoanCount_;
+				FixedRate beginningRate_;//first rate worth lending at, rounded up onto the rate grid
+				bool beginningRateExact_;//false if rounding up changed it
+				FixedRate recentHighRate_;//highest recent lowest-rate-above-dust, rounded up onto the rate grid
+			};
+
+			struct Offer
+			{
+				FixedAmount amount_;
+				FixedRate rate_;
+			};
+			typedef std::vector<Offer> Offers;
+
+			//Recent lowestOfferRateAboveDustAmount samples, count_ 0 when there are none yet
+			struct RecentRates
+			{
+				FixedRate low_, high_;
+				FixedRate::Raw sum_;
+				uint64_t count_;
+			};
+
+			static FixedRate minimumRateIncrement() { return FixedRate::fromRaw(1); }
+
+			//Number of book offers that have to be read to find lendOrdersToSpread_ spread positions.
+			static boost::optional<uint32_t> positionOfLastOfferToSpreadLendUnder(const Params &params, const LoanOrderBook &book)
+			{
+				uint32_t offerCount = 0;
+				uint16_t spreadCount = 0;
+
+				FixedAmount sum;
+				for(const auto &offer : book)
+				{
+					sum += offer.amount_;
+					if(spreadCount == 0 && sum >= params.lowestOffersDustSkipAmount_)
+					{
+						++spreadCount;
+						sum = FixedAmount();
+					}
+					else if(spreadCount != 0 && sum >= params.spreadDustSkipAmount_)
+					{
+						++spreadCount;
+						sum = FixedAmount();
+					}
+					++offerCount;
+					if(spreadCount >= params.lendOrdersToSpread_)
+						return offerCount;
+				}
+
+				return boost::none;
+			}
+
+			//Least book amount positionOfLastOfferToSpreadLendUnder reads before it can return.
+			static FixedAmount amountToSpreadLendUnder(const Params &params)
+			{
+				if(params.lendOrdersToSpread_ == 0)
+					return FixedAmount();
+				return params.lowestOffersDustSkipAmount_ + params.spreadDustSkipAmount_ * (params.lendOrdersToSpread_ - 1);
+			}
+
+			static boost::optional<FixedRate> lowestOfferRateAboveDustAmount(const Params &params, const LoanOrderBook &book)
+			{
+				size_t i = book.firstReachingCumulativeAmount(params.lowestOffersDustSkipAmount_);
+				if(i == book.size())
+					return boost::none;
+				return book[i].rate_;
+			}
+
+			//First rate worth lending at: the lowest rate above dust (just over maxDailyRate_ when there is none), raised
+			//to minDailyRate_ and then to halfway between the recent low and average. Rounded up onto the rate grid,
+			//exact is false if that changed it.
+			static FixedRate beginningRate(const Params &params, const LoanOrderBook &book, const RecentRates &recent, bool &exact)
+			{
+				auto lowest = lowestOfferRateAboveDustAmount(params, book);
+				FixedRate rate = lowest ? *lowest : params.maxDailyRate_ + minimumRateIncrement();
+				if(rate < params.minDailyRate_)
+					rate = params.minDailyRate_;
+
+				exact = true;
+				if(recent.count_ != 0)
+				{
+					//(low + sum / count) / 2, rounded up
+					int64_t count = static_cast<int64_t>(recent.count_);
+					int64_t numerator = recent.low_.raw() * count + recent.sum_, denominator = 2 * count;
+					int64_t midpoint = numerator / denominator;
+					bool midpointExact = numerator % denominator == 0;
+					if(!midpointExact && numerator > 0)
+						++midpoint;
+					if(rate < FixedRate::fromRaw(midpoint))
+					{
+						rate = FixedRate::fromRaw(midpoint);
+						exact = midpointExact;
+					}
+				}
+				return rate;
+			}
+
+			static Inputs inputs(const Params &params, const LoanOrderBook &book, const RecentRates &recent, const FixedAmount &availableLendBalance, uint32_t activeLoanCount)
+			{
+				Inputs in;
+				in.availableLendBalance_ = availableLendBalance;
+				in.activeLoanCount_ = activeLoanCount;
+				in.beginningRate_ = beginningRate(params, book, recent, in.beginningRateExact_);
+				in.recentHighRate_ = recent.count_ != 0 ? recent.high_ : FixedRate();
+				return in;
+			}
+
+			//Amount per spread offer on the amount grid. Ties round to even. The Decimal code divided inexactly, so a share of
+			//exactly half a tick went either way there.
+			static FixedAmount spreadLendAmount(const Params &params, uint32_t activeLoanCount, const FixedAmount &availableLendBalance)
+			{
+				uint32_t spreadLendCount = params.lendOrdersToSpread_;
+
+				if(activeLoanCount + spreadLendCount < std::max(activeLoanCount, spreadLendCount))
+					throw std::runtime_error("uint32_t overflow. activeLoanCount + spreadLendCount.");
+
+				if(activeLoanCount + spreadLendCount < params.minTotalLendOrdersToSpread_)
+					spreadLendCount = params.minTotalLendOrdersToSpread_;
+
+				if(activeLoanCount + spreadLendCount > params.maxTotalLendOrdersToSpread_)
+				{
+					if(activeLoanCount > params.maxTotalLendOrdersToSpread_)
+						spreadLendCount = 0u;
+					else
+						spreadLendCount = params.maxTotalLendOrdersToSpread_ - activeLoanCount;
+				}
+
+				if(spreadLendCount == 0u)
+				{
+					if(availableLendBalance < params.minLendOfferAmount_)
+						return FixedAmount();
+					else
+						return availableLendBalance;
+				}
+
+				//largest count whose share is still >= minLendOfferAmount_ (balance / count >= min  <=>  count <= balance / min)
+				if(params.minLendOfferAmount_ > FixedAmount())
+				{
+					int64_t maxCount = availableLendBalance.raw() / params.minLendOfferAmount_.raw();
+					if(maxCount < static_cast<int64_t>(spreadLendCount))
+						spreadLendCount = static_cast<uint32_t>(std::max<int64_t>(maxCount, 0));
+				}
+				if(spreadLendCount == 0u)
+					return FixedAmount();
+
+				return availableLendBalance.divide(spreadLendCount, Rounding::HALF_EVEN);
+			}
+
+			//Caller has already checked availableLendBalance_ >= minLendOfferAmount_.
+			//Returns how many leading book offers the result depends on, book.size() when it also depends on where the
+			//book ends. Only the rates and amounts of those offers are read.
+			static size_t optimalSpreadLendOffers(const Params &params, const LoanOrderBook &book, const Inputs &inputs, Offers &offers)
+			{
+				FixedAmount availableLendBalance = inputs.availableLendBalance_;
+				const FixedRate increment = minimumRateIncrement();
+
+				//beginningRate_ is rounded up, so one that only reached maxDailyRate_ by rounding was below it
+				bool atOrAboveMax = inputs.beginningRate_ > params.maxDailyRate_ || (inputs.beginningRate_ == params.maxDailyRate_ && inputs.beginningRateExact_);
+				if(atOrAboveMax || book.empty())
+				{
+					if(inputs.beginningRateExact_ && inputs.beginningRate_ == params.maxDailyRate_)
+						offers.push_back({ availableLendBalance, params.maxDailyRate_ - increment });
+					else
+						offers.push_back({ availableLendBalance, params.maxDailyRate_ });
+					return 0;
+				}
+
+				FixedAmount amount = spreadLendAmount(params, inputs.activeLoanCount_, availableLendBalance);
+
+				uint16_t createLoanOfferCount = 0;
+				FixedAmount offerAmountSum;
+				FixedRate previousCreatedOfferRate;
+				size_t offersRead = 0;
+				for(const auto &offer : book)
+				{
+					++offersRead;
+					const FixedRate &rate = offer.rate_;
+					if((rate - increment) - previousCreatedOfferRate < params.minRateSkipAmount_)
+						continue;
+
+					offerAmountSum += offer.amount_;
+
+					if(offerAmountSum > params.spreadDustSkipAmount_ && rate >= inputs.beginningRate_ && offer.amount_ * 2 > params.spreadDustSkipAmount_)
+					{
+						if(availableLendBalance - amount < params.minLendOfferAmount_)
+							amount = availableLendBalance;
+						previousCreatedOfferRate = rate - increment;
+						offers.push_back({ amount, previousCreatedOfferRate });
+						availableLendBalance -= amount;
+						++createLoanOfferCount;
+						offerAmountSum = FixedAmount();
+					}
+					if(availableLendBalance == FixedAmount() || createLoanOfferCount >= params.lendOrdersToSpread_)
+						break;
+				}
+
+				if(availableLendBalance > params.minLendOfferAmount_ && previousCreatedOfferRate + increment < inputs.recentHighRate_)
+				{
+					offersRead = book.size();
+					if(book.back().rate_ < inputs.recentHighRate_)
+					{
+						if(availableLendBalance - amount != FixedAmount() && availableLendBalance - amount < params.minLendOfferAmount_)
+							amount = availableLendBalance;
+						offers.push_back({ amount, inputs.recentHighRate_ - increment });
+						availableLendBalance -= amount;
+					}
+				}
+
+				if(availableLendBalance > params.minLendOfferAmount_)
+					offers.push_back({ availableLendBalance, params.maxDailyRate_ });
+				return offersRead;
+			}
+		};
+	}
+}
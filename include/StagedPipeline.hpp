@@ -0,0 +1,142 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+#include "BoundedSpscQueue.hpp"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tylawin
+{
+	//fetch -> compute -> execute, one thread per stage joined by BoundedSpscQueues, so while key B is being
+	//fetched key A is being computed and the key before it executed. Keys go through every stage in order.
+	//
+	//A stage that throws only fails its own key: the exception rides along to the execute thread, which hands it
+	//to failed_ in key order instead of running the later stages. If failed_ rethrows, nothing more is started,
+	//the keys already in the queues are dropped and run() rethrows it once the other stages have stopped.
+	template<typename Key, typename Fetched, typename Planned>
+	class StagedPipeline
+	{
+	public:
+		struct Stages
+		{
+			std::function<Fetched(const Key &)> fetch_;
+			std::function<Planned(const Key &, Fetched &)> compute_;
+			std::function<void(const Key &, Planned &)> execute_;
+			std::function<void(const Key &, std::exception_ptr)> failed_;
+		};
+
+		//fetch_ and compute_ run on new threads, execute_ and failed_ on the caller's
+		static void run(const std::vector<Key> &keys, const Stages &stages, size_t queueCapacity = 4)
+		{
+			BoundedSpscQueue<Item<Fetched>> fetched(queueCapacity);
+			BoundedSpscQueue<Item<Planned>> planned(queueCapacity);
+			std::atomic<bool> stop(false);
+
+			std::thread fetchThread([&]() {
+				for(const auto &key : keys)
+				{
+					if(stop.load(std::memory_order_relaxed))
+						break;
+					Item<Fetched> item;
+					item.key_ = key;
+					try
+					{
+						item.value_ = stages.fetch_(key);
+					}
+					catch(...)
+					{
+						item.error_ = std::current_exception();
+					}
+					fetched.push(std::move(item));
+				}
+				fetched.close();
+			});
+
+			std::thread computeThread([&]() {
+				Item<Fetched> in;
+				while(fetched.pop(in))
+				{
+					Item<Planned> out;
+					out.key_ = in.key_;
+					out.error_ = in.error_;
+					if(!out.error_ && !stop.load(std::memory_order_relaxed))
+					{
+						try
+						{
+							out.value_ = stages.compute_(in.key_, in.value_);
+						}
+						catch(...)
+						{
+							out.error_ = std::current_exception();
+						}
+					}
+					planned.push(std::move(out));
+				}
+				planned.close();
+			});
+
+			//drains to the end even after a stop so the other stages never wait on a full queue
+			std::exception_ptr stopError;
+			Item<Planned> item;
+			while(planned.pop(item))
+			{
+				if(stopError)
+					continue;
+				try
+				{
+					if(item.error_)
+						stages.failed_(item.key_, item.error_);
+					else
+					{
+						try
+						{
+							stages.execute_(item.key_, item.value_);
+						}
+						catch(...)
+						{
+							stages.failed_(item.key_, std::current_exception());
+						}
+					}
+				}
+				catch(...)
+				{
+					stopError = std::current_exception();
+					stop.store(true, std::memory_order_relaxed);
+				}
+			}
+
+			fetchThread.join();
+			computeThread.join();
+			if(stopError)
+				std::rethrow_exception(stopError);
+		}
+
+	private:
+		template<typename Value>
+		struct Item
+		{
+			Key key_;
+			Value value_;
+			std::exception_ptr error_;
+		};
+	};
+}
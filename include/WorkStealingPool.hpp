@@ -0,0 +1,175 @@
+/*
+Copyright 2016 Tyler Winters
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tylawin
+{
+	//Runs batches of independent tasks on a fixed set of threads. Each thread has its own deque, works from the
+	//back of it and when it runs dry steals from the front of the others', so tasks of very different lengths
+	//still keep every thread busy to the end of a batch without all of them contending on one queue.
+	class WorkStealingPool
+	{
+	public:
+		explicit WorkStealingPool(size_t threads = std::max(1u, std::thread::hardware_concurrency())) :
+			generation_(0),
+			remaining_(0),
+			stop_(false)
+		{
+			if(threads == 0)
+				throw std::invalid_argument("WorkStealingPool threads must be > 0");
+			for(size_t i = 0; i < threads; ++i)
+				workers_.emplace_back(new Worker());
+			for(size_t i = 0; i < threads; ++i)
+				threads_.emplace_back([this, i]() { workerLoop(i); });
+		}
+
+		~WorkStealingPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			start_.notify_all();
+			for(auto &thread : threads_)
+				thread.join();
+		}
+
+	private://noncopyable
+		WorkStealingPool(const WorkStealingPool &) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool &) = delete;
+
+	public:
+		size_t threads() const { return threads_.size(); }
+
+		//Blocks until every task has run. Tasks are dealt out round robin. If any throw, the first exception is
+		//rethrown once the rest have finished.
+		void run(std::vector<std::function<void()>> tasks)
+		{
+			if(tasks.empty())
+				return;
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			for(size_t i = 0; i < tasks.size(); ++i)
+			{
+				Worker &worker = *workers_[i % workers_.size()];
+				std::lock_guard<std::mutex> workerLock(worker.mutex_);
+				worker.tasks_.push_back(std::move(tasks[i]));
+			}
+			remaining_ = tasks.size();
+			error_ = nullptr;
+			++generation_;
+			start_.notify_all();
+
+			done_.wait(lock, [this]() { return remaining_ == 0; });
+			if(error_)
+				std::rethrow_exception(error_);
+		}
+
+	private:
+		struct Worker
+		{
+			std::mutex mutex_;
+			std::deque<std::function<void()>> tasks_;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers_;
+		std::vector<std::thread> threads_;
+
+		std::mutex mutex_;
+		std::condition_variable start_, done_;
+		uint64_t generation_;
+		size_t remaining_;
+		bool stop_;
+		std::exception_ptr error_;
+
+		bool take(size_t self, std::function<void()> &task)
+		{
+			{
+				Worker &own = *workers_[self];
+				std::lock_guard<std::mutex> lock(own.mutex_);
+				if(!own.tasks_.empty())
+				{
+					task = std::move(own.tasks_.back());
+					own.tasks_.pop_back();
+					return true;
+				}
+			}
+			for(size_t i = 1; i < workers_.size(); ++i)
+			{
+				Worker &victim = *workers_[(self + i) % workers_.size()];
+				std::lock_guard<std::mutex> lock(victim.mutex_);
+				if(!victim.tasks_.empty())
+				{
+					task = std::move(victim.tasks_.front());
+					victim.tasks_.pop_front();
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void workerLoop(size_t self)
+		{
+			uint64_t seen = 0;
+			while(true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					start_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+					if(stop_)
+						return;
+					seen = generation_;
+				}
+
+				//tasks don't add tasks, so once every deque is empty this batch needs nothing more from this thread
+				std::function<void()> task;
+				while(take(self, task))
+				{
+					std::exception_ptr error;
+					try
+					{
+						task();
+					}
+					catch(...)
+					{
+						error = std::current_exception();
+					}
+					task = nullptr;
+
+					std::lock_guard<std::mutex> lock(mutex_);
+					if(error && !error_)
+						error_ = error;
+					if(--remaining_ == 0)
+						done_.notify_all();
+				}
+			}
+		}
+	};
+}
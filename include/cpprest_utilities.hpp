@@ -177,6 +177,52 @@ namespace tylawin
 				
 				//return tmpStrStream.str();
 			}
+
+			//Writes 2 * size lowercase hex chars to out. (not null terminated)
+			void toHex(const unsigned char *bytes, size_t size, char *out)
+			{
+				static const char hexDigits[] = "0123456789abcdef";
+				for(size_t i = 0; i < size; ++i)
+				{
+					out[2 * i]     = hexDigits[bytes[i] >> 4];
+					out[2 * i + 1] = hexDigits[bytes[i] & 0x0f];
+				}
+			}
+
+			//HMAC-SHA512 with the key's inner/outer pad states computed once up front.
+			//sign() only copies that state, so it is const and safe to call from several threads.
+			class HmacSha512Signer
+			{
+			public:
+				static constexpr size_t hexDigestSize_ = 2 * SHA512_DIGEST_SIZE;
+
+				explicit HmacSha512Signer(const std::string &key)
+				{
+					hmac_sha512_init(&keyedCtx_, reinterpret_cast<const unsigned char*>(key.data()), static_cast<unsigned int>(key.size()));
+				}
+
+				//Writes hexDigestSize_ chars to hexOut. (not null terminated)
+				void sign(const char *message, size_t messageSize, char *hexOut) const
+				{
+					hmac_sha512_ctx ctx = keyedCtx_;
+					hmac_sha512_update(&ctx, reinterpret_cast<const unsigned char*>(message), static_cast<unsigned int>(messageSize));
+
+					unsigned char digest[SHA512_DIGEST_SIZE];
+					hmac_sha512_final(&ctx, digest, SHA512_DIGEST_SIZE);
+
+					toHex(digest, SHA512_DIGEST_SIZE, hexOut);
+				}
+
+				std::string sign(const std::string &message) const
+				{
+					std::string hex(hexDigestSize_, '\0');
+					sign(message.data(), message.size(), &hex[0]);
+					return hex;
+				}
+
+			private:
+				hmac_sha512_ctx keyedCtx_;
+			};
 		}
 	}
 }
\ No newline at end of file
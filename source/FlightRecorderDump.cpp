@@ -0,0 +1,171 @@
+#include "FlightRecorder.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+using namespace tylawin::poloniex;
+using namespace std;
+
+namespace
+{
+	void usage()
+	{
+		cerr << "usage: FlightRecorderDump [file] [--last N] [--body] [--pretty]" << endl
+			<< "  file      flight recorder file (default logs/flightrecorder.bin)" << endl
+			<< "  --last N  only the newest N entries" << endl
+			<< "  --body    print each response body" << endl
+			<< "  --pretty  print each response body indented (implies --body)" << endl;
+	}
+
+	string formatTime(uint64_t unixTimeUs)
+	{
+		time_t seconds = static_cast<time_t>(unixTimeUs / 1000000);
+		tm utc;
+#ifdef _WIN32
+		gmtime_s(&utc, &seconds);
+#else
+		gmtime_r(&seconds, &utc);
+#endif
+		char buf[32];
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &utc);
+		char us[8];
+		snprintf(us, sizeof(us), ".%06u", static_cast<unsigned>(unixTimeUs % 1000000));
+		return string(buf) + us + "Z";
+	}
+
+	//Indents json text as it goes without building a document, so truncated bodies still print.
+	void printIndented(const char *text, size_t size)
+	{
+		int depth = 0;
+		bool inString = false, escaped = false;
+		auto newline = [&depth]() {
+			cout << '\n';
+			for(int i = 0; i < depth; ++i)
+				cout << '\t';
+		};
+		for(size_t i = 0; i < size; ++i)
+		{
+			char c = text[i];
+			if(inString)
+			{
+				cout << c;
+				if(escaped)
+					escaped = false;
+				else if(c == '\\')
+					escaped = true;
+				else if(c == '"')
+					inString = false;
+				continue;
+			}
+			switch(c)
+			{
+			case '"':
+				inString = true;
+				cout << c;
+				break;
+			case '{':
+			case '[':
+				cout << c;
+				if(i + 1 < size && (text[i + 1] == '}' || text[i + 1] == ']'))
+				{
+					cout << text[++i];
+					break;
+				}
+				++depth;
+				newline();
+				break;
+			case '}':
+			case ']':
+				--depth;
+				newline();
+				cout << c;
+				break;
+			case ',':
+				cout << c;
+				newline();
+				break;
+			case ':':
+				cout << ": ";
+				break;
+			case ' ':
+			case '\t':
+			case '\r':
+			case '\n':
+				break;
+			default:
+				cout << c;
+			}
+		}
+		cout << '\n';
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string file = "logs/flightrecorder.bin";
+	size_t last = 0;
+	bool body = false, pretty = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "--last") == 0 && i + 1 < argc)
+			last = static_cast<size_t>(strtoul(argv[++i], nullptr, 10));
+		else if(strcmp(argv[i], "--body") == 0)
+			body = true;
+		else if(strcmp(argv[i], "--pretty") == 0)
+			body = pretty = true;
+		else if(argv[i][0] == '-')
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		else
+			file = argv[i];
+	}
+
+	try
+	{
+		FlightRecorderReader reader(file);
+		const auto &entries = reader.entries();
+		size_t first = last != 0 && last < entries.size() ? entries.size() - last : 0;
+		for(size_t i = first; i < entries.size(); ++i)
+		{
+			const FlightRecorderReader::EntryView &entry = entries[i];
+			const FlightRecorder::SlotHeader &header = *entry.header_;
+			cout << "#" << header.sequence_ << " " << formatTime(header.unixTimeUs_) << " " << (header.latencyUs_ / 1000.0) << "ms ";
+			if(header.flags_ & FlightRecorder::TRANSPORT_ERROR)
+				cout << "transport error";
+			else
+				cout << header.status_ << " " << header.bodyTotalBytes_ << "B";
+			if(header.flags_ & FlightRecorder::TRUNCATED)
+				cout << " (truncated to " << header.bodyBytes_ << "B)";
+			cout << (header.flags_ & FlightRecorder::AUTHENTICATED ? " private " : " public ");
+			cout.write(entry.request_, header.requestBytes_);
+			cout << '\n';
+
+			if(header.flags_ & FlightRecorder::TRANSPORT_ERROR)
+			{
+				cout << "  ";
+				cout.write(entry.body_, header.bodyBytes_);
+				cout << '\n';
+			}
+			else if(pretty)
+				printIndented(entry.body_, header.bodyBytes_);
+			else if(body)
+			{
+				cout.write(entry.body_, header.bodyBytes_);
+				cout << '\n';
+			}
+		}
+		cout.flush();
+	}
+	catch(const std::exception &e)
+	{
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+#include "MockPoloniexExchange.hpp"
+#ifdef LOAN_ORDER_BOOK_FEED
+#include "MockLoanOrderBookFeedServer.hpp"
+#endif
+
+#include <cpprest/http_listener.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+volatile sig_atomic_t g_sigint = false;
+void interruptSignalHandler(int param)
+{
+	g_sigint = true;
+}
+
+namespace
+{
+	void usage()
+	{
+		cerr << "usage: MockPoloniexServer [--listen URI] [--feedPort N] [--key KEY] [--secret SECRET] [--currencies BTC,ETH,...] [--depth N] [--rps N] [--loanDay MS] [--seed N]" << endl
+			<< "  --listen      default http://127.0.0.1:8765" << endl
+#ifdef LOAN_ORDER_BOOK_FEED
+			<< "  --feedPort    also push the books as a loan order book feed (loanOrderBookFeedUri ws://127.0.0.1:N), default off" << endl
+#endif
+			<< "  --key/secret  api key pair the bot must sign with (default benchmark/benchmark)" << endl
+			<< "  --currencies  simulated loan markets (default BTC,ETH,XMR)" << endl
+			<< "  --depth       offers per simulated book (default 600)" << endl
+			<< "  --rps         requests per second before 429 (default 6)" << endl
+			<< "  --loanDay     ms of real time per simulated lending day (default 60000)" << endl
+			<< "  --seed        random seed for the simulated books (default 1)" << endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string listenUri = "http://127.0.0.1:8765";
+#ifdef LOAN_ORDER_BOOK_FEED
+	uint16_t feedPort = 0;
+#endif
+	MockPoloniexExchange::Settings settings;
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		string value = argv[++i];
+		if(arg == "--listen")
+			listenUri = value;
+#ifdef LOAN_ORDER_BOOK_FEED
+		else if(arg == "--feedPort")
+			feedPort = static_cast<uint16_t>(strtoul(value.c_str(), nullptr, 10));
+#endif
+		else if(arg == "--key")
+			settings.key_ = value;
+		else if(arg == "--secret")
+			settings.secret_ = value;
+		else if(arg == "--currencies")
+		{
+			settings.currencies_.clear();
+			istringstream list(value);
+			string currency;
+			while(getline(list, currency, ','))
+				settings.currencies_.push_back(currency);
+		}
+		else if(arg == "--depth")
+			settings.bookDepth_ = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--rps")
+			settings.requestsPerSecond_ = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--loanDay")
+			settings.loanDay_ = chrono::milliseconds(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--seed")
+			settings.seed_ = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	MockPoloniexExchange exchange(settings);
+
+	web::http::experimental::listener::http_listener listener(CppRest::Utilities::s2u(listenUri));
+	listener.support([&exchange](web::http::http_request request) {
+		try
+		{
+			utility::string_t key, sign;
+			request.headers().match(U("Key"), key);
+			request.headers().match(U("Sign"), sign);
+			string body = request.extract_utf8string(true).get();
+
+			auto result = exchange.handle(CppRest::Utilities::u2s(request.method()), CppRest::Utilities::u2s(request.relative_uri().path()),
+				CppRest::Utilities::u2s(request.relative_uri().query()), body, CppRest::Utilities::u2s(key), CppRest::Utilities::u2s(sign));
+
+			web::http::http_response response(result.status_);
+			response.set_reason_phrase(CppRest::Utilities::s2u(result.reasonPhrase_));
+			response.set_body(result.body_, "application/json");
+			request.reply(response);
+		}
+		catch(const std::exception &e)
+		{
+			request.reply(web::http::status_codes::BadRequest, CppRest::Utilities::s2u(string("{\"error\":\"") + e.what() + "\"}"), U("application/json"));
+		}
+	});
+	listener.open().wait();
+	cout << "Mock Poloniex listening on " << listenUri << " (^c to stop)" << endl;
+
+#ifdef LOAN_ORDER_BOOK_FEED
+	//a snapshot on subscribe, then each second the level changes of every subscribed book, or a heartbeat
+	struct FeedChannel
+	{
+		uint64_t sequence_ = 0;
+		MockLoanOrderBookFeedServer::Levels sent_;
+	};
+	mutex feedMutex;
+	map<string, FeedChannel> feedChannels;
+	unique_ptr<MockLoanOrderBookFeedServer> feed;
+	if(feedPort != 0)
+	{
+		feed.reset(new MockLoanOrderBookFeedServer(feedPort, [&](MockLoanOrderBookFeedServer &server, const string &command, const string &channel) {
+			lock_guard<mutex> lock(feedMutex);
+			if(command == "unsubscribe")
+			{
+				feedChannels.erase(channel);
+				return;
+			}
+			FeedChannel &feedChannel = feedChannels[channel];
+			feedChannel.sent_ = MockLoanOrderBookFeedServer::levels(exchange.book(channel));
+			server.push(MockLoanOrderBookFeedServer::snapshot(channel, ++feedChannel.sequence_, feedChannel.sent_));
+		}));
+		cout << "Mock loan order book feed on ws://127.0.0.1:" << feedPort << endl;
+	}
+	auto lastPush = chrono::steady_clock::now();
+#endif
+
+	signal(SIGINT, interruptSignalHandler);
+	while(!g_sigint)
+	{
+		this_thread::sleep_for(chrono::milliseconds(100));
+#ifdef LOAN_ORDER_BOOK_FEED
+		if(feed && chrono::steady_clock::now() - lastPush >= chrono::seconds(1))
+		{
+			lastPush = chrono::steady_clock::now();
+			bool pushed = false;
+			lock_guard<mutex> lock(feedMutex);
+			for(auto &feedChannel : feedChannels)
+			{
+				auto levels = MockLoanOrderBookFeedServer::levels(exchange.book(feedChannel.first));
+				auto changes = MockLoanOrderBookFeedServer::changes(feedChannel.second.sent_, levels);
+				if(changes.empty())
+					continue;
+				feed->push(MockLoanOrderBookFeedServer::update(feedChannel.first, ++feedChannel.second.sequence_, changes));
+				feedChannel.second.sent_ = levels;
+				pushed = true;
+			}
+			if(!pushed)
+				feed->push(MockLoanOrderBookFeedServer::heartbeat());
+		}
+#endif
+	}
+
+	listener.close().wait();
+	auto stats = exchange.stats();
+	cout << "requests:" << stats.requests_ << " rate limited:" << stats.rateLimited_ << " rejected:" << stats.rejected_
+		<< " offers created:" << stats.offersCreated_ << " canceled:" << stats.offersCanceled_ << " filled:" << stats.offersFilled_ << endl;
+	return EXIT_SUCCESS;
+}
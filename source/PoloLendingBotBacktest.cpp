@@ -0,0 +1,171 @@
+#include "BacktestSettings.hpp"
+#include "SpreadLendBacktest.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Replays the books recorded by loanOrderBookHistoryDirectory through the spread lending strategy, the rate
+//statistics and a simulated market (see SpreadLendBacktest for the fill model), one coin per core. Coin settings,
+//refreshLoansInterval, startupStatisticsInitializeInterval and strategyRateStatisticsWindow come from the bot's
+//settings file, so a settings change can be judged on history before it goes live:
+//  PoloLendingBotBacktest --history logs/bookhistory --settings config.json --balance 10
+namespace
+{
+	struct Run
+	{
+		string currency_;
+		SpreadLendBacktest::Config config_;
+		SpreadLendBacktest::Result result_;
+		string error_;
+	};
+
+	void usage()
+	{
+		cerr << "usage: PoloLendingBotBacktest --history DIR [--settings FILE] [--balance AMOUNT] [--loanHours N] [--currencies BTC,ETH,...] [--threads N]" << endl
+			<< "  --history     loanOrderBookHistoryDirectory of the bot that recorded the books" << endl
+			<< "  --settings    bot settings file for coin settings and intervals (default config.json, built in defaults if that is missing)" << endl
+			<< "  --balance     lending balance of each coin, in that coin (default 1)" << endl
+			<< "  --loanHours   how long a filled offer stays lent, at most its day term (default 24)" << endl
+			<< "  --currencies  only these (default every <currency>.books in --history)" << endl
+			<< "  --threads     coins replayed at once (default one per core)" << endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string historyDir, settingsFile = BacktestSettings::defaultFile(), balance = "1";
+	bool settingsFileGiven = false;
+	int loanHours = 24;
+	vector<string> currencies;
+	size_t threadCount = max(1u, thread::hardware_concurrency());
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		string value = argv[++i];
+		if(arg == "--history")
+			historyDir = value;
+		else if(arg == "--settings")
+		{
+			settingsFile = value;
+			settingsFileGiven = true;
+		}
+		else if(arg == "--balance")
+			balance = value;
+		else if(arg == "--loanHours")
+			loanHours = atoi(value.c_str());
+		else if(arg == "--threads")
+			threadCount = max<size_t>(1, strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--currencies")
+		{
+			istringstream list(value);
+			string currency;
+			while(getline(list, currency, ','))
+				currencies.push_back(currency);
+		}
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(historyDir.empty() || loanHours < 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		if(currencies.empty())
+		{
+			for(filesystem::directory_iterator iter(historyDir), end; iter != end; ++iter)
+			{
+				if(iter->path().extension() == ".books")
+					currencies.push_back(iter->path().stem().string());
+			}
+			sort(currencies.begin(), currencies.end());
+		}
+
+		BacktestSettings settings(settingsFile, settingsFileGiven);
+		SpreadLendBacktest::Config defaults = settings.defaults(FixedAmount::parse(balance), loanHours);
+
+		vector<Run> runs;
+		for(const auto &currency : currencies)
+		{
+			auto coin = settings.coin(currency);
+
+			Run run;
+			run.currency_ = currency;
+			run.config_ = defaults;
+			run.config_.params_ = coin.strategyParams();
+			run.config_.dayThresholds_ = coin.dayThresholds();
+			runs.push_back(run);
+		}
+
+		auto start = chrono::steady_clock::now();
+		atomic<size_t> next(0);
+		vector<thread> threads;
+		for(size_t t = 0; t < min(threadCount, runs.size()); ++t)
+		{
+			threads.emplace_back([&]() {
+				for(size_t i = next++; i < runs.size(); i = next++)
+				{
+					try
+					{
+						LoanOrderBookHistoryReader history((filesystem::path(historyDir) / (runs[i].currency_ + ".books")).string());
+						runs[i].result_ = SpreadLendBacktest::run(history, runs[i].config_);
+					}
+					catch(const exception &e)
+					{
+						runs[i].error_ = e.what();
+					}
+				}
+			});
+		}
+		for(auto &t : threads)
+			t.join();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		uint64_t books = 0;
+		cout << left << setw(8) << "coin" << right << setw(8) << "days" << setw(10) << "yield%" << setw(9) << "util%" << setw(9) << "loans"
+			<< setw(9) << "cancels" << setw(9) << "creates" << setw(10) << "books" << setw(10) << "private" << endl;
+		for(const auto &run : runs)
+		{
+			cout << left << setw(8) << run.currency_ << right;
+			if(!run.error_.empty())
+			{
+				cout << "  " << run.error_ << endl;
+				continue;
+			}
+			const auto &r = run.result_;
+			cout << fixed << setprecision(2) << setw(8) << r.days() << setw(10) << r.annualYield() * 100 << setw(9) << r.utilization() * 100
+				<< setw(9) << r.loans_ << setw(9) << r.cancels_ << setw(9) << r.creates_ << setw(10) << r.books_ << setw(10) << r.privateCalls_ << endl;
+			books += r.books_;
+		}
+		cout << books << " books in " << setprecision(3) << seconds << "s on " << min(threadCount, runs.size()) << " threads" << endl;
+	}
+	catch(const exception &e)
+	{
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
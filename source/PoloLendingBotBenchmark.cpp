@@ -0,0 +1,234 @@
+#include "PoloniexLendingBot.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Runs PoloniexLendingBot::run() against MockPoloniexServer and reports per tick costs. A tick is one pass of the
+//main loop: book statistics, plus refreshing loans when that is due. Cpu is this process's (std::clock, which is wall
+//time on Windows) so the server should run separately. Start it first:
+//  MockPoloniexServer &
+//  PoloLendingBotBenchmark --ticks 60
+namespace
+{
+	struct ServerStats
+	{
+		uint64_t requests_ = 0, rateLimited_ = 0, rejected_ = 0;
+	};
+
+	ServerStats serverStats(web::http::client::http_client &client)
+	{
+		auto response = client.request(web::http::methods::GET, U("/mock/stats")).get();
+		string body = response.extract_utf8string(true).get();
+
+		ServerStats stats;
+		JsonStreamReader reader(body);
+		JsonStreamReader::Slice key;
+		reader.beginObject();
+		while(reader.nextKey(key))
+		{
+			if(key == "requests")         stats.requests_ = reader.readUnsigned();
+			else if(key == "rateLimited") stats.rateLimited_ = reader.readUnsigned();
+			else if(key == "rejected")    stats.rejected_ = reader.readUnsigned();
+			else
+				reader.skipValue();
+		}
+		return stats;
+	}
+
+	struct Tick
+	{
+		bool refreshed_;
+		double wallMs_, cpuMs_;
+		uint64_t requests_, rateLimited_, rejected_;
+	};
+
+	double percentile(vector<double> values, double p)
+	{
+		if(values.empty())
+			return 0;
+		sort(values.begin(), values.end());
+		size_t i = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+		return values[i];
+	}
+
+	void report(const string &name, const vector<Tick> &ticks)
+	{
+		vector<double> wall, cpu, requests;
+		uint64_t rateLimited = 0, rejected = 0;
+		for(const auto &tick : ticks)
+		{
+			wall.push_back(tick.wallMs_);
+			cpu.push_back(tick.cpuMs_);
+			requests.push_back(static_cast<double>(tick.requests_));
+			rateLimited += tick.rateLimited_;
+			rejected += tick.rejected_;
+		}
+		double cpuSum = 0, requestSum = 0;
+		for(size_t i = 0; i < ticks.size(); ++i)
+		{
+			cpuSum += cpu[i];
+			requestSum += requests[i];
+		}
+		size_t n = max<size_t>(ticks.size(), 1);
+
+		cout << fixed << setprecision(2) << name << " ticks:" << ticks.size() << endl
+			<< "  tick ms        p50:" << percentile(wall, 0.5) << " p90:" << percentile(wall, 0.9) << " p99:" << percentile(wall, 0.99) << " max:" << percentile(wall, 1) << endl
+			<< "  cpu ms/tick    avg:" << cpuSum / n << " p50:" << percentile(cpu, 0.5) << " p99:" << percentile(cpu, 0.99) << endl
+			<< "  requests/tick  avg:" << requestSum / n << " max:" << percentile(requests, 1) << " 429s:" << rateLimited << " rejected:" << rejected << endl;
+	}
+
+	void writeConfig(const string &file, const string &uri, const string &feedUri, const string &key, const string &secret, const vector<string> &currencies)
+	{
+		boost::property_tree::ptree pt;
+		pt.put("key", key);
+		pt.put("secret", secret);
+		pt.put("startupStatisticsInitializeInterval", 1);
+		pt.put("updateRateStatisticsInterval", 1);
+		pt.put("refreshLoansInterval", 5);
+		pt.put("loanOrdersCacheTtl", 0);
+		pt.put("apiBaseUri", uri);
+		pt.put("loanOrderBookFeedUri", feedUri);
+		pt.put("connectionWarmup", false);
+		pt.put("flightRecorderFile", "");
+		pt.put("rateStatisticsDirectory", "");//every run starts cold
+
+		boost::property_tree::ptree coins;
+		for(const auto &currency : currencies)
+		{
+			boost::property_tree::ptree coin;
+			coin.put("lowestOffersDustSkipAmount", "5");
+			coin.put("spreadDustSkipAmount", "5");
+			coin.put("minRateSkipAmount", "0.000001");
+			coin.put("lendOrdersToSpread", 6);
+			coin.put("minLendOfferAmount", "0.01");
+			coin.put("minTotalLendOrdersToSpread", 30);
+			coin.put("maxTotalLendOrdersToSpread", 600);
+			coin.put("minDailyRate", "0.00003");
+			coin.put("maxDailyRate", "0.02");
+			coin.add_child("rateDayThresholds", boost::property_tree::ptree());
+			coin.put("autoRenewWhenNotRunning", false);
+			coin.put("stopLending", false);
+			coins.add_child(currency, coin);
+		}
+		pt.add_child("CoinSettings", coins);
+		write_json(file, pt);
+	}
+
+	void usage()
+	{
+		cerr << "usage: PoloLendingBotBenchmark [--uri URI] [--feedUri URI] [--ticks N] [--workdir DIR] [--key KEY] [--secret SECRET] [--currencies BTC,ETH,...]" << endl
+			<< "  --uri         mock server (default http://127.0.0.1:8765)" << endl
+			<< "  --feedUri     mock server's loan order book feed, ws://127.0.0.1:N of its --feedPort (default none, books are polled)" << endl
+			<< "  --ticks       main loop passes to measure (default 60)" << endl
+			<< "  --workdir     config, nonce and log files go here (default benchmark)" << endl
+			<< "  --key/secret  must match the server's (default benchmark/benchmark)" << endl
+			<< "  --currencies  must be simulated by the server (default BTC,ETH,XMR)" << endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string uri = "http://127.0.0.1:8765", feedUri, workdir = "benchmark", key = "benchmark", secret = "benchmark";
+	vector<string> currencies = { "BTC", "ETH", "XMR" };
+	size_t tickTarget = 60;
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		string value = argv[++i];
+		if(arg == "--uri")
+			uri = value;
+		else if(arg == "--feedUri")
+			feedUri = value;
+		else if(arg == "--ticks")
+			tickTarget = strtoul(value.c_str(), nullptr, 10);
+		else if(arg == "--workdir")
+			workdir = value;
+		else if(arg == "--key")
+			key = value;
+		else if(arg == "--secret")
+			secret = value;
+		else if(arg == "--currencies")
+		{
+			currencies.clear();
+			istringstream list(value);
+			string currency;
+			while(getline(list, currency, ','))
+				currencies.push_back(currency);
+		}
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	try
+	{
+		filesystem::create_directories(workdir);
+		filesystem::current_path(workdir);
+		writeConfig("config.json", uri, feedUri, key, secret, currencies);
+		logInit();
+
+		web::http::client::http_client statsClient(CppRest::Utilities::s2u(uri));
+		vector<Tick> ticks;
+		Tick current = Tick();
+		ServerStats before;
+		chrono::steady_clock::time_point wallStart;
+		clock_t cpuStart = 0;
+
+		atomic<size_t> tickCount(0);//the quit check also runs on api threads, ticks is only touched on this one
+		PoloniexLendingBot bot([&tickCount, tickTarget]() { return tickCount.load() >= tickTarget; });
+		PoloniexLendingBot::TickObserver observer;
+		observer.begin_ = [&]() {
+			before = serverStats(statsClient);
+			wallStart = chrono::steady_clock::now();
+			cpuStart = clock();
+		};
+		observer.end_ = [&](bool refreshed) {
+			current.wallMs_ = chrono::duration<double, milli>(chrono::steady_clock::now() - wallStart).count();
+			current.cpuMs_ = 1000.0 * (clock() - cpuStart) / CLOCKS_PER_SEC;
+			ServerStats after = serverStats(statsClient);
+			current.refreshed_ = refreshed;
+			current.requests_ = after.requests_ - before.requests_;
+			current.rateLimited_ = after.rateLimited_ - before.rateLimited_;
+			current.rejected_ = after.rejected_ - before.rejected_;
+			ticks.push_back(current);
+			++tickCount;
+		};
+		bot.tickObserver(observer);
+		bot.run();
+
+		vector<Tick> refreshTicks;
+		copy_if(ticks.begin(), ticks.end(), back_inserter(refreshTicks), [](const Tick &tick) { return tick.refreshed_; });
+		report("all", ticks);
+		report("refresh", refreshTicks);
+	}
+	catch(const std::exception &)
+	{
+		cerr << boost::current_exception_diagnostic_information() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
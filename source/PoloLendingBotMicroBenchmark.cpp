@@ -0,0 +1,421 @@
+#include "PoloniexLendingBot.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Times the pure compute kernels the bot runs every refresh, at book sizes the api returns (100 - 1500 offers).
+//One JSON document goes to stdout (or --out) so results from different builds and machines can be diffed:
+//  PoloLendingBotMicroBenchmark --label "$(git rev-parse --short HEAD)" --out bench.json
+namespace
+{
+	const vector<size_t> bookSizes = { 100, 250, 500, 1000, 1500 };
+	const vector<size_t> windowSizes = { 60, 900, 3600, 86400 };//rateStatisticsWindows at one sample per second
+
+	//Results are folded into this so the optimizer can't drop the measured calls.
+	volatile uint64_t g_sink = 0;
+
+	struct Result
+	{
+		string name_;
+		size_t size_;
+		uint64_t iterations_;//per sample
+		vector<double> nsPerOp_;
+		vector<pair<string, double>> counters_;//side effects per op, e.g. file writes
+	};
+
+	class Bench
+	{
+	public:
+		Bench(const string &filter, chrono::milliseconds sampleTime, size_t samples) :
+			filter_(filter),
+			sampleTime_(sampleTime),
+			samples_(samples)
+		{}
+
+		//op returns a value that depends on the work done. False if filtered out.
+		bool run(const string &name, size_t size, const function<uint64_t()> &op)
+		{
+			if(!filter_.empty() && name.find(filter_) == string::npos)
+				return false;
+
+			//grow the batch until one takes sampleTime_ so timer overhead doesn't matter
+			uint64_t iterations = 1;
+			for(;;)
+			{
+				double ns = batch(op, iterations);
+				if(ns >= chrono::duration<double, nano>(sampleTime_).count() || iterations >= (uint64_t(1) << 40))
+					break;
+				uint64_t scale = ns <= 0 ? 10 : static_cast<uint64_t>(chrono::duration<double, nano>(sampleTime_).count() / ns * 1.2) + 1;
+				iterations *= min<uint64_t>(max<uint64_t>(scale, 2), 10);
+			}
+
+			Result result = { name, size, iterations, {} };
+			for(size_t i = 0; i < samples_; ++i)
+				result.nsPerOp_.push_back(batch(op, iterations) / iterations);
+			cerr << name << "/" << size << " " << median(result.nsPerOp_) << " ns" << endl;
+			results_.push_back(result);
+			return true;
+		}
+
+		//Attached to the result of the last run
+		void counter(const string &name, double value)
+		{
+			cerr << "  " << name << " " << value << endl;
+			results_.back().counters_.emplace_back(name, value);
+		}
+
+		const vector<Result> &results() const { return results_; }
+
+		static double median(vector<double> values)
+		{
+			sort(values.begin(), values.end());
+			return values[values.size() / 2];
+		}
+
+	private:
+		string filter_;
+		chrono::milliseconds sampleTime_;
+		size_t samples_;
+		vector<Result> results_;
+
+		static double batch(const function<uint64_t()> &op, uint64_t iterations)
+		{
+			uint64_t sink = 0;
+			auto start = chrono::steady_clock::now();
+			for(uint64_t i = 0; i < iterations; ++i)
+				sink += op();
+			auto elapsed = chrono::steady_clock::now() - start;
+			g_sink += sink;
+			return chrono::duration<double, nano>(elapsed).count();
+		}
+	};
+
+	//Sorted book shaped like a live one: a few dust offers at the front, then amounts spread over a wide range.
+	LoanOrderBook makeBook(size_t size, mt19937 &rng)
+	{
+		uniform_int_distribution<int64_t> rateStep(0, 40);//FixedRate raw, 0.000001 units
+		uniform_int_distribution<int64_t> amount(1000000, 5000000000);//0.01 - 50
+		uniform_int_distribution<int64_t> dust(1000, 1000000);
+		LoanOrderBook book;
+		FixedRate::Raw rate = 100;
+		for(size_t i = 0; i < size; ++i)
+		{
+			rate += rateStep(rng);
+			book.insert(FixedRate::fromRaw(rate), FixedAmount::fromRaw(i < 5 ? dust(rng) : amount(rng)), 2, 2);
+		}
+		return book;
+	}
+
+	SpreadLendStrategy::Params makeParams(size_t bookSize)
+	{
+		SpreadLendStrategy::Params params;
+		params.lowestOffersDustSkipAmount_ = FixedAmount::parse("5");
+		params.spreadDustSkipAmount_ = FixedAmount::parse("20");
+		params.minLendOfferAmount_ = FixedAmount::parse("0.01");
+		params.minRateSkipAmount_ = FixedRate::parse("0.000005");
+		params.minDailyRate_ = FixedRate::parse("0.00005");
+		params.maxDailyRate_ = FixedRate::parse("0.05");
+		params.minTotalLendOrdersToSpread_ = 10;
+		params.maxTotalLendOrdersToSpread_ = 200;
+		//deep enough that the spread position lands near the end of the book
+		params.lendOrdersToSpread_ = static_cast<uint32_t>(max<size_t>(bookSize / 12, 2));
+		return params;
+	}
+
+	string jsonString(const string &str)
+	{
+		string out = "\"";
+		for(char ch : str)
+		{
+			if(ch == '"' || ch == '\\')
+				out += '\\';
+			if(static_cast<unsigned char>(ch) >= 0x20)
+				out += ch;
+		}
+		return out + "\"";
+	}
+
+	string architecture()
+	{
+#if defined(__aarch64__) || defined(_M_ARM64)
+		return "aarch64";
+#elif defined(__arm__) || defined(_M_ARM)
+		return "arm";
+#elif defined(__x86_64__) || defined(_M_X64)
+		return "x86_64";
+#elif defined(__i386__) || defined(_M_IX86)
+		return "x86";
+#else
+		return "unknown";
+#endif
+	}
+
+	string compiler()
+	{
+#if defined(__clang__)
+		return "clang " __clang_version__;
+#elif defined(__GNUC__)
+		return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+		return "msvc " + to_string(_MSC_VER);
+#else
+		return "unknown";
+#endif
+	}
+
+	void writeJson(ostream &os, const string &label, const vector<Result> &results)
+	{
+		os << "{" << endl
+			<< "\t\"label\": " << jsonString(label) << "," << endl
+			<< "\t\"architecture\": " << jsonString(architecture()) << "," << endl
+			<< "\t\"compiler\": " << jsonString(compiler()) << "," << endl
+#ifdef NDEBUG
+			<< "\t\"optimized\": true," << endl
+#else
+			<< "\t\"optimized\": false," << endl
+#endif
+			<< "\t\"unit\": \"ns/op\"," << endl
+			<< "\t\"benchmarks\": [" << endl;
+		os.precision(1);
+		os << fixed;
+		for(size_t i = 0; i < results.size(); ++i)
+		{
+			const Result &result = results[i];
+			os << "\t\t{ \"name\": " << jsonString(result.name_) << ", \"size\": " << result.size_ << ", \"iterations\": " << result.iterations_
+				<< ", \"median\": " << Bench::median(result.nsPerOp_)
+				<< ", \"min\": " << *min_element(result.nsPerOp_.begin(), result.nsPerOp_.end())
+				<< ", \"max\": " << *max_element(result.nsPerOp_.begin(), result.nsPerOp_.end()) << ", \"samples\": [";
+			for(size_t s = 0; s < result.nsPerOp_.size(); ++s)
+				os << (s == 0 ? "" : ", ") << result.nsPerOp_[s];
+			os << "]";
+			if(!result.counters_.empty())
+			{
+				os << ", \"counters\": { ";
+				for(size_t c = 0; c < result.counters_.size(); ++c)
+					os << (c == 0 ? "" : ", ") << jsonString(result.counters_[c].first) << ": " << result.counters_[c].second;
+				os << " }";
+			}
+			os << " }" << (i + 1 == results.size() ? "" : ",") << endl;
+		}
+		os << "\t]" << endl << "}" << endl;
+	}
+
+	void usage()
+	{
+		cerr << "usage: PoloLendingBotMicroBenchmark [--filter NAME] [--sampleMs N] [--samples N] [--label TEXT] [--out FILE]" << endl
+			<< "  --filter    only benchmarks whose name contains NAME" << endl
+			<< "  --sampleMs  minimum time per sample (default 50)" << endl
+			<< "  --samples   samples per benchmark (default 7)" << endl
+			<< "  --label     copied into the output, e.g. commit and machine" << endl
+			<< "  --out       write the JSON here instead of stdout" << endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string filter, label, outFile;
+	chrono::milliseconds sampleTime(50);
+	size_t samples = 7;
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		string value = argv[++i];
+		if(arg == "--filter")
+			filter = value;
+		else if(arg == "--sampleMs")
+			sampleTime = chrono::milliseconds(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--samples")
+			samples = max<size_t>(strtoul(value.c_str(), nullptr, 10), 1);
+		else if(arg == "--label")
+			label = value;
+		else if(arg == "--out")
+			outFile = value;
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	try
+	{
+		Bench bench(filter, sampleTime, samples);
+		mt19937 rng(1);
+
+		for(size_t size : bookSizes)
+		{
+			LoanOrderBook book = makeBook(size, rng);
+			SpreadLendStrategy::Params params = makeParams(size);
+			SpreadLendStrategy::Inputs inputs;
+			inputs.availableLendBalance_ = FixedAmount::parse("12.5");
+			inputs.activeLoanCount_ = 3;
+			inputs.beginningRate_ = book[book.size() / 20].rate_;
+			inputs.beginningRateExact_ = true;
+			inputs.recentHighRate_ = book.back().rate_ + FixedRate::fromRaw(10);//forces the read to the end of the book
+
+			//calcOptimalSpreadLendOffers minus the settings lookups and Decimal conversions
+			SpreadLendStrategy::Offers offers;
+			bench.run("optimalSpreadLendOffers", size, [&]() {
+				offers.clear();
+				size_t read = SpreadLendStrategy::optimalSpreadLendOffers(params, book, inputs, offers);
+				return static_cast<uint64_t>(read + offers.size());
+			});
+			bench.run("positionOfLastOfferToSpreadLendUnder", size, [&]() {
+				auto pos = SpreadLendStrategy::positionOfLastOfferToSpreadLendUnder(params, book);
+				return static_cast<uint64_t>(pos ? *pos : 0);
+			});
+			bench.run("lowestOfferRateAboveDustAmount", size, [&]() {
+				auto rate = SpreadLendStrategy::lowestOfferRateAboveDustAmount(params, book);
+				return static_cast<uint64_t>(rate ? rate->raw() : 0);
+			});
+
+			//what one getLoanOrders response costs to turn into text and back, per book
+			vector<string> rateStrings, amountStrings;
+			for(const auto &offer : book)
+			{
+				rateStrings.push_back(offer.rate_.toString());
+				amountStrings.push_back(offer.amount_.toString());
+			}
+			bench.run("Decimal parse", size, [&]() {
+				uint64_t sum = 0;
+				for(size_t i = 0; i < rateStrings.size(); ++i)
+				{
+					Decimal rate(rateStrings[i]), amount(amountStrings[i]);
+					sum += (rate > amount) ? 1 : 0;
+				}
+				return sum;
+			});
+			vector<Decimal> decimals;
+			for(const auto &str : amountStrings)
+				decimals.emplace_back(str);
+			bench.run("Decimal to_string", size, [&]() {
+				uint64_t sum = 0;
+				for(const auto &decimal : decimals)
+					sum += to_string(decimal, 8).size();
+				return sum;
+			});
+			bench.run("FixedPoint parse", size, [&]() {
+				uint64_t sum = 0;
+				for(size_t i = 0; i < rateStrings.size(); ++i)
+					sum += FixedRate::parse(rateStrings[i]).raw() + FixedAmount::parse(amountStrings[i]).raw();
+				return sum;
+			});
+			bench.run("FixedPoint toString", size, [&]() {
+				uint64_t sum = 0;
+				for(const auto &offer : book)
+					sum += offer.amount_.toString().size();
+				return sum;
+			});
+
+			//recording a fetched book, alternating with one where every 10th amount moved, and reading one back
+			LoanOrderBook moved;
+			for(size_t i = 0; i < book.size(); ++i)
+				moved.insert(book[i].rate_, i % 10 == 0 ? book[i].amount_ + FixedAmount::fromRaw(1) : book[i].amount_, book[i].rangeMin_, book[i].rangeMax_);
+			string historyFile = (filesystem::temp_directory_path() / "PoloLendingBotMicroBenchmark.books").string();
+			filesystem::remove(historyFile);
+			{
+				LoanOrderBookHistoryWriter history(historyFile);
+				auto time = LoanOrderBookHistory::Clock::now();
+				uint64_t n = 0;
+				bench.run("LoanOrderBookHistory append", size, [&]() {
+					history.append(time += chrono::seconds(10), ++n % 2 == 0 ? book : moved);
+					return history.bytesWritten();
+				});
+				for(int i = 0; i < 64; ++i)
+					history.append(time += chrono::seconds(10), i % 2 == 0 ? book : moved);
+			}
+			{
+				LoanOrderBookHistoryReader history(historyFile);
+				const auto &block = history.blocks().front();//a full one, 64 snapshots
+				bench.run("LoanOrderBookHistory read block", size, [&]() {
+					uint64_t sum = 0;
+					history.forEach([&sum](LoanOrderBookHistory::Clock::time_point, const LoanOrderBook &snapshot) { sum += snapshot.size(); }, block.first_, block.last_);
+					return sum;
+				});
+			}
+			filesystem::remove(historyFile);
+		}
+
+		//one sample per second at steady state, so size is the samples in the window
+		for(size_t size : windowSizes)
+		{
+			RollingRateStatistics stats({ chrono::seconds(size) });
+			uniform_int_distribution<int64_t> rate(50, 3000);
+			auto time = RollingRateStatistics::Clock::now();
+			for(size_t i = 0; i < size; ++i)
+				stats.add(time += chrono::seconds(1), FixedRate::fromRaw(rate(rng)));
+
+			bench.run("RollingRateStatistics add low high average", size, [&]() {
+				stats.add(time += chrono::seconds(1), FixedRate::fromRaw(rate(rng)));
+				const RollingRateWindow &window = stats[0];
+				return static_cast<uint64_t>(window.low().raw() + window.high().raw() + window.average().raw());
+			});
+		}
+
+		//every trading api request takes a nonce. Lease size 1 is the old save of nonce.txt per request.
+		for(uint64_t leaseSize : { uint64_t(1), NonceAllocator::defaultLeaseSize_ })
+		{
+			string nonceFile = (filesystem::temp_directory_path() / "PoloLendingBotMicroBenchmark.nonce").string();
+			filesystem::remove(nonceFile);
+			{
+				NonceAllocator nonces(nonceFile, leaseSize);
+				uint64_t handedOut = 0;
+				if(bench.run("NonceAllocator next", static_cast<size_t>(leaseSize), [&]() { ++handedOut; return nonces.next(); }))
+					bench.counter("fileWritesPer1000", static_cast<double>(nonces.persistCount()) * 1000 / static_cast<double>(handedOut));
+			}
+			filesystem::remove(nonceFile);
+		}
+
+		//trading api request bodies, nonce + command + up to 6 parameters
+		CppRest::Utilities::QueryParams params = { { "nonce", "1500000000000123" }, { "command", "createLoanOffer" }, { "currency", "BTC" },
+			{ "amount", "0.12345678" }, { "duration", "2" }, { "autoRenew", "0" }, { "lendingRate", "0.000123" } };
+		string body = CppRest::Utilities::paramsToUrlString(params);
+		bench.run("paramsToUrlString", params.size(), [&]() {
+			return static_cast<uint64_t>(CppRest::Utilities::paramsToUrlString(params).size());
+		});
+
+		const string secret(128, 'a');
+		bench.run("hmacSha512", body.size(), [&]() {
+			return static_cast<uint64_t>(CppRest::Utilities::hmacSha512(secret, body)[0]);
+		});
+		CppRest::Utilities::HmacSha512Signer signer(secret);
+		bench.run("HmacSha512Signer sign", body.size(), [&]() {
+			return static_cast<uint64_t>(signer.sign(body)[0]);
+		});
+
+		if(outFile.empty())
+			writeJson(cout, label, bench.results());
+		else
+		{
+			ofstream out(outFile);
+			writeJson(out, label, bench.results());
+			if(!out)
+				throw runtime_error("failed to write " + outFile);
+		}
+	}
+	catch(const std::exception &)
+	{
+		cerr << boost::current_exception_diagnostic_information() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+#include "BacktestSettings.hpp"
+#include "SpreadLendBacktest.hpp"
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Backtests (see PoloLendingBotBacktest) every combination of a grid of coin settings on each coin's recorded books
+//and ranks them by yield. Each coin's history is mapped once and shared by all of its runs, runs are batched so one
+//decode of the history feeds a whole batch, and batches from every coin go to a work stealing pool so a coin with a
+//longer history doesn't leave cores idle at the end:
+//  PoloLendingBotSweep --history logs/bookhistory --settings config.json --lendOrdersToSpread 3,6,10 --dayThresholdScale 0.8,1,1.2 --loanHours 72
+namespace
+{
+	struct Grid
+	{
+		vector<string> lendOrdersToSpread_ = { "3", "6", "10", "20" };
+		vector<string> lowestOffersDustSkipAmount_ = { "1", "5", "20" };
+		vector<string> spreadDustSkipAmount_ = { "1", "5", "20" };
+		vector<string> minRateSkipAmount_ = { "0.000001", "0.00001" };
+		vector<string> dayThresholdScale_ = { "1" };
+	};
+
+	struct Candidate
+	{
+		bool settings_;//the coin's settings file values, not a grid point
+		string lendOrdersToSpread_, lowestOffersDustSkipAmount_, spreadDustSkipAmount_, minRateSkipAmount_, dayThresholdScale_;
+		SpreadLendBacktest::Config config_;
+		SpreadLendBacktest::Result result_;
+	};
+
+	struct CoinSweep
+	{
+		string currency_;
+		unique_ptr<LoanOrderBookHistoryReader> history_;
+		vector<Candidate> candidates_;
+		string error_;
+	};
+
+	void usage()
+	{
+		cerr << "usage: PoloLendingBotSweep --history DIR [--settings FILE] [--balance AMOUNT] [--loanHours N] [--currencies BTC,ETH,...] [--threads N] [--batch N] [--top N] [grid...]" << endl
+			<< "  --history     loanOrderBookHistoryDirectory of the bot that recorded the books" << endl
+			<< "  --settings    bot settings file for the coin settings not in the grid, and intervals (default config.json, built in defaults if that is missing)" << endl
+			<< "  --balance     lending balance of each coin, in that coin (default 1)" << endl
+			<< "  --loanHours   how long a filled offer stays lent, at most its day term (default 24)" << endl
+			<< "  --currencies  only these (default every <currency>.books in --history)" << endl
+			<< "  --threads     worker threads (default one per core)" << endl
+			<< "  --batch       runs that share one decode of a coin's history (default 16)" << endl
+			<< "  --top         rows ranked per coin (default 10)" << endl
+			<< "grid, comma separated values, every combination is run:" << endl
+			<< "  --lendOrdersToSpread          (default 3,6,10,20)" << endl
+			<< "  --lowestOffersDustSkipAmount  (default 1,5,20)" << endl
+			<< "  --spreadDustSkipAmount        (default 1,5,20)" << endl
+			<< "  --minRateSkipAmount           (default 0.000001,0.00001)" << endl
+			<< "  --dayThresholdScale           multiplies every rateDayThresholds rate, only matters with --loanHours over 48 (default 1)" << endl;
+	}
+
+	vector<string> split(const string &value)
+	{
+		vector<string> values;
+		istringstream list(value);
+		string item;
+		while(getline(list, item, ','))
+		{
+			if(!item.empty())
+				values.push_back(item);
+		}
+		return values;
+	}
+
+	//Grid point on top of the coin's settings, validated the same way the settings file is
+	Candidate candidate(PoloniexLendingBot::Settings::Coin coin, const SpreadLendBacktest::Config &defaults,
+		const string &spread, const string &lowestDust, const string &spreadDust, const string &minRateSkip, const string &dayScale)
+	{
+		auto pt = coin.ptree();
+		pt.put("lendOrdersToSpread", spread);
+		pt.put("lowestOffersDustSkipAmount", lowestDust);
+		pt.put("spreadDustSkipAmount", spreadDust);
+		pt.put("minRateSkipAmount", minRateSkip);
+		coin.ptree(pt);
+
+		Rate scale(dayScale);
+		if(!(scale > Rate(0)))
+			throw invalid_argument("dayThresholdScale(" + dayScale + ") must be > 0");
+		decltype(coin.dayThreshold_) scaled;
+		for(const auto &threshold : coin.dayThreshold_)
+			scaled[threshold.first * scale] = threshold.second;
+		coin.dayThreshold_ = scaled;
+
+		Candidate c = { false, spread, lowestDust, spreadDust, minRateSkip, dayScale, defaults, {} };
+		c.config_.params_ = coin.strategyParams();
+		c.config_.dayThresholds_ = coin.dayThresholds();
+		return c;
+	}
+
+	bool betterThan(const Candidate &lhs, const Candidate &rhs)
+	{
+		double lhsYield = lhs.result_.annualYield(), rhsYield = rhs.result_.annualYield();
+		if(lhsYield != rhsYield)
+			return lhsYield > rhsYield;
+		return lhs.result_.privateCalls_ < rhs.result_.privateCalls_;//same yield for less api traffic
+	}
+
+	void printRow(const string &rank, const Candidate &c)
+	{
+		const auto &r = c.result_;
+		cout << right << setw(6) << rank << setw(8) << c.lendOrdersToSpread_ << setw(10) << c.lowestOffersDustSkipAmount_ << setw(10) << c.spreadDustSkipAmount_
+			<< setw(11) << c.minRateSkipAmount_ << setw(9) << c.dayThresholdScale_
+			<< fixed << setprecision(2) << setw(10) << r.annualYield() * 100 << setw(9) << r.utilization() * 100
+			<< setw(8) << r.loans_ << setw(9) << r.cancels_ + r.creates_ << setw(10) << r.privateCalls_ << endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string historyDir, settingsFile = BacktestSettings::defaultFile(), balance = "1";
+	bool settingsFileGiven = false;
+	int loanHours = 24;
+	vector<string> currencies;
+	size_t threadCount = max(1u, thread::hardware_concurrency()), batchSize = 16, top = 10;
+	Grid grid;
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		string value = argv[++i];
+		if(arg == "--history")
+			historyDir = value;
+		else if(arg == "--settings")
+		{
+			settingsFile = value;
+			settingsFileGiven = true;
+		}
+		else if(arg == "--balance")
+			balance = value;
+		else if(arg == "--loanHours")
+			loanHours = atoi(value.c_str());
+		else if(arg == "--threads")
+			threadCount = max<size_t>(1, strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--batch")
+			batchSize = max<size_t>(1, strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--top")
+			top = strtoul(value.c_str(), nullptr, 10);
+		else if(arg == "--currencies")
+			currencies = split(value);
+		else if(arg == "--lendOrdersToSpread")
+			grid.lendOrdersToSpread_ = split(value);
+		else if(arg == "--lowestOffersDustSkipAmount")
+			grid.lowestOffersDustSkipAmount_ = split(value);
+		else if(arg == "--spreadDustSkipAmount")
+			grid.spreadDustSkipAmount_ = split(value);
+		else if(arg == "--minRateSkipAmount")
+			grid.minRateSkipAmount_ = split(value);
+		else if(arg == "--dayThresholdScale")
+			grid.dayThresholdScale_ = split(value);
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(historyDir.empty() || loanHours < 1 || grid.lendOrdersToSpread_.empty() || grid.lowestOffersDustSkipAmount_.empty()
+		|| grid.spreadDustSkipAmount_.empty() || grid.minRateSkipAmount_.empty() || grid.dayThresholdScale_.empty())
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		if(currencies.empty())
+		{
+			for(filesystem::directory_iterator iter(historyDir), end; iter != end; ++iter)
+			{
+				if(iter->path().extension() == ".books")
+					currencies.push_back(iter->path().stem().string());
+			}
+			sort(currencies.begin(), currencies.end());
+		}
+
+		BacktestSettings settings(settingsFile, settingsFileGiven);
+		SpreadLendBacktest::Config defaults = settings.defaults(FixedAmount::parse(balance), loanHours);
+
+		vector<CoinSweep> sweeps(currencies.size());
+		for(size_t i = 0; i < currencies.size(); ++i)
+		{
+			CoinSweep &sweep = sweeps[i];
+			sweep.currency_ = currencies[i];
+
+			auto coin = settings.coin(sweep.currency_);
+			try
+			{
+				Candidate current = { true, to_string(coin.lendOrdersToSpread_), to_string(coin.lowestOffersDustSkipAmount_), to_string(coin.spreadDustSkipAmount_),
+					to_string(coin.minRateSkipAmount_), "1", defaults, {} };
+				current.config_.params_ = coin.strategyParams();
+				current.config_.dayThresholds_ = coin.dayThresholds();
+				sweep.candidates_.push_back(current);
+
+				for(const auto &spread : grid.lendOrdersToSpread_)
+					for(const auto &lowestDust : grid.lowestOffersDustSkipAmount_)
+						for(const auto &spreadDust : grid.spreadDustSkipAmount_)
+							for(const auto &minRateSkip : grid.minRateSkipAmount_)
+								for(const auto &dayScale : grid.dayThresholdScale_)
+									sweep.candidates_.push_back(candidate(coin, defaults, spread, lowestDust, spreadDust, minRateSkip, dayScale));
+			}
+			catch(const invalid_argument &e)
+			{
+				throw invalid_argument("curCode(" + sweep.currency_ + ") " + e.what());
+			}
+
+			try
+			{
+				sweep.history_.reset(new LoanOrderBookHistoryReader((filesystem::path(historyDir) / (sweep.currency_ + ".books")).string()));
+			}
+			catch(const exception &e)
+			{
+				sweep.error_ = e.what();
+			}
+		}
+
+		//longest histories first, so the tail of the sweep is the quick batches
+		vector<CoinSweep *> order;
+		for(auto &sweep : sweeps)
+		{
+			if(sweep.history_)
+				order.push_back(&sweep);
+		}
+		stable_sort(order.begin(), order.end(), [](const CoinSweep *lhs, const CoinSweep *rhs) { return lhs->history_->snapshots() > rhs->history_->snapshots(); });
+
+		vector<function<void()>> tasks;
+		size_t runs = 0;
+		uint64_t replayed = 0;
+		for(CoinSweep *sweep : order)
+		{
+			for(size_t first = 0; first < sweep->candidates_.size(); first += batchSize)
+			{
+				size_t last = min(first + batchSize, sweep->candidates_.size());
+				runs += last - first;
+				replayed += (last - first) * sweep->history_->snapshots();
+				tasks.push_back([sweep, first, last]() {
+					vector<SpreadLendBacktest::Config> configs;
+					for(size_t i = first; i < last; ++i)
+						configs.push_back(sweep->candidates_[i].config_);
+					auto results = SpreadLendBacktest::run(*sweep->history_, configs);
+					for(size_t i = first; i < last; ++i)
+						sweep->candidates_[i].result_ = results[i - first];
+				});
+			}
+		}
+
+		auto start = chrono::steady_clock::now();
+		{
+			WorkStealingPool pool(threadCount);
+			pool.run(move(tasks));
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		for(auto &sweep : sweeps)
+		{
+			cout << sweep.currency_;
+			if(!sweep.error_.empty())
+			{
+				cout << "  " << sweep.error_ << endl;
+				continue;
+			}
+			cout << "  " << sweep.candidates_.size() - 1 << " configs, " << fixed << setprecision(2) << sweep.candidates_.front().result_.days() << " days" << endl;
+
+			vector<const Candidate *> ranked;
+			for(const auto &c : sweep.candidates_)
+				ranked.push_back(&c);
+			stable_sort(ranked.begin(), ranked.end(), [](const Candidate *lhs, const Candidate *rhs) { return betterThan(*lhs, *rhs); });
+
+			cout << right << setw(6) << "rank" << setw(8) << "spread" << setw(10) << "lowDust" << setw(10) << "sprDust" << setw(11) << "minSkip" << setw(9) << "dayScale"
+				<< setw(10) << "yield%" << setw(9) << "util%" << setw(8) << "loans" << setw(9) << "churn" << setw(10) << "private" << endl;
+			for(size_t i = 0; i < ranked.size(); ++i)
+			{
+				//the settings file row is always shown, for comparison
+				if(i < top || ranked[i]->settings_)
+					printRow(to_string(i + 1) + (ranked[i]->settings_ ? "*" : ""), *ranked[i]);
+			}
+		}
+		cout << runs << " runs, " << replayed << " books replayed in " << setprecision(3) << seconds << "s on " << threadCount << " threads (* = settings file)" << endl;
+	}
+	catch(const exception &e)
+	{
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
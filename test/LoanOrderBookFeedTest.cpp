@@ -0,0 +1,188 @@
+#include "LoanOrderBookFeed.hpp"
+#include "MockLoanOrderBookFeedServer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Runs LoanOrderBookFeed against MockLoanOrderBookFeedServer on localhost and walks it through a snapshot, level
+//updates, a sequence gap and the resubscribe it causes, going quiet (books stop being served, polling takes over)
+//and coming back, and a dropped connection with the reconnect and resubscribe after it. Fails on the first step
+//that doesn't end up as expected within a few seconds.
+//  LoanOrderBookFeedTest [port]
+namespace
+{
+	typedef MockLoanOrderBookFeedServer::Levels Levels;
+
+	const string currency = "BTC";
+	const chrono::milliseconds staleAfter(500);
+
+	Levels makeLevels(const vector<pair<int64_t, int64_t>> &rateAmounts)//rate and amount raw
+	{
+		Levels levels;
+		for(const auto &rateAmount : rateAmounts)
+			levels[rateAmount.first] = FixedAmount::fromRaw(rateAmount.second);
+		return levels;
+	}
+
+	//What the exchange would hold: answers every subscribe with a snapshot of the current book
+	struct Exchange
+	{
+		mutex mutex_;
+		Levels levels_;
+		uint64_t sequence_ = 0;
+
+		void subscribed(MockLoanOrderBookFeedServer &server, const string &command, const string &channel)
+		{
+			if(command != "subscribe" || channel != currency)
+				return;
+			lock_guard<mutex> lock(mutex_);
+			sequence_ += 100;//snapshots restart the sequence anywhere
+			server.push(MockLoanOrderBookFeedServer::snapshot(currency, sequence_, levels_));
+		}
+
+		//Pushes the change to levels under the next sequence number, or skip numbers later to leave a gap
+		void change(MockLoanOrderBookFeedServer &server, const Levels &levels, uint64_t skip = 0)
+		{
+			lock_guard<mutex> lock(mutex_);
+			sequence_ += 1 + skip;
+			server.push(MockLoanOrderBookFeedServer::update(currency, sequence_, MockLoanOrderBookFeedServer::changes(levels_, levels)));
+			if(skip == 0)
+				levels_ = levels;
+		}
+	};
+
+	bool same(const LoanOrderBook &book, const Levels &levels)
+	{
+		if(book.size() != levels.size())
+			return false;
+		size_t i = 0;
+		for(const auto &level : levels)
+		{
+			if(book[i].rate_.raw() != level.first || !(book[i].amount_ == level.second))
+				return false;
+			++i;
+		}
+		return true;
+	}
+
+	void waitFor(const string &step, const function<bool()> &done)
+	{
+		auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+		while(!done())
+		{
+			if(chrono::steady_clock::now() > deadline)
+				throw runtime_error(step);
+			this_thread::sleep_for(chrono::milliseconds(20));
+		}
+	}
+
+	size_t count(const vector<string> &commands, const string &command)
+	{
+		return static_cast<size_t>(std::count(commands.begin(), commands.end(), command));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint16_t port = static_cast<uint16_t>(argc > 1 ? strtoul(argv[1], nullptr, 10) : 8767);
+
+	Exchange exchange;
+	Levels first = makeLevels({ { 200, 150000000 }, { 210, 20000000 }, { 230, 700000000 } });
+	exchange.levels_ = first;
+	MockLoanOrderBookFeedServer server(port, [&exchange](MockLoanOrderBookFeedServer &s, const string &command, const string &channel) {
+		exchange.subscribed(s, command, channel);
+	});
+
+	//heartbeats keep the feed current between steps, except while it is meant to go quiet
+	atomic<bool> quiet(false), stop(false);
+	thread heartbeats([&]() {
+		while(!stop)
+		{
+			if(!quiet)
+				server.push(MockLoanOrderBookFeedServer::heartbeat());
+			this_thread::sleep_for(staleAfter / 5);
+		}
+	});
+
+	int result = EXIT_SUCCESS;
+	try
+	{
+		LoanOrderBookFeed::Settings settings;
+		settings.uri_ = "ws://127.0.0.1:" + to_string(port);
+		settings.staleAfter_ = staleAfter;
+		settings.reconnectInterval_ = chrono::seconds(1);
+		LoanOrderBookFeed feed(settings);
+
+		auto book = [&feed]() { return feed.find(currency, boost::none, false); };
+		auto serves = [&book](const Levels &levels) {
+			return [&book, levels]() {
+				auto orders = book();
+				return orders && same(orders->offers_, levels);
+			};
+		};
+
+		//first ask subscribes, the snapshot answers it
+		waitFor("snapshot served", serves(first));
+
+		Levels second = makeLevels({ { 200, 100000000 }, { 220, 30000000 }, { 230, 700000000 } });
+		exchange.change(server, second);
+		waitFor("updates applied", serves(second));
+
+		//a skipped sequence number drops the book until a new snapshot
+		Levels third = makeLevels({ { 190, 50000000 }, { 200, 100000000 } });
+		size_t subscribes = count(server.commands(), "subscribe " + currency);
+		exchange.change(server, third, 1);
+		waitFor("gap resubscribed", [&]() {
+			auto commands = server.commands();
+			return count(commands, "unsubscribe " + currency) == 1 && count(commands, "subscribe " + currency) > subscribes;
+		});
+		waitFor("snapshot after gap served", serves(second));
+		if(feed.stats().gaps_ != 1)
+			throw runtime_error("one gap expected");
+		exchange.change(server, third);
+		waitFor("updates after gap applied", serves(third));
+
+		//quiet past staleAfter: not served, polling takes over
+		quiet = true;
+		this_thread::sleep_for(staleAfter * 2);
+		if(book())
+			throw runtime_error("stale book served");
+		quiet = false;
+		waitFor("served again after heartbeats", serves(third));
+
+		//dropped connection: reconnect, resubscribe, served from the new snapshot
+		uint64_t connects = server.connects();
+		subscribes = count(server.commands(), "subscribe " + currency);
+		server.closeAll();
+		waitFor("reconnected", [&]() { return server.connects() > connects && count(server.commands(), "subscribe " + currency) > subscribes; });
+		waitFor("served after reconnect", serves(third));
+		auto stats = feed.stats();
+		if(stats.disconnects_ < 1 || stats.connects_ < 2)
+			throw runtime_error("reconnect not counted: " + stats.toString());
+
+		cout << "feed " << stats.toString() << endl;
+	}
+	catch(const exception &e)
+	{
+		cerr << "failed: " << e.what() << endl;
+		result = EXIT_FAILURE;
+	}
+
+	stop = true;
+	heartbeats.join();
+	return result;
+}
@@ -0,0 +1,155 @@
+#include "LoanOrderBook.hpp"
+#include "OfferReconciler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Runs OfferReconciler on random open and planned offer sets, up to large ones, and checks every diff against a
+//brute force count of each (rate, amount): what is kept on both sides is the same multiset, nothing more could have
+//been kept, and where equal open offers are canceled it is the latest ones. Rates and amounts come from small pools
+//so duplicates and partial overlaps are common.
+//  OfferReconcilerTest [cases] [seed]
+namespace
+{
+	struct Offer
+	{
+		FixedAmount amount_;
+		FixedRate rate_;
+	};
+
+	typedef pair<int64_t, int64_t> Key;//rate, amount raw
+
+	Key key(const Offer &offer) { return { offer.rate_.raw(), offer.amount_.raw() }; }
+
+	vector<Offer> offers(mt19937_64 &random, size_t count, int64_t rates, int64_t amounts)
+	{
+		vector<Offer> result;
+		result.reserve(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			int64_t rate = uniform_int_distribution<int64_t>(1, rates)(random);
+			int64_t amount = uniform_int_distribution<int64_t>(1, amounts)(random);
+			result.push_back({ FixedAmount::fromRaw(amount * 1000000), FixedRate::fromRaw(rate * 10) });
+		}
+		return result;
+	}
+
+	//Indexes must be ascending, in range and unique
+	string checkIndexes(const vector<size_t> &indexes, size_t size)
+	{
+		for(size_t i = 0; i < indexes.size(); ++i)
+		{
+			if(indexes[i] >= size)
+				return "index out of range";
+			if(i > 0 && !(indexes[i - 1] < indexes[i]))
+				return "indexes not ascending and unique";
+		}
+		return "";
+	}
+
+	string check(const vector<Offer> &open, const vector<Offer> &planned, const OfferReconciler::Diff &diff)
+	{
+		string error = checkIndexes(diff.cancel_, open.size());
+		if(error.empty())
+			error = checkIndexes(diff.create_, planned.size());
+		if(!error.empty())
+			return error;
+
+		vector<bool> canceled(open.size()), created(planned.size());
+		for(size_t i : diff.cancel_)
+			canceled[i] = true;
+		for(size_t i : diff.create_)
+			created[i] = true;
+
+		map<Key, size_t> openCount, plannedCount, keptOpen, keptPlanned;
+		map<Key, bool> openCanceled;//a canceled offer was seen, so every later equal one must be canceled too
+		for(size_t i = 0; i < open.size(); ++i)
+		{
+			Key k = key(open[i]);
+			++openCount[k];
+			if(canceled[i])
+				openCanceled[k] = true;
+			else
+			{
+				if(openCanceled[k])
+					return "kept an open offer after canceling an earlier equal one";
+				++keptOpen[k];
+			}
+		}
+		for(size_t i = 0; i < planned.size(); ++i)
+		{
+			++plannedCount[key(planned[i])];
+			if(!created[i])
+				++keptPlanned[key(planned[i])];
+		}
+
+		if(keptOpen != keptPlanned)
+			return "kept open and kept planned offers differ";
+		for(const auto &count : openCount)
+		{
+			auto plannedEqual = plannedCount.find(count.first);
+			size_t most = plannedEqual == plannedCount.end() ? 0 : min(count.second, plannedEqual->second);
+			auto kept = keptOpen.find(count.first);
+			if((kept == keptOpen.end() ? 0 : kept->second) != most)
+				return "not the smallest diff";
+		}
+		return "";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t cases = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000;
+	uint64_t seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1;
+
+	mt19937_64 random(seed);
+	uint64_t offerCount = 0, cancels = 0, creates = 0;
+	for(uint64_t n = 0; n < cases; ++n)
+	{
+		//mostly bot sized sets, every 100th one large
+		size_t most = n % 100 == 99 ? 100000 : 200;
+		size_t openSize = uniform_int_distribution<size_t>(0, most)(random);
+		size_t plannedSize = uniform_int_distribution<size_t>(0, most)(random);
+		int64_t rates = uniform_int_distribution<int64_t>(1, 50)(random);
+		int64_t amounts = uniform_int_distribution<int64_t>(1, 20)(random);
+
+		vector<Offer> open = offers(random, openSize, rates, amounts);
+		vector<Offer> planned;
+		if(n % 2 == 0)
+			planned = offers(random, plannedSize, rates, amounts);
+		else
+		{
+			//a plan that is mostly the open offers again, shuffled, the way most refreshes look
+			planned = open;
+			shuffle(planned.begin(), planned.end(), random);
+			planned.resize(min(planned.size(), plannedSize));
+			auto extra = offers(random, plannedSize / 8, rates, amounts);
+			planned.insert(planned.end(), extra.begin(), extra.end());
+		}
+
+		auto diff = OfferReconciler::diff(open, planned);
+		string error = check(open, planned, diff);
+		if(!error.empty())
+		{
+			cerr << "case " << n << " seed " << seed << " (" << open.size() << " open, " << planned.size() << " planned): " << error << endl;
+			return EXIT_FAILURE;
+		}
+		offerCount += open.size() + planned.size();
+		cancels += diff.cancel_.size();
+		creates += diff.create_.size();
+	}
+
+	cout << cases << " cases, " << offerCount << " offers, " << cancels << " cancels, " << creates << " creates, all minimal" << endl;
+	return EXIT_SUCCESS;
+}
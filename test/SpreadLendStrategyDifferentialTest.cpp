@@ -0,0 +1,387 @@
+#include "Decimal.hpp"
+#include "SpreadLendStrategy.hpp"
+
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace tylawin;
+using namespace tylawin::poloniex;
+using namespace std;
+
+//Runs SpreadLendStrategy and the Decimal code it replaced (calcOptimalSpreadLendOffers and the functions it called,
+//copied below from the Decimal version of PoloniexLendingBot.hpp) on random books, settings and rate statistics,
+//and fails on the first case where they would submit different offers. Spread amounts that land exactly on a half
+//tick and beginning rates just under maxDailyRate_ are generated on purpose, the two came apart there before.
+//  SpreadLendStrategyDifferentialTest [cases] [seed]
+namespace
+{
+	typedef DataTypes::Decimal Decimal;
+
+	//Deliberate difference: the Decimal code stepped by the long double PoloniexApi::minimumRateIncrement_, which
+	//isn't exactly 0.000001, so its (rate - increment) sat a hair off the rate grid and a first offer exactly
+	//minRateSkipAmount_ above one tick could be skipped. The fixed code steps exactly one tick.
+	const Decimal minimumRateIncrement("0.000001");
+
+	struct DecimalSettings
+	{
+		Decimal lowestOffersDustSkipAmount_, spreadDustSkipAmount_, minRateSkipAmount_, minLendOfferAmount_, minDailyRate_, maxDailyRate_;
+		uint32_t minTotalLendOrdersToSpread_, maxTotalLendOrdersToSpread_, lendOrdersToSpread_;
+	};
+
+	struct DecimalStats
+	{
+		Decimal lendingRateLow_15m, lendingRateHigh_15m, movingAvgLendingRate_15m;
+	};
+
+	typedef vector<pair<Decimal, Decimal>> DecimalBook;//rate, amount in rate order
+
+	struct DecimalOffer
+	{
+		Decimal amount_;
+		Decimal rate_;
+	};
+
+	boost::optional<Decimal> lowestOfferRateAboveDustAmount(const DecimalBook &loanOffers, const DecimalSettings &coinSettings)
+	{
+		Decimal amt(0);
+		for(auto offer : loanOffers)
+		{
+			amt += offer.second;
+			if(amt >= coinSettings.lowestOffersDustSkipAmount_)
+				return offer.first;
+		}
+		return boost::none;
+	}
+
+	Decimal firstLendOfferRate(const DecimalBook &availableLoans, const DecimalSettings &coinSettings, const DecimalStats &coinStats)
+	{
+		boost::optional<Decimal> lowestOfferRateAboveDust = lowestOfferRateAboveDustAmount(availableLoans, coinSettings);
+		Decimal beginningRateAboveDust = lowestOfferRateAboveDust ? *lowestOfferRateAboveDust : coinSettings.maxDailyRate_ + minimumRateIncrement;
+
+		if(beginningRateAboveDust < coinSettings.minDailyRate_)
+			beginningRateAboveDust = coinSettings.minDailyRate_;
+
+		if(beginningRateAboveDust < (coinStats.lendingRateLow_15m + coinStats.movingAvgLendingRate_15m) / 2)
+			beginningRateAboveDust = (coinStats.lendingRateLow_15m + coinStats.movingAvgLendingRate_15m) / 2;
+
+		return beginningRateAboveDust;
+	}
+
+	Decimal toDecimal(const FixedAmount &value) { return Decimal(value.toString()); }
+	Decimal toDecimal(const FixedRate &value) { return Decimal(value.toString()); }
+
+	//Deliberate difference: Decimal division isn't exact, so a share of exactly half an amount tick rounded off either
+	//way depending on the digits. The fixed code rounds those ties to even and so does the reference.
+	Decimal roundOff(const Decimal &spreadLendAmount, const Decimal &availableLendBalance, uint32_t spreadLendCount)
+	{
+		FixedAmount balance = FixedAmount::parse(to_string(availableLendBalance, 8));
+		if(spreadLendCount > 1 && 2 * (balance.raw() % spreadLendCount) == spreadLendCount)
+			return toDecimal(balance.divide(spreadLendCount, Rounding::HALF_EVEN));
+		return Decimal(to_string(spreadLendAmount, 8));
+	}
+
+	//tmpSpreadLendCount is returned as spreadLendCount for roundOff
+	Decimal calcSpreadLendAmount(const DecimalSettings &coinSettings, uint32_t activeLoanCount, const Decimal &availableLendBalance, uint32_t &spreadLendCount)
+	{
+		uint32_t &tmpSpreadLendCount = spreadLendCount;
+		tmpSpreadLendCount = coinSettings.lendOrdersToSpread_;
+
+		if(activeLoanCount + tmpSpreadLendCount < std::max(activeLoanCount, tmpSpreadLendCount))
+			throw std::runtime_error("uint32_t overflow. activeLoanCount + tmpSpreadLendCount.");
+
+		if(activeLoanCount + tmpSpreadLendCount < coinSettings.minTotalLendOrdersToSpread_)
+			tmpSpreadLendCount = coinSettings.minTotalLendOrdersToSpread_;
+
+		if(activeLoanCount + tmpSpreadLendCount > coinSettings.maxTotalLendOrdersToSpread_)
+		{
+			if(activeLoanCount > coinSettings.maxTotalLendOrdersToSpread_)
+				tmpSpreadLendCount = 0u;
+			else
+				tmpSpreadLendCount = coinSettings.maxTotalLendOrdersToSpread_ - activeLoanCount;
+		}
+
+		if(tmpSpreadLendCount == 0u)
+		{
+			if(availableLendBalance < coinSettings.minLendOfferAmount_)
+				return Decimal(0u);
+			else
+				return availableLendBalance;
+		}
+
+		while(availableLendBalance / tmpSpreadLendCount < coinSettings.minLendOfferAmount_)
+		{
+			tmpSpreadLendCount -= 1u;
+			if(tmpSpreadLendCount == 0u)
+				return Decimal(0u);
+		}
+
+		return availableLendBalance / tmpSpreadLendCount;
+	}
+
+	vector<DecimalOffer> calcOptimalSpreadLendOffers(const DecimalBook &availableLoans, const DecimalSettings &coinSettings, const DecimalStats &coinStats, uint32_t activeLoanCount, Decimal availableLendBalance)
+	{
+		vector<DecimalOffer> optimalOffers;
+
+		if(availableLendBalance < coinSettings.minLendOfferAmount_)
+			return optimalOffers;
+
+		Decimal beginningRateAboveDust = firstLendOfferRate(availableLoans, coinSettings, coinStats);
+
+		if(beginningRateAboveDust >= coinSettings.maxDailyRate_ || availableLoans.size() == 0)
+		{
+			if(beginningRateAboveDust == coinSettings.maxDailyRate_)
+				optimalOffers.push_back({ availableLendBalance, coinSettings.maxDailyRate_ - minimumRateIncrement });
+			else
+				optimalOffers.push_back({ availableLendBalance, coinSettings.maxDailyRate_ });
+		}
+		else
+		{
+			uint32_t spreadLendCount;
+			Decimal spreadLendAmount = calcSpreadLendAmount(coinSettings, activeLoanCount, availableLendBalance, spreadLendCount);
+
+			spreadLendAmount = roundOff(spreadLendAmount, availableLendBalance, spreadLendCount);//round off
+
+			uint16_t createLoanOfferCount = 0;
+			Decimal offerAmountSum(0);
+			Decimal previousCreatedOfferRate(0);
+			for(auto offer : availableLoans)
+			{
+				const Decimal &rate = offer.first;
+				if((rate - minimumRateIncrement) - previousCreatedOfferRate < coinSettings.minRateSkipAmount_)
+					continue;
+
+				offerAmountSum += offer.second;
+
+				if(offerAmountSum > coinSettings.spreadDustSkipAmount_ && rate >= beginningRateAboveDust && offer.second > coinSettings.spreadDustSkipAmount_ / 2)
+				{
+					if(availableLendBalance - spreadLendAmount < 0 || availableLendBalance - spreadLendAmount < coinSettings.minLendOfferAmount_)
+						spreadLendAmount = availableLendBalance;
+					previousCreatedOfferRate = rate - minimumRateIncrement;
+					optimalOffers.push_back({ spreadLendAmount, previousCreatedOfferRate });
+					availableLendBalance -= spreadLendAmount;
+					++createLoanOfferCount;
+					offerAmountSum = 0;
+				}
+				if(availableLendBalance == 0 || createLoanOfferCount >= coinSettings.lendOrdersToSpread_)
+					break;
+			}
+
+			if(availableLendBalance > coinSettings.minLendOfferAmount_ && previousCreatedOfferRate + minimumRateIncrement < coinStats.lendingRateHigh_15m)
+			{
+				const Decimal &lastRate = availableLoans.rbegin()->first;
+				if(lastRate < coinStats.lendingRateHigh_15m)
+				{
+					if(availableLendBalance - spreadLendAmount != 0.0 && availableLendBalance - spreadLendAmount < coinSettings.minLendOfferAmount_)
+						spreadLendAmount = availableLendBalance;
+					optimalOffers.push_back({ spreadLendAmount, coinStats.lendingRateHigh_15m - minimumRateIncrement });
+					availableLendBalance -= spreadLendAmount;
+				}
+			}
+
+			if(availableLendBalance > coinSettings.minLendOfferAmount_)
+				optimalOffers.push_back({ availableLendBalance, coinSettings.maxDailyRate_ });
+		}
+
+		return optimalOffers;
+	}
+
+	struct Case
+	{
+		SpreadLendStrategy::Params params_;
+		LoanOrderBook book_;
+		vector<FixedRate> samples_;//recent lowestOfferRateAboveDustAmount
+		FixedAmount balance_;
+		uint32_t activeLoanCount_;
+	};
+
+	class Generator
+	{
+	public:
+		explicit Generator(uint64_t seed) : random_(seed) {}
+
+		uint64_t uniform(uint64_t low, uint64_t high) { return uniform_int_distribution<uint64_t>(low, high)(random_); }
+		bool oneIn(uint64_t n) { return uniform(1, n) == 1; }
+
+		FixedAmount amount()
+		{
+			switch(uniform(0, 3))
+			{
+				case 0: return FixedAmount::fromRaw(static_cast<int64_t>(uniform(1, 100000)));//dust
+				case 1: return FixedAmount::fromRaw(static_cast<int64_t>(uniform(1, 100)) * 100000000);//whole coins
+				default: return FixedAmount::fromRaw(static_cast<int64_t>(uniform(1, 5000000000)));
+			}
+		}
+
+		Case next(bool &halfTick, bool &underMax)
+		{
+			Case c;
+			SpreadLendStrategy::Params &p = c.params_;
+			const FixedAmount dust[] = { FixedAmount::parse("0.00000001"), FixedAmount::parse("0.5"), FixedAmount::parse("1"), FixedAmount::parse("5"), FixedAmount::parse("20") };
+			const FixedAmount minOffer[] = { FixedAmount::parse("0.00000001"), FixedAmount::parse("0.0001"), FixedAmount::parse("0.001"), FixedAmount::parse("0.01"), FixedAmount::parse("1") };
+			p.lowestOffersDustSkipAmount_ = dust[uniform(0, 4)];
+			p.spreadDustSkipAmount_ = dust[uniform(0, 4)];
+			p.minLendOfferAmount_ = minOffer[uniform(0, 4)];
+			p.minRateSkipAmount_ = FixedRate::fromRaw(static_cast<int64_t>(uniform(1, 20)));
+			p.minDailyRate_ = FixedRate::fromRaw(static_cast<int64_t>(uniform(1, 500)));
+			p.maxDailyRate_ = FixedRate::fromRaw(static_cast<int64_t>(uniform(100, 50000)));
+			p.minTotalLendOrdersToSpread_ = static_cast<uint32_t>(uniform(1, 50));
+			p.maxTotalLendOrdersToSpread_ = static_cast<uint32_t>(uniform(1, 700));
+			p.lendOrdersToSpread_ = static_cast<uint32_t>(uniform(1, 50));
+			c.activeLoanCount_ = static_cast<uint32_t>(uniform(0, 700));
+			c.balance_ = amount();
+
+			//mostly below maxDailyRate_ so the spread loop runs, sometimes empty, sometimes past it
+			int64_t tick = static_cast<int64_t>(uniform(1, static_cast<uint64_t>(p.maxDailyRate_.raw())));
+			size_t size = oneIn(20) ? 0 : static_cast<size_t>(uniform(1, 300));
+			for(size_t i = 0; i < size; ++i)
+			{
+				c.book_.insert(FixedRate::fromRaw(tick), amount(), 2, 2);
+				tick += static_cast<int64_t>(uniform(0, 5));
+			}
+
+			size_t count = oneIn(10) ? 0 : static_cast<size_t>(uniform(1, 100));
+			for(size_t i = 0; i < count; ++i)
+			{
+				if(!c.book_.empty() && !oneIn(4))
+					c.samples_.push_back(c.book_[static_cast<size_t>(uniform(0, c.book_.size() - 1))].rate_);
+				else
+					c.samples_.push_back(FixedRate::fromRaw(static_cast<int64_t>(uniform(1, static_cast<uint64_t>(p.maxDailyRate_.raw())))));
+			}
+
+			halfTick = oneIn(8);
+			if(halfTick)
+			{
+				//balance / lendOrdersToSpread_ ends in exactly half an amount tick
+				uint32_t n = 2 * static_cast<uint32_t>(uniform(1, 25));
+				p.lendOrdersToSpread_ = n;
+				p.minTotalLendOrdersToSpread_ = 1;
+				p.maxTotalLendOrdersToSpread_ = 50000;
+				p.minLendOfferAmount_ = FixedAmount::parse("0.00000001");
+				c.activeLoanCount_ = 0;
+				c.balance_ = FixedAmount::fromRaw(static_cast<int64_t>(n / 2) * (2 * static_cast<int64_t>(uniform(1, 100000000)) + 1));
+			}
+
+			underMax = false;
+			if(!c.samples_.empty() && oneIn(8))
+			{
+				//(low + average) / 2 just under a tick, and that tick is maxDailyRate_
+				FixedRate low = *min_element(c.samples_.begin(), c.samples_.end());
+				int64_t sum = 0;
+				for(const auto &rate : c.samples_)
+					sum += rate.raw();
+				int64_t numerator = low.raw() * static_cast<int64_t>(c.samples_.size()) + sum, denominator = 2 * static_cast<int64_t>(c.samples_.size());
+				if(numerator % denominator != 0)
+				{
+					p.maxDailyRate_ = FixedRate::fromRaw(numerator / denominator + 1);
+					underMax = true;
+				}
+			}
+			return c;
+		}
+
+	private:
+		mt19937_64 random_;
+	};
+
+	string describe(const Case &c)
+	{
+		const auto &p = c.params_;
+		ostringstream os;
+		os << "balance:" << c.balance_.toString() << " activeLoans:" << c.activeLoanCount_ << " lowestDust:" << p.lowestOffersDustSkipAmount_.toString()
+			<< " spreadDust:" << p.spreadDustSkipAmount_.toString() << " minRateSkip:" << p.minRateSkipAmount_.toString() << " minOffer:" << p.minLendOfferAmount_.toString()
+			<< " minDaily:" << p.minDailyRate_.toString() << " maxDaily:" << p.maxDailyRate_.toString() << " spread:" << p.lendOrdersToSpread_
+			<< " minTotal:" << p.minTotalLendOrdersToSpread_ << " maxTotal:" << p.maxTotalLendOrdersToSpread_ << " book:" << c.book_.size() << " samples:" << c.samples_.size();
+		return os.str();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t cases = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000;
+	uint64_t seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1;
+
+	Generator generator(seed);
+	uint64_t halfTicks = 0, underMaxes = 0, offers = 0;
+	for(uint64_t n = 0; n < cases; ++n)
+	{
+		bool halfTick, underMax;
+		Case c = generator.next(halfTick, underMax);
+		halfTicks += halfTick;
+		underMaxes += underMax;
+		const auto &p = c.params_;
+
+		DecimalSettings settings = { toDecimal(p.lowestOffersDustSkipAmount_), toDecimal(p.spreadDustSkipAmount_), toDecimal(p.minRateSkipAmount_), toDecimal(p.minLendOfferAmount_),
+			toDecimal(p.minDailyRate_), toDecimal(p.maxDailyRate_), p.minTotalLendOrdersToSpread_, p.maxTotalLendOrdersToSpread_, p.lendOrdersToSpread_ };
+		DecimalBook book;
+		for(const auto &offer : c.book_)
+			book.push_back({ toDecimal(offer.rate_), toDecimal(offer.amount_) });
+
+		//LendingStatistics of the Decimal version, -1 until there are samples
+		DecimalStats stats = { Decimal(-1), Decimal(-1), Decimal(-1) };
+		SpreadLendStrategy::RecentRates recent = SpreadLendStrategy::RecentRates();
+		if(!c.samples_.empty())
+		{
+			recent.low_ = *min_element(c.samples_.begin(), c.samples_.end());
+			recent.high_ = *max_element(c.samples_.begin(), c.samples_.end());
+			Decimal sum(0);
+			for(const auto &rate : c.samples_)
+			{
+				recent.sum_ += rate.raw();
+				sum += toDecimal(rate);
+			}
+			recent.count_ = c.samples_.size();
+			stats = { toDecimal(recent.low_), toDecimal(recent.high_), sum / c.samples_.size() };
+
+			//Deliberate difference: averageRate divided inexactly too, so a (low + average) / 2 exactly on a rate tick
+			//could come out a hair above it and push the first spread offer up a tick. The fixed code takes the
+			//midpoint exactly, so when it is on a tick the reference gets an average that puts it there.
+			int64_t count = static_cast<int64_t>(recent.count_);
+			int64_t numerator = recent.low_.raw() * count + recent.sum_;
+			if(numerator % (2 * count) == 0)
+				stats.movingAvgLendingRate_15m = toDecimal(FixedRate::fromRaw(numerator / count - recent.low_.raw()));
+		}
+
+		auto expected = calcOptimalSpreadLendOffers(book, settings, stats, c.activeLoanCount_, toDecimal(c.balance_));
+
+		SpreadLendStrategy::Offers actual;
+		if(!(c.balance_ < p.minLendOfferAmount_))
+		{
+			auto inputs = SpreadLendStrategy::inputs(p, c.book_, recent, c.balance_, c.activeLoanCount_);
+			SpreadLendStrategy::optimalSpreadLendOffers(p, c.book_, inputs, actual);
+		}
+
+		//compared as submitted: createLoanOffer sends amounts at 8 decimals and rates at 6
+		bool same = expected.size() == actual.size();
+		for(size_t i = 0; same && i < actual.size(); ++i)
+		{
+			same = FixedAmount::parse(to_string(expected[i].amount_, 8)) == actual[i].amount_
+				&& FixedRate::parse(to_string(expected[i].rate_, 6)) == actual[i].rate_;
+		}
+		offers += actual.size();
+
+		if(!same)
+		{
+			cerr << "case " << n << " seed " << seed << " differs: " << describe(c) << endl << "  decimal:";
+			for(const auto &offer : expected)
+				cerr << " " << to_string(offer.amount_, 8) << "@" << to_string(offer.rate_, 6);
+			cerr << endl << "  fixed:  ";
+			for(const auto &offer : actual)
+				cerr << " " << offer.amount_.toString() << "@" << offer.rate_.toString();
+			cerr << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	cout << cases << " cases (" << halfTicks << " half tick spread amounts, " << underMaxes << " beginning rates just under maxDailyRate) " << offers << " offers, all identical" << endl;
+	return EXIT_SUCCESS;
+}